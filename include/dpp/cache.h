@@ -24,33 +24,324 @@
 #include <dpp/discord.h>
 #include <map>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <utility>
+#include <functional>
+#include <unordered_map>
 
 namespace dpp {
 
 	/**
-	 * @brief A set of cached managed objects
+	 * @brief A set of cached managed objects, keyed by snowflake id.
+	 *
+	 * This is an open addressing hash table with linear probing, storing each
+	 * id and pointer pair inline in one flat array. Compared to a node based
+	 * std::unordered_map there is no heap allocation per entry, and a lookup
+	 * usually touches a single cache line. Snowflakes are mixed with a
+	 * multiplicative hash before use, as their low bits are a per-process
+	 * increment.
+	 *
+	 * An empty slot is marked by a null pointer, so nullptr can't be stored.
+	 * Deleting shifts following entries back rather than leaving tombstones,
+	 * so erasing invalidates iterators.
+	 *
+	 * Each slot also has an age, counted in calls to age_all() since the entry
+	 * was inserted or last touched. This gives an approximate least recently
+	 * used order for eviction, for the cost of two bytes per slot.
+	 *
+	 * @note This replaced a std::unordered_map, and code which used the old
+	 * container directly may need changes:
+	 * - insert() can grow the table and move every entry, so it invalidates
+	 *   all iterators and references, where std::unordered_map kept them valid.
+	 * - erase() returns nothing and invalidates all iterators, so the
+	 *   `it = c.erase(it)` idiom no longer works. To erase while iterating,
+	 *   collect the ids first and erase them afterwards.
+	 * - There is no operator[], at(), count() or const_iterator, and the key
+	 *   in value_type is not const but must not be changed.
 	 */
-	typedef std::unordered_map<uint64_t, managed*> cache_container;
+	class DPP_EXPORT cache_container {
+	public:
+		/**
+		 * @brief An id and the object stored against it
+		 */
+		typedef std::pair<uint64_t, managed*> value_type;
+
+		/**
+		 * @brief Forward iterator over the occupied slots of the table
+		 */
+		class iterator {
+			/** Current slot */
+			value_type* pos;
+			/** One past the last slot */
+			value_type* last;
+
+			/** Move forward to the next occupied slot */
+			void skip() {
+				while (pos != last && !pos->second) {
+					++pos;
+				}
+			}
+		public:
+			iterator(value_type* p, value_type* l) : pos(p), last(l) {
+				skip();
+			}
+
+			value_type& operator*() const {
+				return *pos;
+			}
+
+			value_type* operator->() const {
+				return pos;
+			}
+
+			iterator& operator++() {
+				++pos;
+				skip();
+				return *this;
+			}
+
+			bool operator==(const iterator& other) const {
+				return pos == other.pos;
+			}
+
+			bool operator!=(const iterator& other) const {
+				return pos != other.pos;
+			}
+		};
+
+	private:
+		/** Slot array, slot_count entries long */
+		value_type* slots;
+
+		/** Number of slots, zero or a power of two */
+		size_t slot_count;
+
+		/** Right shift which reduces a 64 bit hash to a slot index */
+		unsigned int slot_shift;
+
+		/** Age of the entry in each slot, slot_count entries long */
+		std::atomic<uint16_t>* ages;
+
+		/** Number of occupied slots */
+		size_t element_count;
+
+		/**
+		 * @brief Get the preferred slot for an id
+		 * 
+		 * @param key id
+		 * @return size_t slot index
+		 */
+		size_t home(uint64_t key) const;
+
+		/**
+		 * @brief Move all entries into a new slot array
+		 * 
+		 * @param new_count New number of slots, zero or a power of two
+		 */
+		void resize(size_t new_count);
+
+		/**
+		 * @brief Get the smallest slot count which can hold a number
+		 * of entries without going over the maximum load
+		 * 
+		 * @param elements number of entries
+		 * @return size_t slot count
+		 */
+		static size_t slots_for(size_t elements);
+
+	public:
+		/**
+		 * @brief Construct an empty container. No memory is allocated
+		 * until the first insert.
+		 */
+		cache_container();
+
+		/**
+		 * @brief Destroy the container. The objects it points to are not deleted.
+		 */
+		~cache_container();
+
+		cache_container(const cache_container&) = delete;
+
+		cache_container& operator=(const cache_container&) = delete;
+
+		/**
+		 * @brief Find an entry by id
+		 * 
+		 * @param key id to find
+		 * @return iterator to the entry, or end() if it isn't present
+		 */
+		iterator find(uint64_t key);
+
+		/**
+		 * @brief Insert an entry, if no entry with the same id exists
+		 * 
+		 * @param value id and object pointer, which must not be nullptr
+		 * @return std::pair<iterator, bool> iterator to the entry with this id, and
+		 * true if it was inserted, or false if one already existed
+		 */
+		std::pair<iterator, bool> insert(const value_type& value);
+
+		/**
+		 * @brief Remove an entry. Invalidates all iterators.
+		 * 
+		 * @param it iterator to the entry to remove
+		 */
+		void erase(iterator it);
+
+		/**
+		 * @brief Remove an entry by id. Invalidates all iterators.
+		 * 
+		 * @param key id to remove
+		 * @return size_t number of entries removed, zero or one
+		 */
+		size_t erase(uint64_t key);
+
+		/**
+		 * @brief Remove all entries and free the slot array
+		 */
+		void clear();
+
+		/**
+		 * @brief Allocate enough slots to hold a number of entries without
+		 * growing again
+		 * 
+		 * @param elements number of entries
+		 */
+		void reserve(size_t elements);
+
+		/**
+		 * @brief Shrink the slot array to the smallest size that can hold
+		 * the current entries
+		 */
+		void shrink_to_fit();
+
+		/**
+		 * @brief Get the number of entries
+		 * 
+		 * @return size_t number of entries
+		 */
+		size_t size() const;
+
+		/**
+		 * @brief Returns true if there are no entries
+		 * 
+		 * @return true if empty
+		 */
+		bool empty() const;
+
+		/**
+		 * @brief Get the number of slots allocated
+		 * 
+		 * @return size_t number of slots
+		 */
+		size_t capacity() const;
+
+		/**
+		 * @brief Get the size of the memory allocated for the slot array
+		 * 
+		 * @return size_t size in bytes
+		 */
+		size_t bytes() const;
+
+		/**
+		 * @brief Get the age of an entry
+		 * 
+		 * @param it iterator to the entry
+		 * @return uint16_t number of calls to age_all() since the entry was
+		 * inserted or touched
+		 */
+		uint16_t get_age(iterator it) const;
+
+		/**
+		 * @brief Mark an entry as recently used, resetting its age to zero.
+		 * Safe to call while holding only a shared lock.
+		 * 
+		 * @param it iterator to the entry
+		 */
+		void touch(iterator it);
+
+		/**
+		 * @brief Add one to the age of every entry, saturating at the maximum.
+		 * Safe to call while holding only a shared lock.
+		 */
+		void age_all();
+
+		/**
+		 * @brief Get an iterator to the first entry
+		 * 
+		 * @return iterator first entry
+		 */
+		iterator begin();
+
+		/**
+		 * @brief Get an iterator to one past the last entry
+		 * 
+		 * @return iterator end
+		 */
+		iterator end();
+	};
 
 	/**
 	 * @brief A cache object maintains a cache of dpp::managed objects.
 	 * This is for example users, channels or guilds.
+	 *
+	 * The cache is split into a number of lock stripes. Each stripe holds
+	 * the objects whose ids hash to it, and has its own reader/writer lock,
+	 * so that lookups from many shard threads at once only contend with
+	 * writers to the same stripe, and never with each other.
 	 */
 	class DPP_EXPORT cache {
 	private:
 
-		/** Mutex to protect the cache */
-		std::mutex cache_mutex;
+		/**
+		 * @brief A single lock stripe of the cache
+		 */
+		struct cache_stripe {
+			/** Mutex to protect the stripe */
+			std::shared_mutex stripe_mutex;
+
+			/** Cached items in this stripe */
+			cache_container cache_map;
+		};
+
+		/** Number of stripes, always a power of two */
+		size_t stripe_count;
+
+		/** Array of stripe_count stripes */
+		cache_stripe* stripes;
+
+		/** Longest time any one stripe was locked during the last rehash, in seconds */
+		std::atomic<double> rehash_pause;
+
+		/** Number of objects removed by evict() */
+		std::atomic<uint64_t> evicted;
+
+		/** Mutex returned by the deprecated get_mutex() */
+		std::mutex legacy_mutex;
+
+		/** Copy of every stripe returned by the deprecated get_container() */
+		std::unordered_map<snowflake, managed*> legacy_map;
 
-		/** Cached items */
-		cache_container* cache_map;
+		/**
+		 * @brief Get the stripe an id belongs to
+		 * 
+		 * @param id Object id
+		 * @return cache_stripe& stripe containing the id
+		 */
+		cache_stripe& get_stripe(snowflake id);
 
 	public:
 
 		/**
 		 * @brief Construct a new cache object
+		 * 
+		 * @param stripe_count Number of lock stripes. Rounded up to the
+		 * nearest power of two. Use more stripes for caches which are
+		 * read or written heavily from many shards at once.
 		 */
-		cache();
+		cache(size_t stripe_count = 1);
 
 		/**
 		 * @brief Destroy the cache object
@@ -62,59 +353,375 @@ namespace dpp {
 		 */
 		void store(managed* object);
 
+		/**
+		 * @brief Store an object unless one with the same id is already cached,
+		 * in which case a function is called on the cached one with its stripe
+		 * still locked. The object passed in is then not stored, and still
+		 * belongs to the caller.
+		 * 
+		 * @param object object to store
+		 * @param found Called with the cached object, if there is one
+		 * @return managed* the object which is now cached
+		 */
+		managed* store_or_find(managed* object, std::function<void(managed*)> found);
+
 		/** Remove an object from the cache.
 		 * @param object object to remove
 		 */
 		void remove(managed* object);
 
-		/** Find an object in the cache by id.
+		/** Find an object in the cache by id, and mark it as recently used.
 		 * @param id Object id to find
 		 */
 		managed* find(snowflake id);
 
+		/**
+		 * @brief Find an object in the cache by id, mark it as recently used, and
+		 * call a function on it while its stripe is still locked for reading. The
+		 * object can't be removed by remove_if() while the function runs.
+		 * 
+		 * @param id Object id to find
+		 * @param found Called with the object if it is found
+		 * @return managed* object, or nullptr if not found
+		 */
+		managed* find(snowflake id, std::function<void(managed*)> found);
+
+		/**
+		 * @brief Remove and retire an object if a predicate, called with the
+		 * object's stripe locked for writing, agrees.
+		 * 
+		 * @param id Object id to remove
+		 * @param can_remove Called with the object if it is found. Return false to keep it.
+		 * @return true if the object was removed
+		 */
+		bool remove_if(snowflake id, std::function<bool(managed*)> can_remove);
+
+		/**
+		 * @brief Find an object in the cache by id without marking it as
+		 * recently used
+		 * 
+		 * @param id Object id to find
+		 * @param age Set to the object's age, see cache::age()
+		 * @return managed* object, or nullptr if not found
+		 */
+		managed* peek(snowflake id, uint16_t& age);
+
+		/**
+		 * @brief Add one to the age of every object in the cache. Storing or
+		 * finding an object resets its age to zero, so when this is called at
+		 * a regular interval an object's age tells you roughly how many
+		 * intervals ago it was last used.
+		 */
+		void age();
+
+		/**
+		 * @brief Remove and retire every object of at least a given age which
+		 * the predicate agrees can be evicted. Stripes are processed one at a time.
+		 * 
+		 * @param min_age Minimum age to evict
+		 * @param can_evict Called for each object old enough to evict, with the
+		 * stripe locked. Return false to keep the object.
+		 * @return size_t number of objects evicted
+		 */
+		size_t evict(uint16_t min_age, std::function<bool(managed*)> can_evict);
+
+		/**
+		 * @brief Get the total number of objects removed by evict()
+		 * 
+		 * @return uint64_t number of objects evicted
+		 */
+		uint64_t get_evicted_count() const;
+
 		/** Return a count of the number of items in the cache.
 		 */
 		uint64_t count();
 
+		/**
+		 * @brief Get the number of lock stripes in the cache
+		 * 
+		 * @return size_t number of stripes
+		 */
+		size_t get_stripe_count() const;
+
 		/** 
-		 * @brief Return the cache's locking mutex. Use this whenever
-		 * you manipulate or iterate raw elements in the cache!
+		 * @brief Return the locking mutex of one of the cache's stripes.
+		 * Use this whenever you manipulate or iterate raw elements in the
+		 * cache! Take a std::shared_lock to iterate, and a std::unique_lock
+		 * to modify.
 		 * 
-		 * @return The mutex used to protect the container
+		 * @param stripe Stripe index, less than get_stripe_count()
+		 * @return The mutex used to protect the stripe's container
 		 */
-		std::mutex& get_mutex();
+		std::shared_mutex& get_mutex(size_t stripe);
 
 		/**
-		 * @brief Get the container map
+		 * @brief Get the container map of one of the cache's stripes.
+		 * To visit every object in the cache, iterate every stripe
+		 * from 0 to get_stripe_count() - 1.
 		 * @warning Be sure to use cache::get_mutex() correctly if you
 		 * manipulate or iterate the map returned by this method! If you do
 		 * not, this is not thread safe and will cause crashes!
 		 * @see cache::get_mutex
 		 * 
-		 * @return cache_container& A reference to the cache's container map
+		 * @param stripe Stripe index, less than get_stripe_count()
+		 * @return cache_container& A reference to the stripe's container map
 		 */
-		cache_container& get_container();
+		cache_container& get_container(size_t stripe);
 
 		/**
-		 * @brief "Rehash" a cache by cleaning out used RAM
-		 * @warning May be time consuming!
+		 * @brief Return the mutex which guards the map returned by the
+		 * deprecated get_container(). It does not lock the cache itself.
+		 * 
+		 * @deprecated The cache is split into lock stripes. Use
+		 * get_mutex(size_t) and get_container(size_t) for each stripe instead.
+		 * @return std::mutex& mutex to hold while using get_container()
+		 */
+		[[deprecated("Use get_mutex(size_t) for each stripe")]] std::mutex& get_mutex();
+
+		/**
+		 * @brief Get a map of every object in the cache, copied from all of
+		 * its stripes. Changes to the map are not reflected in the cache, and
+		 * objects in it may be removed from the cache while you use them, so
+		 * pin an epoch_guard for as long as you hold on to them.
+		 * 
+		 * @deprecated The cache is split into lock stripes. Use
+		 * get_mutex(size_t) and get_container(size_t) for each stripe instead.
+		 * @warning Hold the mutex returned by get_mutex() while calling this and
+		 * using the map.
+		 * @return std::unordered_map<snowflake, managed*>& copy of the cache's contents
+		 */
+		[[deprecated("Use get_container(size_t) for each stripe")]] std::unordered_map<snowflake, managed*>& get_container();
+
+		/**
+		 * @brief "Rehash" a cache by cleaning out used RAM.
+		 * Only stripes whose slot arrays have become sparse are shrunk,
+		 * one stripe at a time, so lookups are only ever blocked on the one
+		 * stripe being shrunk and only for as long as it takes.
 		 */
 		void rehash();
 
 		/**
-		 * @brief Get "real" size in RAM of the cache
+		 * @brief Get the longest time that lookups on any one stripe were
+		 * blocked by the last call to rehash()
 		 * 
-		 * @return size_t 
+		 * @return double pause in seconds
+		 */
+		double get_rehash_pause() const;
+
+		/**
+		 * @brief Get "real" size in RAM of the cache, including all
+		 * container slots but not the cached objects themselves
+		 * 
+		 * @return size_t size in bytes
 		 */
 		size_t bytes();
 
 	};
 
-	/** Run garbage collection across all caches removing deleted items
-	 * that have been deleted over 60 seconds ago.
+	/**
+	 * @brief An epoch_guard pins the calling thread into the current cache
+	 * reclamation epoch for as long as it exists.
+	 *
+	 * Objects which are removed or replaced in a dpp::cache are not deleted
+	 * straight away. They are retired, and freed once no thread which was
+	 * pinned at the time they were retired is still pinned, and at least 60 seconds
+	 * have passed. Pointers you get from dpp::find_user() and friends are therefore
+	 * valid until your guard is destroyed. Pointers used without a guard, such as
+	 * message::author, stay valid for 60 seconds after the object leaves the cache.
+	 *
+	 * Shard and voice events, and REST completion callbacks, are already
+	 * called from inside a guard. If you look up cached objects from a thread of
+	 * your own, hold an epoch_guard while you use them. Guards may be nested.
+	 * @warning Don't hold a guard for long periods, as nothing retired while you
+	 * hold it can be freed until you release it.
+	 */
+	class DPP_EXPORT epoch_guard {
+	public:
+		/**
+		 * @brief Pin the calling thread
+		 */
+		epoch_guard();
+
+		/**
+		 * @brief Unpin the calling thread, unless this guard is nested in another
+		 */
+		~epoch_guard();
+
+		epoch_guard(const epoch_guard&) = delete;
+
+		epoch_guard& operator=(const epoch_guard&) = delete;
+	};
+
+	/**
+	 * @brief Get the number of retired cache objects which are waiting for
+	 * every thread that could see them to unpin, and for their grace period
+	 * to pass, before they are freed.
+	 * 
+	 * @return size_t number of objects awaiting reclamation
+	 */
+	size_t DPP_EXPORT get_retired_count();
+
+	/** Run garbage collection across all caches, freeing any retired
+	 * objects which are no longer visible to any thread, and releasing unused
+	 * memory held by the caches.
 	 */
 	void DPP_EXPORT garbage_collection();
 
+	/**
+	 * @brief Seconds between calls to sweep_user_cache() and evict_guild_members()
+	 * by a cluster with the cp_bounded user policy, which is the unit user ages are
+	 * counted in
+	 */
+	#define DPP_USER_SWEEP_INTERVAL 60
+
+	/**
+	 * @brief Age the user cache and evict users which have not been used recently
+	 * enough. Used by clusters with the cp_bounded user policy, where the first
+	 * shard calls it every DPP_USER_SWEEP_INTERVAL seconds; an object's age is the
+	 * number of calls since it was last stored or found.
+	 * 
+	 * @param ttl Evict users not used for this many seconds, 0 for no limit
+	 * @param memory_limit Approximate budget in bytes for cached users and guild
+	 * members. The least recently used users are evicted until the estimated size
+	 * is within budget. 0 for no limit.
+	 */
+	void DPP_EXPORT sweep_user_cache(time_t ttl, size_t memory_limit);
+
+	/**
+	 * @brief Evict the guild members of one shard's guilds whose users were
+	 * evicted, or would be, by the last call to sweep_user_cache(). Must only be
+	 * called from the thread of the shard which owns the guilds.
+	 * 
+	 * @param shard_id Shard whose guilds to check
+	 * @param keep A user id whose members are never evicted, e.g. the bot's own
+	 * @return size_t number of members evicted
+	 */
+	size_t DPP_EXPORT evict_guild_members(uint32_t shard_id, snowflake keep);
+
+	/**
+	 * @brief Find a cached user and add a guild membership to its refcount. This
+	 * is done with the user's cache stripe locked, so that it can't interleave
+	 * with release_user() dropping the last membership and removing the user.
+	 * 
+	 * @param user_id User to find
+	 * @return user* the user, or nullptr if it isn't cached
+	 */
+	user* DPP_EXPORT acquire_user(snowflake user_id);
+
+	/**
+	 * @brief Cache a new user, who is a member of one guild. If another thread
+	 * cached the same user first, a membership is added to that one as if by
+	 * acquire_user() and the new user is deleted.
+	 * 
+	 * @param u User to cache, with a refcount of 1
+	 * @return user* the user which is now cached
+	 */
+	user* DPP_EXPORT store_user(user* u);
+
+	/**
+	 * @brief Drop a guild membership from a cached user's refcount, and remove
+	 * the user from the cache once it is a member of no guilds. Both happen with
+	 * the user's cache stripe locked, see acquire_user().
+	 * 
+	 * @param user_id User to release
+	 * @return true if the user was removed from the cache
+	 */
+	bool DPP_EXPORT release_user(snowflake user_id);
+
+	/**
+	 * @brief Get the total number of users evicted from the user cache
+	 * 
+	 * @return uint64_t number of users evicted
+	 */
+	uint64_t DPP_EXPORT get_evicted_user_count();
+
+	/**
+	 * @brief Get the total number of guild members evicted
+	 * 
+	 * @return uint64_t number of members evicted
+	 */
+	uint64_t DPP_EXPORT get_evicted_member_count();
+
+	/**
+	 * @brief Write the contents of the user, role, channel, emoji and guild caches,
+	 * including guild members, to a binary snapshot file. The file is written
+	 * beside the target and then renamed over it, so a failed save never leaves a
+	 * partial snapshot. Snapshots can only be loaded on the platform and library
+	 * version that wrote them. Nothing else may change the caches while a
+	 * snapshot is saved, so call this only once every shard has stopped.
+	 * 
+	 * @param filename File to write
+	 * @return size_t number of objects written
+	 * @throw dpp::exception if the file can't be written
+	 */
+	size_t DPP_EXPORT cache_snapshot_save(const std::string& filename);
+
+	/**
+	 * @brief Load a snapshot written by cache_snapshot_save() into the caches.
+	 * The whole file is read before anything is cached, so a truncated or corrupt
+	 * snapshot leaves the caches as they were. Objects which are already cached are
+	 * left alone. Guilds which are loaded are remembered so that their next
+	 * GUILD_CREATE refreshes them in full, and anything which is never confirmed is
+	 * later dropped by cache_snapshot_prune().
+	 * 
+	 * @param filename File to read
+	 * @return size_t number of objects loaded, 0 if the file doesn't exist
+	 * @throw dpp::exception if the file is not a valid snapshot
+	 */
+	size_t DPP_EXPORT cache_snapshot_load(const std::string& filename);
+
+	/**
+	 * @brief Check if a guild was loaded from a snapshot and has not yet been
+	 * refreshed. Returns true at most once for each loaded guild.
+	 * 
+	 * @param guild_id Guild to check
+	 * @return true if the guild came from a snapshot and should be refreshed
+	 */
+	bool DPP_EXPORT cache_snapshot_reconcile(snowflake guild_id);
+
+	/**
+	 * @brief Mark a guild member loaded from a snapshot as confirmed by an event,
+	 * so that cache_snapshot_prune() keeps it. Returns true at most once for each
+	 * loaded member.
+	 * 
+	 * @param guild_id Guild the member belongs to
+	 * @param user_id User id of the member
+	 * @return true if the member came from a snapshot and should be refreshed
+	 */
+	bool DPP_EXPORT cache_snapshot_confirm_member(snowflake guild_id, snowflake user_id);
+
+	/**
+	 * @brief Mark a role, channel or emoji loaded from a snapshot as listed by its
+	 * guild's GUILD_CREATE, so that cache_snapshot_prune() keeps it.
+	 * 
+	 * @param guild_id Guild the object belongs to
+	 * @param id Id of the role, channel or emoji
+	 * @return true if the object came from a snapshot
+	 */
+	bool DPP_EXPORT cache_snapshot_confirm_object(snowflake guild_id, snowflake id);
+
+	/**
+	 * @brief Check if a user was loaded from a snapshot and has not yet been
+	 * refreshed. Returns true at most once for each loaded user.
+	 * 
+	 * @param user_id User to check
+	 * @return true if the user came from a snapshot and should be refreshed
+	 */
+	bool DPP_EXPORT cache_snapshot_refresh_user(snowflake user_id);
+
+	/**
+	 * @brief Drop every guild, guild member, role, channel and emoji loaded from
+	 * a snapshot which belongs to a shard and has not been confirmed by an event. Users are dropped
+	 * once they are no longer a member of any guild. Each shard calls this once it
+	 * has been ready for long enough to have received all of its GUILD_CREATEs and
+	 * member chunks, and it must be called from that shard's own thread.
+	 * 
+	 * @param shard_id Shard whose guilds to prune
+	 * @param max_shards Total number of shards across all clusters
+	 * @return size_t number of guilds, members, roles, channels and emojis dropped
+	 */
+	size_t DPP_EXPORT cache_snapshot_prune(uint32_t shard_id, uint32_t max_shards);
+
 	#define cache_decl(type, setter, getter, counter) DPP_EXPORT type * setter (snowflake id); DPP_EXPORT cache * getter ();  DPP_EXPORT uint64_t counter ();
 
 	/* Declare major caches */
@@ -21,6 +21,7 @@
 
 #pragma once
 #include <dpp/export.h>
+#include <dpp/slab.h>
 #include <dpp/json_fwd.hpp>
 
 namespace dpp {
@@ -193,6 +194,11 @@ public:
 	/** Destructor */
 	virtual ~channel();
 
+	/**
+	 * @brief channel objects are allocated from a slab, as many are cached at once
+	 */
+	slab_decl(channel);
+
 	/** Read class values from json object
 	 * @param j A json object to read from
 	 * @return A reference to self
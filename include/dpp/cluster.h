@@ -30,6 +30,7 @@
 #include <dpp/json_fwd.hpp>
 #include <dpp/discordclient.h>
 #include <dpp/queues.h>
+#include <dpp/reactor.h>
 
 using  json = nlohmann::json;
 
@@ -231,6 +232,12 @@ class DPP_EXPORT cluster {
 	/** True if to use compression on shards */
 	bool compressed;
 
+	/**
+	 * @brief Type of compression used by shards when compressed is true.
+	 * See cluster::set_transport_compression.
+	 */
+	transport_compression_t transport_compression;
+
 	/**
 	 * @brief Lock to prevent concurrent access to dm_channels
 	 */
@@ -252,6 +259,11 @@ class DPP_EXPORT cluster {
 	 */
 	shard_list shards;
 
+	/**
+	 * @brief Reactor which handles the shards' connections, or nullptr if each shard runs on its own thread
+	 */
+	reactor* shard_reactor;
+
 	/**
 	 * @brief Accepts result from /gateway/bot REST API call and populates numshards with it
 	 *
@@ -300,6 +312,17 @@ public:
 	 */
 	websocket_protocol_t ws_mode;
 
+	/**
+	 * @brief Largest websocket message accepted by shards and voice connections, or 0 to use the
+	 * websocket default of 64MB. See cluster::set_websocket_max_message_size.
+	 */
+	size_t ws_max_message_size;
+
+	/**
+	 * @brief Cache snapshot file, or empty if snapshots are not used
+	 */
+	std::string cache_snapshot;
+
 	/**
 	 * @brief Constructor for creating a cluster. All but the token are optional.
 	 * @param token The bot token to use for all HTTP commands and websocket connections
@@ -310,8 +333,11 @@ public:
 	 * @param maxclusters The total number of clusters that are active, which may be on separate processes or even separate machines.
 	 * @param compressed Whether or not to use compression for shards on this cluster. Saves a ton of bandwidth at the cost of some CPU
 	 * @param policy Set the user caching policy for the cluster, either lazy (only cache users/members when they message the bot) or aggressive (request whole member lists on seeing new guilds too)
+	 * @param request_threads The number of threads sending REST requests. Requests in different rate limit buckets are sent in parallel, up to this many at once.
+	 * @param completion_threads The number of threads calling REST completion callbacks. If more than one, your callbacks must be thread safe.
+	 * @param ordered_completions If true, REST completion callbacks for the same channel, guild or webhook are called one at a time, in order. If false, they may be called concurrently and in any order.
 	 */
-	cluster(const std::string &token, uint32_t intents = i_default_intents, uint32_t shards = 0, uint32_t cluster_id = 0, uint32_t maxclusters = 1, bool compressed = true, cache_policy_t policy = {cp_aggressive, cp_aggressive, cp_aggressive});
+	cluster(const std::string &token, uint32_t intents = i_default_intents, uint32_t shards = 0, uint32_t cluster_id = 0, uint32_t maxclusters = 1, bool compressed = true, cache_policy_t policy = {cp_aggressive, cp_aggressive, cp_aggressive}, uint32_t request_threads = 4, uint32_t completion_threads = 1, bool ordered_completions = true);
 
 	/**
 	 * @brief dpp::cluster is non-copyable
@@ -339,6 +365,125 @@ public:
 	 */
 	cluster& set_websocket_protocol(websocket_protocol_t mode);
 
+	/**
+	 * @brief Set the largest websocket message accepted from Discord by shards and voice connections
+	 * on this cluster. Messages split into fragments are reassembled and count as one message.
+	 * A shard which receives a bigger message drops the connection and reconnects.
+	 * You should call this method before cluster::start.
+	 * 
+	 * @param bytes Size in bytes, or 0 for the default of 64MB
+	 * @return cluster& Reference to self for chaining.
+	 */
+	cluster& set_websocket_max_message_size(size_t bytes);
+
+	/**
+	 * @brief Set the type of compression used by shards on this cluster, when compression
+	 * is enabled in the constructor. The default is tc_zlib_stream. tc_zstd_stream takes much
+	 * less CPU to decompress.
+	 * You should call this method before cluster::start.
+	 * 
+	 * @param compression Type of compression
+	 * @return cluster& Reference to self for chaining.
+	 * @throw dpp::exception if compression is tc_zstd_stream and D++ was built without libzstd
+	 */
+	cluster& set_transport_compression(transport_compression_t compression);
+
+	/**
+	 * @brief Keep a snapshot of the caches on disk between runs.
+	 * When set, cluster::start loads the snapshot before connecting any shards, so
+	 * that cached users, guilds, roles, channels and emojis are available within
+	 * seconds of boot. Each guild is then refreshed as its GUILD_CREATE arrives. The
+	 * snapshot is written again when the cluster is destroyed.
+	 * You should call this method before cluster::start.
+	 * 
+	 * @param filename Snapshot file, or an empty string to disable snapshots.
+	 * @return cluster& Reference to self for chaining.
+	 */
+	cluster& set_cache_snapshot(const std::string &filename);
+
+	/**
+	 * @brief Set the size and idle timeout of the pools of keep-alive connections used
+	 * for REST requests. Reusing a connection saves a TCP connect and TLS handshake on
+	 * every request after the first.
+	 * 
+	 * @param max_idle_per_host Maximum number of idle connections kept open to each host
+	 * @param idle_seconds Seconds an idle connection is kept open before it is closed
+	 * @return cluster& Reference to self for chaining.
+	 */
+	cluster& set_rest_pool(size_t max_idle_per_host, time_t idle_seconds);
+
+	/**
+	 * @brief Get the connection pool metrics of REST requests made to Discord
+	 * 
+	 * @return http_pool_stats metrics, including how often connections were reused
+	 * and the average latency of requests on new and reused connections
+	 */
+	http_pool_stats get_rest_pool_stats();
+
+	/**
+	 * @brief Get the rate limit metrics of REST requests made to Discord
+	 * 
+	 * @return ratelimit_stats metrics, including how many 429s were avoided by
+	 * holding requests until their bucket reset, and how many were received
+	 */
+	ratelimit_stats get_rest_ratelimit_stats();
+
+	/**
+	 * @brief Get the memory metrics of REST requests made to Discord
+	 * 
+	 * @return queue_memory_stats metrics, including the bytes held by requests and
+	 * replies which have not yet been through their callbacks, and the high water mark
+	 */
+	queue_memory_stats get_rest_memory_stats();
+
+	/**
+	 * @brief Get the latency histogram of a priority lane of REST requests made to Discord
+	 * 
+	 * @param lane Priority lane, e.g. dpp::hp_interaction for interaction responses
+	 * @return latency_histogram time from requests being posted until their reply arrived
+	 */
+	latency_histogram get_rest_latency_stats(http_priority lane);
+
+	/**
+	 * @brief Cache successful replies to REST GET requests to Discord for a short time.
+	 * Identical GETs, such as several handlers fetching the same user, are then answered
+	 * without a request or using up rate limit. Identical GETs made while one is in flight
+	 * always share its reply, whether or not the cache is on.
+	 * 
+	 * @param ttl_seconds Seconds to cache replies for, or 0 to turn the cache off, which is the default
+	 * @return cluster& Reference to self for chaining.
+	 */
+	cluster& set_rest_response_cache(double ttl_seconds);
+
+	/**
+	 * @brief Get the metrics of REST GET requests to Discord which were answered by sharing
+	 * the reply of an identical request or from the response cache
+	 * 
+	 * @return coalesce_stats metrics
+	 */
+	coalesce_stats get_rest_coalesce_stats();
+
+	/**
+	 * @brief Run the shards of this cluster on a fixed number of threads, instead of each shard
+	 * having a thread of its own. Each thread handles many shards with epoll, and only wakes up when
+	 * one of them has something to do. You should call this method before cluster::start.
+	 * 
+	 * This is only supported on Linux. On other platforms a warning is logged and each shard
+	 * keeps its own thread. Voice connections always have their own thread, as they pace audio by sleeping.
+	 * 
+	 * @param threads Number of threads to run the shards on, or 0 for a thread per shard, which is the default
+	 * @return cluster& Reference to self for chaining.
+	 * @throw dpp::exception if the cluster has already started
+	 */
+	cluster& set_shard_threads(size_t threads);
+
+	/**
+	 * @brief Get the reactor which handles the shards' connections
+	 * 
+	 * @return reactor* reactor, or nullptr if each shard runs on its own thread
+	 */
+	reactor* get_reactor();
+
 	/**
 	 * @brief Set the audit log reason for the next REST call to be made.
 	 * This is set per-thread, so you must ensure that if you call this method, your request that
@@ -987,8 +1132,26 @@ public:
 	 * @param callback Function to call when the HTTP call completes. The callback parameter will contain amongst other things, the decoded json.
 	 * @param filename Filename to post for POST requests (for uploading files)
 	 * @param filecontent File content to post for POST requests (for uploading files)
+	 * @param priority Priority lane of the request
+	 */
+	void post_rest(const std::string &endpoint, const std::string &major_parameters, const std::string &parameters, http_method method, const std::string &postdata, json_encode_t callback, const std::string &filename = "", const std::string &filecontent = "", http_priority priority = hp_normal);
+
+	/**
+	 * @brief Post a REST request with any number of files, sent as a multipart body which is
+	 * streamed to Discord rather than put together in memory.
+	 *
+	 * @param endpoint Endpoint to post to, e.g. /api/guilds
+	 * @param major_parameters Major parameters for the endpoint e.g. a guild id
+	 * @param parameters Minor parameters for the API request
+	 * @param method Method, e.g. POST, PATCH
+	 * @param postdata Post data (usually JSON encoded), sent as the payload_json part
+	 * @param callback Function to call when the HTTP call completes. The callback parameter will contain amongst other things, the decoded json.
+	 * @param filename Filename of a file to send before the uploads, or empty for none
+	 * @param filecontent File content of a file to send before the uploads
+	 * @param uploads Files to upload. Copies of an in-memory upload share its content, so this doesn't copy file content
+	 * @param priority Priority lane of the request
 	 */
-	void post_rest(const std::string &endpoint, const std::string &major_parameters, const std::string &parameters, http_method method, const std::string &postdata, json_encode_t callback, const std::string &filename = "", const std::string &filecontent = "");
+	void post_rest(const std::string &endpoint, const std::string &major_parameters, const std::string &parameters, http_method method, const std::string &postdata, json_encode_t callback, const std::string &filename, const std::string &filecontent, std::vector<http_upload> uploads, http_priority priority = hp_normal);
 
 	/**
 	 * @brief Make a HTTP(S) request. For use when wanting asnyncronous access to HTTP APIs outside of Discord.
@@ -34,6 +34,7 @@
 #include <thread>
 #include <deque>
 #include <mutex>
+#include <atomic>
 
 using json = nlohmann::json;
 
@@ -51,6 +52,68 @@ class cluster;
  */
 class zlibcontext;
 
+/** This is an opaque class containing zstd library specific structures,
+ * for the same reason as zlibcontext.
+ */
+class zstdcontext;
+
+/**
+ * @brief Result of decompressing a zstd-stream frame
+ */
+enum zstd_status {
+	/** The frame was decompressed */
+	zs_ok = 0,
+	/** The frame isn't valid zstd, or doesn't follow on from the frames before it */
+	zs_corrupt = 1,
+	/** The message is bigger than allowed */
+	zs_too_big = 2
+};
+
+/**
+ * @brief Decompresses a zstd-stream gateway connection. There is one stream for the
+ * whole connection, which Discord flushes at the end of every message, so unlike
+ * zlib-stream each frame decompresses to a whole message.
+ */
+class DPP_EXPORT zstd_stream {
+	/** libzstd's decompression state, created by the first reset() */
+	zstdcontext* context;
+public:
+	/**
+	 * @brief Construct a zstd_stream. Call reset() before decompressing.
+	 */
+	zstd_stream();
+
+	~zstd_stream();
+
+	zstd_stream(const zstd_stream&) = delete;
+
+	zstd_stream& operator=(const zstd_stream&) = delete;
+
+	/**
+	 * @brief Returns true if D++ was built with libzstd, and zstd-stream can be used
+	 */
+	static bool available();
+
+	/**
+	 * @brief Start a new stream, for a new connection. The decompression state is reused.
+	 * 
+	 * @throw dpp::exception if D++ was built without libzstd, or the stream can't be initialised
+	 */
+	void reset();
+
+	/**
+	 * @brief Decompress a frame onto the end of a buffer
+	 * 
+	 * @param input Compressed frame
+	 * @param output Buffer to append the decompressed message to
+	 * @param max_size Largest size output may grow to
+	 * @param error Set to a description of the problem when the result isn't zs_ok
+	 * @return zstd_status zs_ok once decompressed. Otherwise the stream is broken, and
+	 * must be reset, with a new connection, before it is used again.
+	 */
+	zstd_status decompress(std::string_view input, std::string& output, size_t max_size, std::string& error);
+};
+
 /**
  * @brief Represents a connection to a voice channel.
  * A client can only connect to one voice channel per guild at a time, so these are stored in a map
@@ -168,19 +231,45 @@ private:
 	/** Thread this shard is executing on */
 	std::thread* runner;
 
+	/** Thread reconnecting this shard after it was disconnected from the cluster's reactor, if there is one */
+	std::thread* reconnector;
+
+	/** Protects reconnector, and terminating from being set while a reconnection starts */
+	std::mutex reconnect_mutex;
+
+	/** True when the shard is being destroyed, so must not reconnect */
+	std::atomic<bool> terminating;
+
 	/**
 	 * @brief Run shard loop under a thread.
 	 * Calls discord_client::Run() from within a std::thread.
 	 */
 	void ThreadRun();
 
+	/**
+	 * @brief Close the connection and connect again, retrying every 5 seconds until it succeeds
+	 */
+	void Reconnect();
+
+	/**
+	 * @brief Called by the cluster's reactor when the connection has ended.
+	 * Reconnects on a thread of its own, so as not to hold up the other shards on the reactor thread,
+	 * then adds the shard back to the reactor. The destructor waits for the thread.
+	 */
+	void ReactorDisconnected();
+
 	/** If true, stream compression is enabled */
 	bool compressed;
 
-	/** ZLib decompression buffer */
-	unsigned char* decomp_buffer;
+	/** The type of stream compression used when it is enabled */
+	transport_compression_t compression;
 
-	/** Decompressed string */
+	/**
+	 * @brief Decompressed text of the message being received. Frames are inflated straight
+	 * into the end of it as they arrive, and it is cleared once the message is handled,
+	 * keeping its capacity, so that it is only reallocated when a message is bigger than
+	 * any before it.
+	 */
 	std::string decompressed;
 
 	/**
@@ -191,12 +280,33 @@ private:
 	 */
 	zlibcontext* zlib;
 
+	/**
+	 * @brief zstd decompression stream. It is created when the shard first connects
+	 * using zstd-stream, and reused for every frame and connection after that.
+	 */
+	zstd_stream* zstd;
+
 	/** Total decompressed received bytes */
 	uint64_t decompressed_total;
 
+	/** Total time spent decompressing, in microseconds */
+	uint64_t decompress_time;
+
 	/** Last connect time of cluster */
 	time_t connect_time;
 
+	/** Time since which this shard has been ready with nothing left to send, or 0 */
+	time_t snapshot_settled;
+
+	/** True once this shard has pruned what it didn't confirm from a cache snapshot */
+	bool snapshot_pruned;
+
+	/** Last time the caches were garbage collected and swept, if this is the first shard */
+	time_t last_cache_sweep;
+
+	/** Last time members of this shard's guilds were evicted */
+	time_t last_member_eviction;
+
 	/** Time last ping sent to websocket, in fractional seconds */
 	double ping_start;
 
@@ -214,7 +324,7 @@ private:
 	std::string jsonobj_to_string(const nlohmann::json& json);
 
 	/**
-	 * @brief Initialise ZLib (websocket compression)
+	 * @brief Initialise ZLib or zstd (websocket compression)
 	 */
 	void SetupZLib();
 
@@ -223,6 +333,31 @@ private:
 	 */
 	void EndZLib();
 
+	/**
+	 * @brief Called when the compressed stream can't be decoded. Drops the connection,
+	 * so that the shard reconnects with a new stream.
+	 */
+	void StreamBroken();
+
+	/**
+	 * @brief Decompress a zlib-stream frame onto the end of the decompressed buffer
+	 *
+	 * @param buffer Compressed frame
+	 * @return int 1 if the frame completes a message, 0 if more frames are needed,
+	 * or -1 if the stream is broken and the connection is being dropped
+	 */
+	int InflateFrame(std::string_view buffer);
+
+	/**
+	 * @brief Decompress a zstd-stream frame onto the end of the decompressed buffer.
+	 * Every frame is a whole message.
+	 *
+	 * @param buffer Compressed frame
+	 * @return int 1 once decompressed, or -1 if the stream is broken and the connection
+	 * has been closed
+	 */
+	int DecompressZstdFrame(std::string_view buffer);
+
 public:
 	/** Owning cluster */
 	class dpp::cluster* creator;
@@ -361,10 +496,12 @@ public:
 	 * @param _max_shards The total number of shards across all clusters
 	 * @param _token The bot token to use for identifying to the websocket
 	 * @param intents Privileged intents to use, a bitmask of values from dpp::intents
-	 * @param compressed True if the received data will be gzip compressed
+	 * @param compressed True if the received data will be compressed
 	 * @param ws_protocol Websocket protocol to use for the connection, JSON or ETF
+	 * @param compression Type of compression to use if compressed is true
+	 * @throw dpp::exception if compression is tc_zstd_stream and D++ was built without libzstd
 	 */
-	discord_client(dpp::cluster* _cluster, uint32_t _shard_id, uint32_t _max_shards, const std::string &_token, uint32_t intents = 0, bool compressed = true, websocket_protocol_t ws_protocol = ws_json);
+	discord_client(dpp::cluster* _cluster, uint32_t _shard_id, uint32_t _max_shards, const std::string &_token, uint32_t intents = 0, bool compressed = true, websocket_protocol_t ws_protocol = ws_json, transport_compression_t compression = tc_zlib_stream);
 
 	/** Destructor */
 	virtual ~discord_client();
@@ -372,10 +509,24 @@ public:
 	/** Get decompressed total bytes received */
 	uint64_t get_decompressed_bytes_in();
 
+	/**
+	 * @brief Get the average speed of decompression
+	 *
+	 * @return double megabytes of decompressed output per second spent decompressing,
+	 * or 0 if nothing has been decompressed yet
+	 */
+	double get_decompression_rate();
+
 	/** Handle JSON from the websocket.
 	 * @param buffer The entire buffer content from the websocket client
 	 * @returns True if a frame has been handled
 	 */
+	virtual bool HandleFrame(std::string_view buffer);
+
+	/** Handle JSON from the websocket. Forwards to HandleFrame(std::string_view).
+	 * @param buffer The entire buffer content from the websocket client
+	 * @returns True if a frame has been handled
+	 */
 	virtual bool HandleFrame(const std::string &buffer);
 
 	/** Handle a websocket error.
@@ -385,8 +536,7 @@ public:
 
 	/**
 	 * @brief Start and monitor I/O loop.
-	 * Note that this is a blocking call and is usually executed within a
-	 * thread by whatever creates the object.
+	 * The loop runs on a new thread, or on the cluster's reactor if it has one.
 	 */
 	void Run();
 
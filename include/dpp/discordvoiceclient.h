@@ -413,6 +413,12 @@ public:
 	 * @param buffer The entire buffer content from the websocket client
 	 * @returns True if a frame has been handled
 	 */
+	virtual bool HandleFrame(std::string_view buffer);
+
+	/** Handle JSON from the websocket. Forwards to HandleFrame(std::string_view).
+	 * @param buffer The entire buffer content from the websocket client
+	 * @returns True if a frame has been handled
+	 */
 	virtual bool HandleFrame(const std::string &buffer);
 
 	/** Handle a websocket error.
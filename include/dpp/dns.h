@@ -0,0 +1,128 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * Copyright 2021 Craig Edwards and D++ contributors 
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <string>
+#include <vector>
+#include <future>
+#include <ctime>
+#include <cstdint>
+
+struct sockaddr;
+
+namespace dpp {
+
+/**
+ * @brief An address which a hostname resolved to
+ */
+struct DPP_EXPORT dns_address {
+	/** Address family, e.g. AF_INET or AF_INET6 */
+	int family;
+	/** Socket type, e.g. SOCK_STREAM */
+	int socktype;
+	/** Protocol, e.g. IPPROTO_TCP */
+	int protocol;
+	/** The raw bytes of a sockaddr of the address family */
+	std::string addr;
+
+	/**
+	 * @brief Get the address, to pass to connect()
+	 *
+	 * @return const sockaddr* address
+	 */
+	const sockaddr* get_sockaddr() const;
+
+	/**
+	 * @brief Get the size of the address, to pass to connect()
+	 *
+	 * @return size_t size in bytes
+	 */
+	size_t get_size() const;
+};
+
+/**
+ * @brief The addresses a hostname resolved to, in the order they should be tried
+ */
+typedef std::vector<dns_address> dns_result;
+
+/**
+ * @brief Metrics of the DNS cache
+ */
+struct DPP_EXPORT dns_stats {
+	/** Lookups sent to the system resolver */
+	uint64_t lookups = 0;
+	/** Requests answered from the cache */
+	uint64_t cache_hits = 0;
+	/** Requests which waited for a lookup of the same hostname that was already running */
+	uint64_t shared = 0;
+	/** Failed lookups which were answered with the expired addresses from before */
+	uint64_t stale_used = 0;
+	/** Hostnames in the cache */
+	uint64_t entries = 0;
+};
+
+/**
+ * @brief Resolve a hostname without blocking.
+ *
+ * Results are cached for the DNS cache TTL, and all the requests for a hostname which
+ * come in while it is being looked up share the one lookup. This means that when every
+ * shard reconnects at once, the gateway hostname is looked up only once. If a lookup fails,
+ * the addresses from before it expired are used, if there are any.
+ *
+ * Lookups run on up to four resolver threads, which are started as they are needed, so a
+ * lookup stuck in the system resolver only holds up requests for the same hostname, until
+ * four are stuck at once. At most 256 different hostnames can be waiting for a thread; past
+ * that, requests fail straight away unless there are expired addresses to use.
+ *
+ * @param hostname Hostname to resolve
+ * @param port Port or service name to connect to
+ * @return std::shared_future<dns_result> addresses. Getting them throws dpp::exception if the lookup failed.
+ */
+DPP_EXPORT std::shared_future<dns_result> resolve_hostname_async(const std::string& hostname, const std::string& port);
+
+/**
+ * @brief Resolve a hostname, waiting for the result on the calling thread.
+ * See resolve_hostname_async() for how results are cached and shared.
+ *
+ * @param hostname Hostname to resolve
+ * @param port Port or service name to connect to
+ * @param timeout Seconds to wait for the lookup
+ * @return dns_result addresses
+ * @throw dpp::exception if the lookup failed or timed out
+ */
+DPP_EXPORT dns_result resolve_hostname(const std::string& hostname, const std::string& port, time_t timeout = 10);
+
+/**
+ * @brief Set how long resolved addresses are cached for. The system resolver doesn't
+ * tell us the TTL of the records it looked up, so the same TTL is used for every hostname.
+ *
+ * @param seconds TTL in seconds, or 0 to look up every hostname each time. The default is 300.
+ */
+DPP_EXPORT void set_dns_cache_ttl(time_t seconds);
+
+/**
+ * @brief Get metrics of the DNS cache
+ *
+ * @return dns_stats metrics
+ */
+DPP_EXPORT dns_stats get_dns_stats();
+
+};
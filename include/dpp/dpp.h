@@ -33,4 +33,6 @@
 #include <dpp/cluster.h>
 #include <dpp/cache.h>
 #include <dpp/queues.h>
+#include <dpp/dns.h>
+#include <dpp/reactor.h>
 #include <dpp/commandhandler.h>
\ No newline at end of file
@@ -20,6 +20,7 @@
  ************************************************************************************/
 #pragma once
 #include <dpp/export.h>
+#include <dpp/slab.h>
 #include <dpp/discord.h>
 #include <dpp/json_fwd.hpp>
 
@@ -82,6 +83,11 @@ public:
 	 */
 	virtual ~emoji();
 
+	/**
+	 * @brief emoji objects are allocated from a slab, as many are cached at once
+	 */
+	slab_decl(emoji);
+
 	/**
 	 * @brief Read class values from json object
 	 * 
@@ -35,6 +35,7 @@
 #include <dpp/export.h>
 #include <dpp/discord.h>
 #include <dpp/nlohmann/json.hpp>
+#include <string_view>
 
 namespace dpp {
 
@@ -568,7 +569,7 @@ public:
 	 * @param in Raw binary ETF data (generally from a websocket)
 	 * @return nlohmann::json JSON data for use in the library
 	 */
-	nlohmann::json parse(const std::string& in);
+	nlohmann::json parse(std::string_view in);
 
 	/**
 	 * @brief Create ETF binary data from nlohmann::json
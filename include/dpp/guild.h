@@ -25,6 +25,7 @@
 #include <unordered_map>
 #include <map>
 #include <dpp/voicestate.h>
+#include <dpp/small_vector.h>
 
 namespace dpp {
 
@@ -111,19 +112,115 @@ enum guild_member_flags {
 	gm_pending =		0b00100
 };
 
+/**
+ * @brief An immutable string shared between every holder of the same value.
+ *
+ * Equal strings are stored once in a process wide table, split into lock
+ * stripes by hash, and each interned_string is a single pointer to its
+ * reference counted entry. An empty
+ * string takes no storage at all. This suits values which are usually empty
+ * and often repeated, such as nicknames of a user across many guilds.
+ */
+class DPP_EXPORT interned_string {
+public:
+	/** Opaque shared entry, defined in guild.cpp */
+	struct entry;
+
+private:
+	/** Entry for this value, or nullptr if empty */
+	entry* e;
+
+	/** Drop our reference to e */
+	void release();
+
+public:
+	/** Construct an empty string */
+	interned_string();
+
+	/**
+	 * @brief Construct an interned copy of a string
+	 * 
+	 * @param value string value
+	 */
+	interned_string(const std::string& value);
+
+	interned_string(const interned_string& other);
+
+	interned_string(interned_string&& other) noexcept;
+
+	~interned_string();
+
+	interned_string& operator=(const interned_string& other);
+
+	interned_string& operator=(interned_string&& other) noexcept;
+
+	/**
+	 * @brief Replace the value
+	 * 
+	 * @param value new string value
+	 * @return interned_string& reference to self
+	 */
+	interned_string& operator=(const std::string& value);
+
+	/**
+	 * @brief Get the string value
+	 * 
+	 * @return const std::string& value, valid while this object holds it
+	 */
+	const std::string& str() const;
+
+	/**
+	 * @brief Get the string value
+	 * 
+	 * @return const std::string& value, valid while this object holds it
+	 */
+	operator const std::string&() const;
+
+	/** Returns true if the string is empty */
+	bool empty() const;
+
+	/**
+	 * @brief Get this holder's share of the memory used by the interned value,
+	 * i.e. the total divided by the number of holders
+	 * 
+	 * @return size_t size in bytes
+	 */
+	size_t bytes() const;
+
+	/** Equal values always share an entry, so this is a pointer comparison */
+	bool operator==(const interned_string& other) const;
+
+	bool operator!=(const interned_string& other) const;
+};
+
+/**
+ * @brief The list of role ids of a guild member. Most members have few roles,
+ * so up to two are stored without a separate allocation.
+ */
+typedef small_vector<snowflake, 2> member_roles;
+
 /**
  * @brief Represents dpp::user membership upon a dpp::guild
  */
 class DPP_EXPORT guild_member {
 public:
-	/** Nickname, or nullptr if they don't have a nickname on this guild */
-	std::string nickname;
 	/** Guild id */
 	snowflake guild_id;
 	/** User id */
 	snowflake user_id;
-	/** List of roles this user has on this guild */
-	std::vector<snowflake> roles;
+	/**
+	 * @brief List of roles this user has on this guild.
+	 * @note This was a std::vector<snowflake>. member_roles has the commonly used
+	 * part of its interface and converts to and from it, but code which takes
+	 * a std::vector<snowflake>& to it must copy it instead.
+	 */
+	member_roles roles;
+	/**
+	 * @brief Nickname, or empty if they don't have a nickname on this guild.
+	 * @note This was a std::string. It converts to const std::string& and can be
+	 * assigned a std::string, but call str() to use std::string members on it.
+	 */
+	interned_string nickname;
 	/** Date and time the user joined the guild */
 	time_t joined_at;
 	/** Boosting since */
@@ -152,6 +249,14 @@ public:
 
 	/** Returns true if pending verification by membership screening */
 	bool is_pending() const;
+
+	/**
+	 * @brief Get the memory used by this member's roles and its share of its
+	 * nickname, not counting the guild_member object itself
+	 * 
+	 * @return size_t size in bytes
+	 */
+	size_t heap_bytes() const;
 	
 };
 
@@ -312,6 +417,15 @@ public:
 	 */
 	void rehash_members();
 
+	/**
+	 * @brief Get the approximate memory used by this guild's member list,
+	 * including the container's nodes and buckets, every member's roles, and
+	 * each member's share of its interned nickname
+	 * 
+	 * @return size_t size in bytes
+	 */
+	size_t members_bytes() const;
+
 	/**
 	 * @brief Connect to a voice channel another guild member is in
 	 *
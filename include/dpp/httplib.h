@@ -293,6 +293,22 @@ struct ci {
 using Headers = std::multimap<std::string, std::string, detail::ci>;
 
 using Params = std::multimap<std::string, std::string>;
+
+// D++ local change: a hook for the host lookup of client connections, which
+// D++ points at its DNS cache. Set with set_address_resolver().
+struct ResolvedAddress {
+  int family;
+  int socktype;
+  int protocol;
+  // Raw bytes of a sockaddr of the family
+  std::string addr;
+};
+
+// Resolves the host of a client connection, in place of getaddrinfo
+using AddressResolver =
+    std::function<bool(const char *host, int port, int address_family,
+                       std::vector<ResolvedAddress> &addresses)>;
+
 using Match = std::smatch;
 
 using Progress = std::function<bool(uint64_t current, uint64_t total)>;
@@ -1021,6 +1037,8 @@ public:
 
   void set_interface(const char *intf);
 
+  void set_address_resolver(AddressResolver resolver); // D++ local change
+
   void set_proxy(const char *host, int port);
   void set_proxy_basic_auth(const char *username, const char *password);
   void set_proxy_bearer_token_auth(const char *token);
@@ -1120,6 +1138,8 @@ protected:
 
   std::string interface_;
 
+  AddressResolver address_resolver_; // D++ local change
+
   std::string proxy_host_;
   int proxy_port_ = -1;
 
@@ -1334,6 +1354,8 @@ public:
 
   void set_interface(const char *intf);
 
+  void set_address_resolver(AddressResolver resolver); // D++ local change
+
   void set_proxy(const char *host, int port);
   void set_proxy_basic_auth(const char *username, const char *password);
   void set_proxy_bearer_token_auth(const char *token);
@@ -21,6 +21,7 @@
 #pragma once
 #include <dpp/export.h>
 #include <dpp/discord.h>
+#include <dpp/queues.h>
 #include <optional>
 #include <dpp/json_fwd.hpp>
 
@@ -806,7 +807,15 @@ enum cache_policy_setting_t {
 	 * @brief Don't cache anything. Fill details when we see them.
 	 * (NOT IMPLEMENTED YET)
 	 */
-	cp_none = 2
+	cp_none = 2,
+	/**
+	 * @brief Cache users and guild members as they are seen in events, without requesting
+	 * them, and evict them again when they haven't been used for a while or when the cache
+	 * is over its memory budget. Only valid for the user policy.
+	 * @see cache_policy_t::user_ttl
+	 * @see cache_policy_t::user_memory_limit
+	 */
+	cp_bounded = 3
 };
 
 /**
@@ -834,6 +843,20 @@ struct DPP_EXPORT cache_policy_t {
 	 * @brief Caching policy for roles
 	 */
 	cache_policy_setting_t role_policy = cp_aggressive;
+
+	/**
+	 * @brief When the user policy is cp_bounded, users and guild members which haven't been
+	 * seen in an event or looked up with dpp::find_user() for this many seconds are evicted.
+	 * Eviction runs once a minute. Zero for no time limit.
+	 */
+	time_t user_ttl = 3600;
+
+	/**
+	 * @brief When the user policy is cp_bounded, an approximate budget in bytes for cached
+	 * users and guild members. When over budget, the least recently used are evicted first.
+	 * Zero for no limit.
+	 */
+	size_t user_memory_limit = 0;
 };
 
 /**
@@ -892,6 +915,9 @@ struct DPP_EXPORT message {
 	/** File content to upload (raw binary) */
 	std::string	filecontent;
 
+	/** Further files to upload, added by add_file() */
+	std::vector<http_upload> uploads;
+
 	/** Message type */
 	uint8_t		type;
 
@@ -1107,6 +1133,32 @@ struct DPP_EXPORT message {
 	 */
 	message& set_file_content(const std::string &fc);
 
+	/**
+	 * @brief Add a file to upload with the message. A message can have several files.
+	 * 
+	 * @param fn filename
+	 * @param fc raw file content contained in std::string
+	 * @return message& reference to self
+	 */
+	message& add_file(const std::string &fn, const std::string &fc);
+
+	/**
+	 * @brief Add a file to upload with the message, such as one from http_upload::from_file()
+	 * which is read from disk while the message is sent rather than held in memory.
+	 * 
+	 * @param file file to upload
+	 * @return message& reference to self
+	 */
+	message& add_file(const http_upload &file);
+
+	/**
+	 * @brief Get the files added by add_file(). The file set by set_filename() and
+	 * set_file_content() is sent before them.
+	 * 
+	 * @return const std::vector<http_upload>& files
+	 */
+	const std::vector<http_upload>& get_uploads() const;
+
 	/**
 	 * @brief Set the message content
 	 * 
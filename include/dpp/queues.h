@@ -23,12 +23,21 @@
 #include <unordered_map>
 #include <string>
 #include <queue>
+#include <deque>
+#include <unordered_set>
 #include <map>
 #include <thread>
 #include <mutex>
 #include <vector>
 #include <functional>
+#include <memory>
 #include <condition_variable>
+#include <atomic>
+#include <array>
+
+namespace httplib {
+	class Client;
+};
 
 namespace dpp {
 
@@ -90,10 +99,14 @@ struct DPP_EXPORT http_request_completion_t {
 	uint64_t ratelimit_limit = 0;
 	/** Ratelimit remaining requests */
 	uint64_t ratelimit_remaining = 0;
-	/** Ratelimit reset after (seconds) */
+	/** Ratelimit reset after (whole seconds, rounded down) */
 	uint64_t ratelimit_reset_after = 0;
-	/** Ratelimit retry after (seconds) */
+	/** Ratelimit retry after (whole seconds, rounded down) */
 	uint64_t ratelimit_retry_after = 0;
+	/** Ratelimit reset after (seconds, with millisecond precision) */
+	double ratelimit_reset_after_precise = 0;
+	/** Ratelimit retry after (seconds, with millisecond precision), set on 429 responses */
+	double ratelimit_retry_after_precise = 0;
 	/** True if this request has caused us to be globally rate limited */
 	bool ratelimit_global = false;
 	/** Reply body */
@@ -107,6 +120,8 @@ struct DPP_EXPORT http_request_completion_t {
  * @note Returned http_completion_events are called ASYNCRONOUSLY in your
  * code which means they execute in a separate thread. The completion events
  * arrive in order.
+ * @note The http_request_completion_t is freed as soon as the callback returns. Copy
+ * anything you need to keep, rather than holding a reference to it.
  */
 typedef std::function<void(const http_request_completion_t&)> http_completion_event;
 
@@ -125,6 +140,88 @@ enum http_method {
 	m_delete
 };
 
+/**
+ * @brief Priority lanes of the REST request queue. Requests in a lane are sent
+ * before any waiting in the lanes after it.
+ */
+enum http_priority {
+	/// Interaction responses, which must reach Discord within 3 seconds. Not held back by the global rate limit, and sent by a worker reserved for this lane
+	hp_interaction = 0,
+	/// Most requests
+	hp_normal,
+	/// Bulk work such as mass role edits, which can wait behind everything else
+	hp_bulk,
+	/// Number of lanes
+	hp_count
+};
+
+/**
+ * @brief Reads part of a file being uploaded, as the request is sent.
+ * Called with the offset in the file to read from, a buffer, and the most bytes to read
+ * into it. Returns the number of bytes read, or 0 if the file can't be read.
+ */
+typedef std::function<size_t(size_t offset, char* buffer, size_t length)> upload_reader;
+
+/**
+ * @brief A file to upload with a request.
+ *
+ * The content can be held in memory, or read a chunk at a time while the request is sent, so
+ * that a large file is never all in memory. Either way, the multipart body of the request is
+ * streamed to the connection without being put together in memory first.
+ */
+struct DPP_EXPORT http_upload {
+	/** File name (server side) */
+	std::string name;
+	/** Mime type of the content */
+	std::string mimetype;
+	/** Content held in memory, used if there is no reader. Copies of the upload share it */
+	std::shared_ptr<const std::string> content;
+	/** Size in bytes of the content read by reader */
+	size_t size;
+	/** Reads the content while the request is sent */
+	upload_reader reader;
+
+	/**
+	 * @brief Construct an upload of content held in memory
+	 * 
+	 * @param _name File name (server side)
+	 * @param _content Binary content. Pass an rvalue to move rather than copy it
+	 * @param _mimetype Mime type of the content
+	 */
+	http_upload(const std::string &_name, std::string _content, const std::string &_mimetype = "application/octet-stream");
+
+	/**
+	 * @brief Construct an upload of content read in chunks while the request is sent.
+	 * The reader may be called again from the start if the request is retried.
+	 * 
+	 * @param _name File name (server side)
+	 * @param _size Size of the content in bytes
+	 * @param _reader Reads the content
+	 * @param _mimetype Mime type of the content
+	 */
+	http_upload(const std::string &_name, size_t _size, upload_reader _reader, const std::string &_mimetype = "application/octet-stream");
+
+	/**
+	 * @brief Upload a file from disk, read in chunks while the request is sent
+	 * 
+	 * @param name File name (server side)
+	 * @param path Path of the file to read
+	 * @param mimetype Mime type of the content
+	 * @return http_upload upload which reads the file
+	 * @throw dpp::exception if the file can't be opened
+	 */
+	static http_upload from_file(const std::string &name, const std::string &path, const std::string &mimetype = "application/octet-stream");
+
+	/**
+	 * @brief Get the size of the content
+	 * 
+	 * @return size_t size in bytes
+	 */
+	size_t length() const;
+};
+
+class http_connection_pool;
+
 /**
  * @brief A HTTP request.
  * 
@@ -142,6 +239,8 @@ class DPP_EXPORT http_request {
 	bool completed;
 	/** True for requests that are not going to discord (rate limits code skipped) */
 	bool non_discord;
+	/** The queue marks requests complete which it answers without running them */
+	friend class request_queue;
 public:
 	/** Endpoint name e.g. /api/users */
 	std::string endpoint;
@@ -157,10 +256,18 @@ public:
 	std::string file_name;
 	/** Upload file contents (binary) */
 	std::string file_content;
+	/** Further files to upload, sent after file_content if it is set */
+	std::vector<http_upload> uploads;
 	/** Request mime type */
 	std::string mimetype;
 	/** Request headers (non-discord requests only) */
 	std::multimap<std::string, std::string> req_headers;
+	/** Number of times the request has been sent again after a 429 response */
+	uint8_t ratelimit_retries;
+	/** Priority lane of the request */
+	http_priority priority;
+	/** Time the request was first posted to a request_queue, on the dpp::utility::time_f() clock */
+	double queued_at;
 
 	/** Constructor. When constructing one of these objects it should be passed to request_queue::post_request().
 	 * @param _endpoint The API endpoint, e.g. /api/guilds
@@ -194,16 +301,19 @@ public:
 
 	/** Execute the HTTP request and mark the request complete.
 	 * @param owner creating cluster
+	 * @param pool connection pool to take a keep-alive connection from, or nullptr
+	 * to make a new connection just for this request
 	 */
-	http_request_completion_t Run(class cluster* owner);
+	http_request_completion_t Run(class cluster* owner, http_connection_pool* pool = nullptr);
 
 	/** Returns true if the request is complete */
 	bool is_completed();
 };
 
 /**
- * @brief A rate limit bucket. The library builds one of these for
- * each endpoint.
+ * @brief A rate limit bucket. The library builds one of these for each
+ * rate limit bucket Discord reports, and each set of major parameters
+ * (channel, guild or webhook) used with it.
  */
 struct DPP_EXPORT bucket_t {
 	/** Request limit */
@@ -211,11 +321,286 @@ struct DPP_EXPORT bucket_t {
 	/** Requests remaining */
 	uint64_t remaining;
 	/** Ratelimit of this bucket resets after this many seconds */
-	uint64_t reset_after;
+	double reset_after;
 	/** Ratelimit of this bucket can be retried after this many seconds */
-	uint64_t retry_after;
+	double retry_after;
 	/** Timestamp this buckets counters were updated */
 	time_t timestamp;
+	/** Time the bucket resets, on the dpp::utility::time_f() clock */
+	double reset_at;
+};
+
+/**
+ * @brief Rate limit metrics of a request_queue
+ */
+struct DPP_EXPORT ratelimit_stats {
+	/** Requests held back until their bucket reset, each of which would otherwise have received a 429 */
+	uint64_t avoided = 0;
+	/** 429 responses received */
+	uint64_t received = 0;
+	/** Requests sent again after receiving a 429 */
+	uint64_t retried = 0;
+	/** Number of buckets being tracked */
+	uint64_t buckets = 0;
+};
+
+/**
+ * @brief Histogram of the time taken by requests in one priority lane, from
+ * being posted to the queue until their reply arrives
+ */
+struct DPP_EXPORT latency_histogram {
+	/** Number of requests in each bucket. See upper_bound() for the range each one covers */
+	std::array<uint64_t, 12> buckets = {};
+	/** Number of requests */
+	uint64_t count = 0;
+	/** Total of all the latencies in seconds */
+	double total = 0;
+	/** The slowest latency in seconds */
+	double max = 0;
+
+	/**
+	 * @brief Get the upper bound of a bucket
+	 * 
+	 * @param bucket bucket index
+	 * @return double latency in seconds which requests in the bucket took at most,
+	 * or infinity for the last bucket
+	 */
+	static double upper_bound(size_t bucket);
+
+	/**
+	 * @brief Add a request to the histogram
+	 * 
+	 * @param latency request latency in seconds
+	 */
+	void add(double latency);
+
+	/**
+	 * @brief Estimate a percentile, to the resolution of the buckets
+	 * 
+	 * @param p percentile from 0 to 100
+	 * @return double upper bound of the bucket the percentile falls in, or 0 if the histogram is empty
+	 */
+	double percentile(double p) const;
+};
+
+/**
+ * @brief Metrics of GET requests answered without a request of their own
+ */
+struct DPP_EXPORT coalesce_stats {
+	/** GET requests which were given the reply of an identical GET already in flight */
+	uint64_t coalesced = 0;
+	/** GET requests answered from the response cache */
+	uint64_t cache_hits = 0;
+	/** Replies in the response cache */
+	uint64_t cache_entries = 0;
+};
+
+/**
+ * @brief Memory metrics of a request_queue
+ */
+struct DPP_EXPORT queue_memory_stats {
+	/** Requests posted whose callbacks have not yet been called */
+	uint64_t requests = 0;
+	/** Replies waiting for their callbacks to be called */
+	uint64_t completions = 0;
+	/** Approximate bytes held by requests and replies, including their bodies */
+	uint64_t bytes = 0;
+	/** The most bytes that have been held at once */
+	uint64_t high_water_bytes = 0;
+};
+
+/**
+ * @brief Connection pool metrics
+ */
+struct DPP_EXPORT http_pool_stats {
+	/** Requests made through the pool */
+	uint64_t requests = 0;
+	/** Requests which had to open a new connection, including the TLS handshake */
+	uint64_t connections_opened = 0;
+	/** Requests which reused an open keep-alive connection */
+	uint64_t connections_reused = 0;
+	/** Requests retried on a new connection because a reused one had been closed by the server */
+	uint64_t retries = 0;
+	/** Idle connections closed because they were unused for longer than the idle timeout */
+	uint64_t idle_closed = 0;
+	/** Average latency in seconds of successful requests on new connections */
+	double new_connection_latency = 0;
+	/** Average latency in seconds of successful requests on reused connections */
+	double reused_connection_latency = 0;
+};
+
+/**
+ * @brief A pool of persistent keep-alive HTTPS connections, kept per host.
+ *
+ * Making a new connection to Discord costs a TCP connect and a full TLS handshake,
+ * which is usually several times the time taken by the request itself. Requests
+ * check a connection out of the pool, and hand it back once the reply is read so
+ * that the next request to the same host can reuse it.
+ */
+class DPP_EXPORT http_connection_pool {
+	/**
+	 * @brief An open connection which is not in use
+	 */
+	struct idle_connection {
+		/** The connection */
+		httplib::Client* client;
+		/** When the connection was last used */
+		time_t last_used;
+	};
+
+	/** Mutex for idle and the settings */
+	std::mutex pool_mutex;
+
+	/** Idle connections, by host. The most recently used is at the back */
+	std::map<std::string, std::vector<idle_connection>> idle;
+
+	/** Maximum number of idle connections kept for each host */
+	size_t max_idle;
+
+	/** Seconds an idle connection is kept before it is closed */
+	time_t idle_timeout;
+
+	/** Metric counters, see http_pool_stats */
+	std::atomic<uint64_t> requests, connections_opened, connections_reused, retries, idle_closed;
+
+	/** Total latency of successful requests, in microseconds, on new and reused connections */
+	std::atomic<uint64_t> new_latency_us, reused_latency_us;
+
+	/** Number of successful requests on new and reused connections */
+	std::atomic<uint64_t> new_count, reused_count;
+
+public:
+	/**
+	 * @brief Construct a new connection pool
+	 * 
+	 * @param max_idle_per_host Maximum number of idle connections kept for each host
+	 * @param idle_seconds Seconds an idle connection is kept before it is closed
+	 */
+	http_connection_pool(size_t max_idle_per_host = 8, time_t idle_seconds = 30);
+
+	/**
+	 * @brief Destroy the pool, closing all idle connections
+	 */
+	~http_connection_pool();
+
+	http_connection_pool(const http_connection_pool&) = delete;
+
+	http_connection_pool& operator=(const http_connection_pool&) = delete;
+
+	/**
+	 * @brief Set the pool size and idle timeout
+	 * 
+	 * @param max_idle_per_host Maximum number of idle connections kept for each host
+	 * @param idle_seconds Seconds an idle connection is kept before it is closed
+	 */
+	void configure(size_t max_idle_per_host, time_t idle_seconds);
+
+	/**
+	 * @brief Check out a connection to a host, reusing an idle one if there is one
+	 * 
+	 * @param host Scheme, host and optional port, e.g. https://discord.com
+	 * @return httplib::Client* connection, which must be handed back with release()
+	 */
+	httplib::Client* acquire(const std::string& host);
+
+	/**
+	 * @brief Hand back a connection from acquire()
+	 * 
+	 * @param host Host the connection was acquired for
+	 * @param client The connection
+	 */
+	void release(const std::string& host, httplib::Client* client);
+
+	/**
+	 * @brief Close any connections which have been idle for longer than the idle timeout
+	 */
+	void prune();
+
+	/**
+	 * @brief Record the outcome of one request
+	 * 
+	 * @param reused True if the request was made on a reused connection
+	 * @param success True if a reply was received
+	 * @param latency Request latency in seconds
+	 * @param retried True if the request had to be retried on a new connection
+	 */
+	void record(bool reused, bool success, double latency, bool retried);
+
+	/**
+	 * @brief Get the pool's metrics
+	 * 
+	 * @return http_pool_stats metrics
+	 */
+	http_pool_stats get_stats();
+};
+
+/**
+ * @brief A hashed timer wheel of string keys.
+ *
+ * Each key is placed in the slot covering the time it is due, so adding a key
+ * and collecting due keys are O(1) no matter how many keys are waiting. Keys due
+ * further ahead than one turn of the wheel share slots with nearer ones, and are
+ * passed over until the turn they are due in. Keys come due up to one tick late.
+ * Not thread safe.
+ */
+class DPP_EXPORT timer_wheel {
+	/** Slots, each holding keys and the times they are due */
+	std::vector<std::vector<std::pair<double, std::string>>> slots;
+
+	/** Width of each slot in seconds */
+	double tick;
+
+	/** Number of the next tick to be collected, counting ticks from the epoch */
+	uint64_t current;
+
+	/** Number of keys in the wheel */
+	size_t count;
+
+	/**
+	 * @brief Get the slot a tick falls in
+	 * 
+	 * @param tick_number tick, counting from the epoch
+	 * @return size_t slot index
+	 */
+	size_t slot_for(uint64_t tick_number) const;
+public:
+	/**
+	 * @brief Construct a new timer wheel
+	 * 
+	 * @param slot_count Number of slots
+	 * @param tick_seconds Width of each slot in seconds
+	 */
+	timer_wheel(size_t slot_count = 1024, double tick_seconds = 0.01);
+
+	/**
+	 * @brief Add a key
+	 * 
+	 * @param key key to add
+	 * @param when time it is due, on the dpp::utility::time_f() clock
+	 */
+	void add(const std::string& key, double when);
+
+	/**
+	 * @brief Remove and return every key which is due
+	 * 
+	 * @param now current time, on the dpp::utility::time_f() clock
+	 * @param due keys which are due are appended to this
+	 */
+	void collect(double now, std::deque<std::string>& due);
+
+	/**
+	 * @brief Get the time at which collect() may next return keys
+	 * 
+	 * @return double time of the end of the current slot, or 0 if the wheel is empty
+	 */
+	double next_tick() const;
+
+	/**
+	 * @brief Get the number of keys in the wheel
+	 * 
+	 * @return size_t number of keys
+	 */
+	size_t size() const;
 };
 
 /**
@@ -224,12 +609,30 @@ struct DPP_EXPORT bucket_t {
  * 
  * It ensures asynchronous delivery of events and queueing of requests.
  *
- * It will spawn two threads, one to make outbound HTTP requests and push the returned
- * results into a queue, and the second to call the callback methods with these results.
+ * It will spawn a pool of worker threads to make outbound HTTP requests and push the returned
+ * results into a queue, and a second pool of threads to call the callback methods with these results.
  * They are separated so that if the user decides to take a long time processing a reply
  * in their callback it won't affect when other requests are sent, and if a HTTP request
  * takes a long time due to latency, it won't hold up user processing.
  *
+ * Requests are sent from three priority lanes, see dpp::http_priority. A free worker always
+ * takes a request from the highest lane with one ready to send, and one extra worker serves
+ * only the interaction lane, so that interaction responses never wait behind a backlog.
+ *
+ * A GET for a url which already has an identical GET in flight is not sent again. It is
+ * given a copy of the first request's reply when it arrives. Successful GET replies can
+ * also be kept for a short time with set_response_cache(). Any other request to a url
+ * drops the cached replies for that url, the urls above it and the urls below it.
+ *
+ * Requests in different rate limit buckets are independent, and are sent in parallel by
+ * the workers. Only one request from each bucket is in flight at a time, so that each
+ * request sees the bucket's limits as updated by the one before it, and requests in a
+ * bucket are sent in the order they were queued.
+ *
+ * If there is more than one completion thread, callbacks may run concurrently. With ordered
+ * completions, which is the default, the callbacks of requests to the same channel, guild
+ * or webhook always run on the same thread, one at a time, in the order the replies arrived.
+ *
  * There are usually two request_queue objects in each dpp::cluster, one of which is used
  * internally for the various REST methods to Discord such as sending messages, and the other
  * used to support user REST calls via dpp::cluster::request().
@@ -239,74 +642,303 @@ private:
 	/** The cluster that owns this request_queue */
 	class cluster* creator;
 
-	/** Inbound queue mutex thread safety */
+	/** Inbound queue mutex thread safety. Also protects buckets, busy_buckets and the global rate limit */
 	std::mutex in_mutex;
 
 	/** Outbound queue mutex thread safety */
 	std::mutex out_mutex;
 
-	/** Inbound queue thread */
-	std::thread* in_thread;
+	/** Inbound queue worker threads */
+	std::vector<std::thread*> in_threads;
 
-	/** Outbound queue thread */
-	std::thread* out_thread;
+	/** Outbound queue threads, which call completion callbacks */
+	std::vector<std::thread*> out_threads;
 
-	/** Inbound queue condition, signalled when there are requests to fulfill */
+	/** Inbound queue condition, signalled when there are requests to fulfill or a bucket becomes free */
 	std::condition_variable in_ready;
 
+	/** Condition of the worker reserved for the interaction lane, signalled along with in_ready */
+	std::condition_variable fast_ready;
+
 	/** Outbound queue condition, signalled when there are requests completed to call callbacks for */ 
 	std::condition_variable out_ready;
 
-	/** Ratelimit bucket counters */
-	std::map<std::string, bucket_t> buckets;
+	/** True if completions for the same major parameter are called in order */
+	bool ordered_completions;
+
+	/**
+	 * @brief Requests waiting to be sent for one route and set of major parameters
+	 */
+	struct route_queue {
+		/** Route with every id replaced by a placeholder, e.g. "POST /api/v9/channels/{id}/messages" */
+		std::string route;
+		/** The route's major parameters, e.g. the channel id */
+		std::string major;
+		/** Requests, oldest first */
+		std::deque<http_request*> requests;
+		/** Highest priority of any request posted to the queue */
+		http_priority priority = hp_bulk;
+		/** True if the queue's key is in the ready queue, the timer wheel, or waiting on a busy bucket */
+		bool scheduled = false;
+	};
+
+	/** Ratelimit bucket counters, by bucket hash and major parameters */
+	std::unordered_map<std::string, bucket_t> buckets;
+
+	/** Discord's bucket hash for each route, learned from the X-RateLimit-Bucket header */
+	std::unordered_map<std::string, std::string> route_buckets;
+
+	/** Queue of requests to be made, by route and major parameters */
+	std::unordered_map<std::string, route_queue> requests_in;
+
+	/** Keys of route queues which may have a request that can be sent now, for each priority lane */
+	std::array<std::deque<std::string>, hp_count> ready;
+
+	/** Keys of route queues waiting for their bucket to reset */
+	timer_wheel waiting;
+
+	/** Keys collected from the timer wheel, kept to reuse its storage */
+	std::deque<std::string> due;
+
+	/** Latency of each priority lane */
+	std::array<latency_histogram, hp_count> latencies;
+
+	/** Buckets which a worker is currently sending a request for */
+	std::unordered_set<std::string> busy_buckets;
+
+	/** Keys of route queues waiting for a busy bucket's request to complete, by bucket */
+	std::unordered_map<std::string, std::vector<std::string>> parked;
+
+	/** Buckets with requests which were held back until the bucket resets */
+	std::unordered_set<std::string> held_buckets;
+
+	/** Rate limit counters, see ratelimit_stats */
+	std::atomic<uint64_t> ratelimits_avoided, ratelimits_received, ratelimits_retried;
+
+	/**
+	 * @brief A request whose reply is waiting for its callback to be called
+	 */
+	struct completion {
+		/** The request, which is deleted once its callback returns */
+		http_request* request;
+		/** The reply, moved here from the worker which received it */
+		http_request_completion_t result;
+	};
+
+	/** Completed requests queue, for completions which may be called on any thread */
+	std::deque<completion> responses_out;
+
+	/** Completed requests queues for each outbound thread, for completions which must be called in order */
+	std::vector<std::deque<completion>> ordered_out;
+
+	/** Memory counters, see queue_memory_stats */
+	std::atomic<uint64_t> live_requests, live_completions, live_bytes, high_water_bytes;
+
+	/**
+	 * @brief Count bytes as held by the queue, raising the high water mark if needed
+	 * 
+	 * @param bytes bytes to add
+	 */
+	void add_bytes(uint64_t bytes);
+
+	/**
+	 * @brief A cached reply to a GET request
+	 */
+	struct cached_response {
+		/** Time the reply expires, on the dpp::utility::time_f() clock */
+		double expires;
+		/** The reply */
+		http_request_completion_t result;
+	};
+
+	/** GET requests waiting for the reply of an identical request in flight, by url */
+	std::unordered_map<std::string, std::vector<http_request*>> coalescing;
+
+	/** Cached replies to GET requests by url, ordered so that the urls below a url follow it */
+	std::map<std::string, cached_response> response_cache;
 
-	/** Queue of requests to be made */
-	std::map<std::string, std::vector<http_request*>> requests_in;
+	/** Seconds successful GET replies are cached for, or 0 to not cache them */
+	double cache_ttl;
 
-	/** Completed requests queue */
-	std::queue<std::pair<http_request_completion_t*, http_request*>> responses_out;
+	/** Time expired replies were last removed from the response cache */
+	double cache_pruned_at;
 
-	/** Completed requests to delete */
-	std::multimap<time_t, std::pair<http_request_completion_t*, http_request*>> responses_to_delete;
+	/** Coalescing counters, see coalesce_stats */
+	std::atomic<uint64_t> gets_coalesced, cache_hits;
+
+	/**
+	 * @brief Move a reply into the completion queues, to be passed to the request's callback.
+	 * The caller must hold in_mutex.
+	 * 
+	 * @param req request
+	 * @param rv reply
+	 * @param major the request's major parameters, which pick the completion thread
+	 */
+	void complete_request(http_request* req, http_request_completion_t&& rv, const std::string& major);
+
+	/**
+	 * @brief Drop cached replies which a request other than a GET may have changed:
+	 * the url itself and every url below it, and if the url is one object of a
+	 * collection (its last part is an id or @me), the collection. Urls further up
+	 * are kept, so a reply cached for a channel or guild survives writes to its
+	 * messages or members. The caller must hold in_mutex.
+	 * 
+	 * @param url url of the request
+	 */
+	void invalidate_cache(const std::string& url);
 
 	/** Set to true if the threads should terminate */
 	bool terminating;
 
-	/** True if globally rate limited - makes the entire request thread wait */
+	/** True if globally rate limited - makes every worker wait */
 	bool globally_ratelimited;
 
-	/** How many seconds we are globally rate limited for, if globally_ratelimited is true */
-	uint64_t globally_limited_for;
+	/** Time the global rate limit ends on the dpp::utility::time_f() clock, if globally_ratelimited is true */
+	double globally_limited_until;
+
+	/** Keep-alive connections used to make requests */
+	http_connection_pool pool;
+
+	/**
+	 * @brief Inbound queue worker thread loop
+	 * 
+	 * @param fast True for the worker reserved for the interaction lane
+	 */
+	void in_loop(bool fast);
+
+	/**
+	 * @brief Put a route queue's key in the ready queue of its lane.
+	 * The caller must hold in_mutex.
+	 * 
+	 * @param key key of the queue in requests_in
+	 */
+	void make_ready(std::string&& key);
+
+	/**
+	 * @brief Get the rate limit bucket a queue's requests are counted against.
+	 * Until Discord has told us the bucket hash for the route, each route and
+	 * set of major parameters is treated as its own bucket.
+	 * The caller must hold in_mutex.
+	 * 
+	 * @param key key of the queue in requests_in
+	 * @param q queue
+	 * @return std::string bucket key
+	 */
+	std::string bucket_for(const std::string& key, const route_queue& q);
+
+	/**
+	 * @brief Take the next request which can be sent now from a bucket which isn't busy.
+	 * Route queues which can't send yet are moved to the timer wheel or parked on their
+	 * busy bucket, so each queue is looked at once per request or reset.
+	 * The caller must hold in_mutex.
+	 * 
+	 * @param now current time, on the dpp::utility::time_f() clock
+	 * @param key set to the key of the request's route queue
+	 * @param bucket set to the key of the request's bucket
+	 * @param lowest lowest priority lane to take a request from
+	 * @return http_request* request to send, or nullptr if none can be sent yet
+	 */
+	http_request* next_request(double now, std::string& key, std::string& bucket, http_priority lowest);
+
+	/**
+	 * @brief Remove buckets which have reset and have no requests in flight.
+	 * The caller must hold in_mutex.
+	 */
+	void prune_buckets();
 
 	/**
-	 * @brief Inbound queue thread loop
+	 * @brief Remove expired replies from the response cache.
+	 * The caller must hold in_mutex.
 	 */
-	void in_loop();
+	void prune_cache();
 
 	/**
 	 * @brief Outbound queue thread loop
+	 * 
+	 * @param index index of the thread, which picks its queue in ordered_out
 	 */
-	void out_loop();
+	void out_loop(size_t index);
 public:
 
 	/** Constructor
 	 * @param owner The creating cluster.
-	 * Side effects: Creates two threads for the queue
+	 * @param request_threads The number of worker threads sending requests. One more
+	 * worker is started which only sends requests in the interaction lane.
+	 * @param completion_threads The number of threads calling completion callbacks.
+	 * With more than one, your callbacks must be thread safe.
+	 * @param ordered If true, callbacks for requests to the same channel, guild or webhook
+	 * are called one at a time in the order their replies arrived. Otherwise any free
+	 * completion thread may call any callback.
+	 * Side effects: Creates the worker threads and completion threads for the queue
 	 */
-	request_queue(class cluster* owner);
+	request_queue(class cluster* owner, uint32_t request_threads = 4, uint32_t completion_threads = 1, bool ordered = true);
 
 	/**
 	 * @brief Destroy the request queue object.
-	 * Side effects: Joins and deletes queue threads
+	 * Side effects: Joins and deletes queue threads, and deletes requests still queued
+	 * without calling their callbacks
 	 */
 	~request_queue();
 
 	/**
 	 * @brief Put a http_request into the request queue. You should ALWAYS "new" an object
-	 * to pass to here -- don't submit an object that's on the stack!
+	 * to pass to here -- don't submit an object that's on the stack! The queue takes
+	 * ownership of the request and deletes it as soon as its callback returns.
 	 * @param req request to add
 	 */
 	void post_request(http_request *req);
+
+	/**
+	 * @brief Set the size and idle timeout of the queue's connection pool
+	 * 
+	 * @param max_idle_per_host Maximum number of idle keep-alive connections kept for each host
+	 * @param idle_seconds Seconds an idle connection is kept before it is closed
+	 */
+	void set_pool(size_t max_idle_per_host, time_t idle_seconds);
+
+	/**
+	 * @brief Get metrics of the queue's connection pool
+	 * 
+	 * @return http_pool_stats metrics
+	 */
+	http_pool_stats get_pool_stats();
+
+	/**
+	 * @brief Get rate limit metrics of the queue
+	 * 
+	 * @return ratelimit_stats metrics
+	 */
+	ratelimit_stats get_ratelimit_stats();
+
+	/**
+	 * @brief Get memory metrics of the queue
+	 * 
+	 * @return queue_memory_stats metrics
+	 */
+	queue_memory_stats get_memory_stats();
+
+	/**
+	 * @brief Get the latency histogram of a priority lane
+	 * 
+	 * @param lane priority lane
+	 * @return latency_histogram time from requests being posted until their reply arrived
+	 */
+	latency_histogram get_latency_stats(http_priority lane);
+
+	/**
+	 * @brief Set how long successful GET replies are cached for. Identical GETs
+	 * within this time are answered from the cache without a request.
+	 * 
+	 * @param ttl_seconds Seconds to cache replies for, or 0 to turn the cache off, which is the default
+	 */
+	void set_response_cache(double ttl_seconds);
+
+	/**
+	 * @brief Get metrics of GET requests answered by coalescing or from the response cache
+	 * 
+	 * @return coalesce_stats metrics
+	 */
+	coalesce_stats get_coalesce_stats();
 };
 
 };
@@ -0,0 +1,119 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * Copyright 2021 Craig Edwards and D++ contributors 
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <vector>
+#include <functional>
+
+namespace dpp {
+
+class ssl_client;
+
+/** This is an opaque class containing a reactor thread and its epoll instance.
+ * It is only defined in the library, as it is platform specific.
+ */
+class reactor_thread;
+
+/**
+ * @brief Called by a reactor when a connection it was handling has ended.
+ * The connection has already been removed from the reactor.
+ */
+typedef std::function<void()> reactor_disconnect_t;
+
+/**
+ * @brief Handles many ssl_client connections on a fixed number of threads using epoll,
+ * instead of each connection running its own read_loop() on a thread of its own.
+ *
+ * Each thread waits on all of its connections at once, and only wakes when one of them
+ * has something to do, or once a second to call their one_second_timer(). Connections with
+ * custom_readable_fd or custom_writeable_fd hooks have their extra file descriptors watched
+ * too, and are checked for changes to them every 50ms, as read_loop() does.
+ *
+ * Handlers of connections on the same thread are called one at a time, so they must not block.
+ * As with read_loop(), connections should only be written to from their own handlers and timers.
+ * Reconnecting does block, so the reactor_disconnect_t callback should reconnect on another
+ * thread and add the connection back when it is ready.
+ *
+ * The reactor is only available on Linux. Use reactor::supported() to check.
+ */
+class DPP_EXPORT reactor {
+	/** Reactor threads, each with its own epoll instance */
+	std::vector<reactor_thread*> threads;
+public:
+	/**
+	 * @brief Construct a new reactor and start its threads
+	 *
+	 * @param thread_count Number of threads to handle connections on
+	 * @throw dpp::exception if the reactor is not supported on this platform, or epoll could not be set up
+	 */
+	reactor(size_t thread_count);
+
+	/**
+	 * @brief dpp::reactor is non-copyable
+	 */
+	reactor(const reactor&) = delete;
+
+	/**
+	 * @brief Stop the reactor threads. Connections which are still in the reactor
+	 * are left open, and are no longer handled.
+	 */
+	~reactor();
+
+	/**
+	 * @brief Returns true if the reactor is available on this platform
+	 */
+	static bool supported();
+
+	/**
+	 * @brief Start handling a connection. The connection must be connected, with Connect()
+	 * having returned, and it is switched to non-blocking mode. It is given to the thread with
+	 * the fewest connections.
+	 *
+	 * @param client Connection to handle
+	 * @param on_disconnect Called on the reactor thread when the connection ends
+	 */
+	void add(ssl_client* client, reactor_disconnect_t on_disconnect);
+
+	/**
+	 * @brief Stop handling a connection, without calling its reactor_disconnect_t callback.
+	 * When this returns, the reactor will not call the connection again. Does nothing if
+	 * the connection is not in a reactor. ssl_client::close() calls this.
+	 *
+	 * @param client Connection to stop handling
+	 */
+	static void remove(ssl_client* client);
+
+	/**
+	 * @brief Get the number of reactor threads
+	 *
+	 * @return size_t number of threads
+	 */
+	size_t get_thread_count() const;
+
+	/**
+	 * @brief Get the number of connections the reactor is handling
+	 *
+	 * @return size_t number of connections
+	 */
+	size_t get_connection_count() const;
+};
+
+};
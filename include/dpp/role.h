@@ -20,6 +20,7 @@
  ************************************************************************************/
 #pragma once
 #include <dpp/export.h>
+#include <dpp/slab.h>
 #include <dpp/json_fwd.hpp>
 
 namespace dpp {
@@ -111,6 +112,11 @@ public:
 	/** Default destructor */
 	virtual ~role();
 
+	/**
+	 * @brief role objects are allocated from a slab, as many are cached at once
+	 */
+	slab_decl(role);
+
 	/** Fill this role from json.
 	 * @param guild_id the guild id to place in the json
 	 * @param j The json data
@@ -0,0 +1,155 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * Copyright 2021 Craig Edwards and D++ contributors 
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <dpp/export.h>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace dpp {
+
+	/**
+	 * @brief A slab allocator hands out fixed size blocks of memory carved from
+	 * large slabs. It is used for the objects the library stores in its caches,
+	 * such as dpp::user and dpp::role, so that loading a guild with thousands of
+	 * members makes a handful of allocations rather than thousands, and the
+	 * objects end up packed together in memory.
+	 *
+	 * Each thread keeps a small cache of free blocks per allocator, so most
+	 * allocations and frees don't touch the shared lock. Blocks freed on one
+	 * thread can be reused by any other. Slabs are never returned to the
+	 * operating system; freed blocks are kept for reuse.
+	 */
+	class DPP_EXPORT slab_allocator {
+	private:
+		/** Protects free_list, free_count and slabs */
+		std::mutex slab_mutex;
+
+		/** Shared list of free blocks, linked through their first word */
+		void* free_list;
+
+		/** Number of blocks in free_list */
+		size_t free_count;
+
+		/** Every slab allocated */
+		std::vector<void*> slabs;
+
+		/** Size of each block */
+		size_t block_size;
+
+		/** Number of blocks in each slab */
+		size_t blocks_per_slab;
+
+		/** Index of this allocator's entry in each thread's local cache */
+		size_t thread_index;
+
+		/**
+		 * @brief Move up to count blocks from the shared list into the calling
+		 * thread's cache, carving a new slab if the shared list is empty
+		 * 
+		 * @param count number of blocks wanted
+		 */
+		void refill(size_t count);
+
+	public:
+		/**
+		 * @brief Construct a new slab allocator
+		 * 
+		 * @param size Size of each block. Rounded up to pointer alignment.
+		 */
+		slab_allocator(size_t size);
+
+		slab_allocator(const slab_allocator&) = delete;
+
+		slab_allocator& operator=(const slab_allocator&) = delete;
+
+		/**
+		 * @brief Allocate a block
+		 * 
+		 * @return void* Pointer to an uninitialised block
+		 * @throw std::bad_alloc if a new slab could not be allocated
+		 */
+		void* allocate();
+
+		/**
+		 * @brief Return a block to the allocator
+		 * 
+		 * @param block Block previously returned by allocate(), or nullptr
+		 */
+		void deallocate(void* block);
+
+		/**
+		 * @brief Return a list of blocks from a thread's cache to the shared list
+		 * 
+		 * @param head First block of the list
+		 * @param tail Last block of the list
+		 * @param count Number of blocks in the list
+		 */
+		void release(void* head, void* tail, size_t count);
+
+		/**
+		 * @brief Get the size of each block
+		 * 
+		 * @return size_t block size in bytes
+		 */
+		size_t get_block_size() const;
+
+		/**
+		 * @brief Get the total memory allocated for slabs
+		 * 
+		 * @return size_t size in bytes
+		 */
+		size_t bytes();
+	};
+
+	/**
+	 * @brief Declare slab allocation for a class. Place inside the class body.
+	 * Only objects of exactly this type come from the slab; derived
+	 * classes of a different size are allocated normally.
+	 */
+	#define slab_decl(type) \
+		static void* operator new(size_t size); \
+		static void operator delete(void* p, size_t size); \
+		static slab_allocator& get_slab();
+
+	/**
+	 * @brief Define slab allocation for a class declared with slab_decl.
+	 * Place in the class's translation unit, inside namespace dpp.
+	 */
+	#define slab_helper(type) \
+	slab_allocator& type::get_slab() { \
+		static slab_allocator* a = new slab_allocator(sizeof(type)); \
+		return *a; \
+	} \
+	void* type::operator new(size_t size) { \
+		return size == sizeof(type) ? get_slab().allocate() : ::operator new(size); \
+	} \
+	void type::operator delete(void* p, size_t size) { \
+		if (size == sizeof(type)) { \
+			get_slab().deallocate(p); \
+		} else { \
+			::operator delete(p); \
+		} \
+	}
+
+};
@@ -0,0 +1,416 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * Copyright 2021 Craig Edwards and D++ contributors 
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <dpp/export.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dpp {
+
+	/**
+	 * @brief A vector which stores up to N elements inline, and only allocates
+	 * on the heap once it grows beyond that. Used where there are very many small
+	 * lists, such as the roles of each guild member, most of which have no more
+	 * than a couple of entries.
+	 *
+	 * Only trivially copyable types such as dpp::snowflake may be stored. The
+	 * interface is the commonly used part of std::vector's, and a small_vector
+	 * converts to and from a std::vector of the same type.
+	 * 
+	 * @tparam T element type
+	 * @tparam N number of elements stored inline
+	 */
+	template<typename T, size_t N> class small_vector {
+		static_assert(std::is_trivially_copyable<T>::value, "small_vector can only hold trivially copyable types");
+		static_assert(N > 0, "small_vector needs at least one inline element");
+
+		/** Inline elements, or a pointer to the heap once capacity exceeds N */
+		union {
+			T local[N];
+			T* heap;
+		};
+
+		/** Number of elements */
+		uint32_t count;
+
+		/** Number of elements which fit without growing */
+		uint32_t cap;
+
+		/** True if the elements are on the heap */
+		bool on_heap() const {
+			return cap > N;
+		}
+
+	public:
+		typedef T value_type;
+		typedef T* iterator;
+		typedef const T* const_iterator;
+
+		/**
+		 * @brief Construct an empty small_vector
+		 */
+		small_vector() : count(0), cap(N) {
+		}
+
+		/**
+		 * @brief Construct a small_vector from a list of values
+		 * 
+		 * @param values values to copy
+		 */
+		small_vector(std::initializer_list<T> values) : count(0), cap(N) {
+			reserve(values.size());
+			for (auto& v : values) {
+				push_back(v);
+			}
+		}
+
+		/**
+		 * @brief Construct a small_vector from a range of values
+		 * 
+		 * @param first first value to copy
+		 * @param last end of the values to copy
+		 */
+		template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+		small_vector(InputIt first, InputIt last) : count(0), cap(N) {
+			assign(first, last);
+		}
+
+		/**
+		 * @brief Construct a small_vector from a std::vector
+		 * 
+		 * @param values values to copy
+		 */
+		small_vector(const std::vector<T>& values) : count(0), cap(N) {
+			assign(values.begin(), values.end());
+		}
+
+		small_vector(const small_vector& other) : count(0), cap(N) {
+			*this = other;
+		}
+
+		small_vector(small_vector&& other) noexcept : count(0), cap(N) {
+			*this = std::move(other);
+		}
+
+		~small_vector() {
+			if (on_heap()) {
+				delete[] heap;
+			}
+		}
+
+		small_vector& operator=(const small_vector& other) {
+			if (this != &other) {
+				clear();
+				reserve(other.count);
+				std::memcpy(data(), other.data(), other.count * sizeof(T));
+				count = other.count;
+			}
+			return *this;
+		}
+
+		small_vector& operator=(small_vector&& other) noexcept {
+			if (this != &other) {
+				if (on_heap()) {
+					delete[] heap;
+				}
+				if (other.on_heap()) {
+					/* Steal the heap block */
+					heap = other.heap;
+				} else {
+					std::memcpy(local, other.local, other.count * sizeof(T));
+				}
+				count = other.count;
+				cap = other.cap;
+				other.count = 0;
+				other.cap = N;
+			}
+			return *this;
+		}
+
+		small_vector& operator=(const std::vector<T>& values) {
+			assign(values.begin(), values.end());
+			return *this;
+		}
+
+		/**
+		 * @brief Copy into a std::vector
+		 * 
+		 * @return std::vector<T> copy of the elements
+		 */
+		operator std::vector<T>() const {
+			return std::vector<T>(begin(), end());
+		}
+
+		/**
+		 * @brief Replace the contents with a range of values
+		 * 
+		 * @param first first value to copy
+		 * @param last end of the values to copy
+		 */
+		template<typename InputIt> void assign(InputIt first, InputIt last) {
+			count = 0;
+			for (; first != last; ++first) {
+				push_back(*first);
+			}
+		}
+
+		/**
+		 * @brief Make room for at least n elements
+		 * 
+		 * @param n number of elements
+		 */
+		void reserve(size_t n) {
+			if (n > cap) {
+				T* grown = new T[n];
+				std::memcpy(grown, data(), count * sizeof(T));
+				if (on_heap()) {
+					delete[] heap;
+				}
+				heap = grown;
+				cap = (uint32_t)n;
+			}
+		}
+
+		/**
+		 * @brief Add an element to the end
+		 * 
+		 * @param value value to add
+		 */
+		void push_back(const T& value) {
+			/* value may be one of our own elements, which growing would free */
+			T v = value;
+			if (count == cap) {
+				reserve(cap * 2);
+			}
+			data()[count++] = v;
+		}
+
+		/**
+		 * @brief Construct an element at the end
+		 * 
+		 * @param args constructor arguments of the element
+		 * @return T& the new element
+		 */
+		template<typename... Args> T& emplace_back(Args&&... args) {
+			push_back(T(std::forward<Args>(args)...));
+			return back();
+		}
+
+		/**
+		 * @brief Remove the last element
+		 */
+		void pop_back() {
+			count--;
+		}
+
+		/**
+		 * @brief Insert an element
+		 * 
+		 * @param pos element to insert before
+		 * @param value value to insert
+		 * @return iterator the inserted element
+		 */
+		iterator insert(const_iterator pos, const T& value) {
+			size_t i = pos - data();
+			/* value may be one of our own elements, which growing would free */
+			T v = value;
+			if (count == cap) {
+				reserve(cap * 2);
+			}
+			std::memmove(data() + i + 1, data() + i, (count - i) * sizeof(T));
+			data()[i] = v;
+			count++;
+			return data() + i;
+		}
+
+		/**
+		 * @brief Insert a range of values
+		 * 
+		 * @param pos element to insert before
+		 * @param first first value to insert
+		 * @param last end of the values to insert
+		 * @return iterator the first inserted element
+		 */
+		template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+		iterator insert(const_iterator pos, InputIt first, InputIt last) {
+			size_t i = pos - data();
+			for (size_t j = i; first != last; ++first, ++j) {
+				insert(data() + j, *first);
+			}
+			return data() + i;
+		}
+
+		/**
+		 * @brief Change the number of elements. New elements are value initialised.
+		 * 
+		 * @param n new number of elements
+		 */
+		void resize(size_t n) {
+			reserve(n);
+			for (size_t i = count; i < n; ++i) {
+				data()[i] = T();
+			}
+			count = (uint32_t)n;
+		}
+
+		/**
+		 * @brief Remove a range of elements
+		 * 
+		 * @param first first element to remove
+		 * @param last end of the elements to remove
+		 * @return iterator the element after the removed ones
+		 */
+		iterator erase(const_iterator first, const_iterator last) {
+			size_t i = first - data();
+			size_t n = last - first;
+			std::memmove(data() + i, data() + i + n, (count - i - n) * sizeof(T));
+			count -= (uint32_t)n;
+			return data() + i;
+		}
+
+		/**
+		 * @brief Remove an element
+		 * 
+		 * @param pos element to remove
+		 * @return iterator the element after the removed one
+		 */
+		iterator erase(const_iterator pos) {
+			size_t i = pos - data();
+			std::memmove(data() + i, data() + i + 1, (count - i - 1) * sizeof(T));
+			count--;
+			return data() + i;
+		}
+
+		/**
+		 * @brief Remove all elements, and free any heap storage
+		 */
+		void clear() {
+			if (on_heap()) {
+				delete[] heap;
+			}
+			count = 0;
+			cap = N;
+		}
+
+		size_t size() const {
+			return count;
+		}
+
+		bool empty() const {
+			return count == 0;
+		}
+
+		size_t capacity() const {
+			return cap;
+		}
+
+		/**
+		 * @brief Get the number of bytes allocated on the heap, not counting
+		 * the small_vector itself
+		 * 
+		 * @return size_t heap bytes
+		 */
+		size_t heap_bytes() const {
+			return on_heap() ? cap * sizeof(T) : 0;
+		}
+
+		T* data() {
+			return on_heap() ? heap : local;
+		}
+
+		const T* data() const {
+			return on_heap() ? heap : local;
+		}
+
+		T& operator[](size_t i) {
+			return data()[i];
+		}
+
+		const T& operator[](size_t i) const {
+			return data()[i];
+		}
+
+		T& front() {
+			return data()[0];
+		}
+
+		const T& front() const {
+			return data()[0];
+		}
+
+		T& back() {
+			return data()[count - 1];
+		}
+
+		const T& back() const {
+			return data()[count - 1];
+		}
+
+		bool operator==(const small_vector& other) const {
+			return count == other.count && std::equal(begin(), end(), other.begin());
+		}
+
+		bool operator!=(const small_vector& other) const {
+			return !(*this == other);
+		}
+
+		bool operator==(const std::vector<T>& other) const {
+			return count == other.size() && std::equal(begin(), end(), other.begin());
+		}
+
+		bool operator!=(const std::vector<T>& other) const {
+			return !(*this == other);
+		}
+
+		iterator begin() {
+			return data();
+		}
+
+		iterator end() {
+			return data() + count;
+		}
+
+		const_iterator begin() const {
+			return data();
+		}
+
+		const_iterator end() const {
+			return data() + count;
+		}
+	};
+
+	template<typename T, size_t N> bool operator==(const std::vector<T>& a, const small_vector<T, N>& b) {
+		return b == a;
+	}
+
+	template<typename T, size_t N> bool operator!=(const std::vector<T>& a, const small_vector<T, N>& b) {
+		return b != a;
+	}
+
+};
@@ -21,6 +21,9 @@
 #pragma once
 #include <dpp/export.h>
 #include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
 #include <functional>
 #include <dpp/discord.h>
 #include <dpp/socket.h>
@@ -33,6 +36,46 @@ namespace dpp {
  */
 class opensslcontext;
 
+class reactor;
+class reactor_thread;
+
+/**
+ * @brief Metrics of TLS handshakes made by ssl_client
+ */
+struct DPP_EXPORT tls_stats {
+	/** Handshakes which negotiated a new session */
+	uint64_t full_handshakes = 0;
+	/** Abbreviated handshakes which resumed a session from an earlier connection */
+	uint64_t resumed_handshakes = 0;
+	/** Host and port pairs which have a session to resume */
+	uint64_t sessions = 0;
+};
+
+/**
+ * @brief Get metrics of TLS handshakes. All ssl_client connections share one SSL context,
+ * which caches the session for each host, so reconnecting shards and voice websockets
+ * resume their session instead of doing a full handshake.
+ *
+ * @return tls_stats metrics
+ */
+DPP_EXPORT tls_stats get_tls_stats();
+
+/**
+ * @brief Metrics of the output queue of an ssl_client
+ */
+struct DPP_EXPORT send_queue_stats {
+	/** Bytes waiting to be sent */
+	uint64_t bytes_queued = 0;
+	/** Buffers waiting to be sent */
+	uint64_t buffers_queued = 0;
+	/** Buffers sent since the client was created */
+	uint64_t buffers_sent = 0;
+	/** Average seconds from a buffer being queued until openssl had taken all of it */
+	double average_flush_time = 0;
+	/** Longest seconds from a buffer being queued until openssl had taken all of it */
+	double max_flush_time = 0;
+};
+
 /**
  * @brief Implements a simple non-blocking SSL stream client.
  * 
@@ -46,8 +89,21 @@ protected:
 	/** Input buffer received from openssl */
 	std::string buffer;
 
-	/** Output buffer for sending to openssl */
-	std::string obuffer;
+	/**
+	 * @brief A buffer in the output queue
+	 */
+	struct send_buffer {
+		/** Data to send */
+		std::string data;
+		/** Time it was queued, on the dpp::utility::time_f() clock */
+		double queued_at;
+	};
+
+	/** Output queue for sending to openssl. Each buffer is passed to SSL_write() as it is, without being copied. */
+	std::deque<send_buffer> obuffer;
+
+	/** Bytes of the buffer at the front of obuffer which have been sent */
+	size_t obuffer_offset;
 
 	/** True if in nonblocking mode. The socket switches to nonblocking mode
 	 * once ReadLoop is called.
@@ -78,11 +134,55 @@ protected:
 	/** Bytes in */
 	uint64_t bytes_in;
 
+	/** True if openssl needs the socket to be writeable before it can read */
+	bool read_blocked_on_write;
+
+	/** True if openssl needs the socket to be readable before it can write */
+	bool write_blocked_on_read;
+
+	/** The reactor thread handling this connection, or nullptr if the connection runs read_loop() itself */
+	std::atomic<reactor_thread*> io_thread;
+
+	/** Output queue metrics, see send_queue_stats */
+	std::atomic<uint64_t> bytes_queued, buffers_queued, buffers_sent, flush_time_total_us, flush_time_max_us;
+
 	/** Called every second */
 	virtual void one_second_timer();
 
 	/** Start connection */
 	virtual void Connect();
+
+	/**
+	 * @brief Write a buffer, taking ownership of it so that it isn't copied on its way to openssl.
+	 * Works in the same way as write().
+	 * 
+	 * @param data Data to be written
+	 */
+	void write_buffer(std::string&& data);
+
+	/**
+	 * @brief Switch the socket to non-blocking mode, ready for handle_io()
+	 */
+	void set_nonblocking();
+
+	/**
+	 * @brief Read from and write to the connection, after the socket became readable or writeable.
+	 * Called by read_loop(), or by a reactor which is handling the connection.
+	 * 
+	 * @param readable True if the socket is readable
+	 * @param writeable True if the socket is writeable
+	 * @return false if the connection ended
+	 */
+	bool handle_io(bool readable, bool writeable);
+
+	/**
+	 * @brief Returns true if there is data waiting to be written, so handle_io()
+	 * should be called when the socket is writeable.
+	 */
+	bool wants_write() const;
+
+	friend class reactor;
+	friend class reactor_thread;
 public:
 	/** Get total bytes sent */
 	uint64_t get_bytes_out();
@@ -93,6 +193,13 @@ public:
 	/** Get SSL cipher name */
 	std::string get_cipher();
 
+	/**
+	 * @brief Get metrics of the output queue
+	 * 
+	 * @return send_queue_stats metrics
+	 */
+	send_queue_stats get_send_queue_stats();
+
 	/**
 	 * @brief Attaching an additional file descriptor to this function will send notifications when there is data to read.
 	 * 
@@ -150,7 +257,8 @@ public:
 	virtual void write(const std::string &data);
 
 	/**
-	 * @brief Close SSL connection
+	 * @brief Close SSL connection. If a reactor is handling the connection,
+	 * it is removed from the reactor first.
 	 */
 	virtual void close();
 
@@ -20,7 +20,9 @@
  ************************************************************************************/
 #pragma once
 #include <dpp/export.h>
+#include <dpp/slab.h>
 #include <dpp/json_fwd.hpp>
+#include <atomic>
 
 namespace dpp {
 
@@ -83,19 +85,42 @@ public:
 	utility::iconhash avatar;
 	/** Flags built from a bitmask of values in dpp::user_flags */
 	uint32_t flags;
-	/** Reference count of how many guilds this user is in */
-	uint8_t refcount;
+	/**
+	 * @brief Reference count of how many guilds this user is in. Shards add and
+	 * remove guild members on their own threads, so this is atomic.
+	 */
+	std::atomic<uint32_t> refcount;
 
 	/**
 	 * @brief Construct a new user object
 	 */
 	user();
 
+	/**
+	 * @brief Copy a user object
+	 * 
+	 * @param other user to copy
+	 */
+	user(const user& other);
+
+	/**
+	 * @brief Copy a user object
+	 * 
+	 * @param other user to copy
+	 * @return user& reference to self
+	 */
+	user& operator=(const user& other);
+
 	/**
 	 * @brief Destroy the user object
 	 */
 	virtual ~user();
 
+	/**
+	 * @brief user objects are allocated from a slab, as many are cached at once
+	 */
+	slab_decl(user);
+
 	/** Fill this record from json.
 	 * @param j The json to fill this record from
 	 * @return Reference to self
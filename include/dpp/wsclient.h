@@ -24,6 +24,7 @@
 #include <map>
 #include <vector>
 #include <variant>
+#include <string_view>
 #include <dpp/sslclient.h>
 
 namespace dpp {
@@ -34,6 +35,18 @@ enum websocket_protocol_t {
 	ws_etf = 1
 };
 
+/**
+ * @brief Transport compression of a gateway connection, used when compression is enabled
+ */
+enum transport_compression_t {
+	/** zlib-stream, supported by all builds */
+	tc_zlib_stream = 0,
+	/** zstd-stream, which takes much less CPU to decompress.
+	 * Only supported when D++ was built with libzstd.
+	 */
+	tc_zstd_stream = 1
+};
+
 /**
  * @brief Websocket connection status
  */
@@ -81,10 +94,21 @@ class DPP_EXPORT websocket_client : public ssl_client
 	/** HTTP headers received on connecting/upgrading */
 	std::map<std::string, std::string> HTTPHeaders;
 
-	/** Parse headers for a websocket frame from the buffer.
-	 * @param buffer The buffer to operate on. Will modify the string removing completed items from the head of the queue
+	/** Payload of a fragmented message, collected until its final frame arrives */
+	std::string fragments;
+
+	/** True while collecting the fragments of a message */
+	bool fragmented;
+
+	/** Largest message accepted, see set_max_message_size() */
+	size_t max_message_size;
+
+	/** Parse headers for a websocket frame from the buffer, and handle the frame if it is complete.
+	 * @param buffer The buffer to operate on. Frames are not removed from it, see handle_buffer().
+	 * @param offset Offset of the frame in the buffer. Advanced past the frame if it was handled.
+	 * @return True if a frame was handled, and there may be another after it
 	 */
-	bool parseheader(std::string &buffer);
+	bool parseheader(std::string &buffer, size_t &offset);
 
 	/** Unpack a frame and pass completed frames up the stack.
 	 * @param buffer The buffer to operate on. Gets modified to remove completed frames on the head of the buffer
@@ -100,11 +124,17 @@ class DPP_EXPORT websocket_client : public ssl_client
 	 */
 	size_t FillHeader(unsigned char* outbuf, size_t sendlength, ws_opcode opcode);
 
+	/** Queue a frame for sending, with its header
+	 * @param payload The data to encapsulate
+	 * @param opcode the ws_opcode to send in the header
+	 */
+	void WriteFrame(std::string_view payload, ws_opcode opcode);
+
 	/** Handle ping and pong requests.
 	 * @param ping True if this is a ping, false if it is a pong 
 	 * @param payload The ping payload, to be returned as-is for a ping
 	 */
-	void HandlePingPong(bool ping, const std::string &payload);
+	void HandlePingPong(bool ping, std::string_view payload);
 
 protected:
 
@@ -147,6 +177,22 @@ public:
 	 */
         virtual void close();
 
+	/**
+	 * @brief Set the largest message accepted from the server. Messages split into fragments are
+	 * reassembled before HandleFrame() is called, and count as one message. If a message is bigger
+	 * than this, Error() is called with close code 1009 and the connection is dropped.
+	 * 
+	 * @param bytes Size in bytes. The default is 64MB.
+	 */
+	void set_max_message_size(size_t bytes);
+
+	/**
+	 * @brief Get the largest message accepted from the server
+	 * 
+	 * @return size_t size in bytes
+	 */
+	size_t get_max_message_size() const;
+
 	/**
 	 * @brief Receives raw frame content only without headers
 	 * 
@@ -155,6 +201,17 @@ public:
 	 */
 	virtual bool HandleFrame(const std::string &buffer);
 
+	/**
+	 * @brief Receives raw frame content only without headers, without copying it out of the
+	 * receive buffer. Fragmented messages are passed whole, once their last fragment has
+	 * arrived. The view is only valid until this returns. Deriving classes should override
+	 * this rather than HandleFrame(const std::string&), which this calls with a copy of the frame by default.
+	 * 
+	 * @param buffer The frame contents
+	 * @return True if the frame was successfully handled. False if no valid frame is in the buffer.
+	 */
+	virtual bool HandleFrame(std::string_view buffer);
+
 	/**
 	 * @brief Called upon error frame.
 	 * 
@@ -0,0 +1,130 @@
+#undef DPP_BUILD
+#ifdef _WIN32
+_Pragma("warning( disable : 4251 )"); // 4251 warns when we export classes or structures with stl member variables
+#endif
+#include <dpp/dpp.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+/* Cache benchmarks. Build with -DDPP_BUILD_BENCH=ON and run ./cachebench [threads] [seconds]
+ *
+ * contention: every thread looks up random users in a preloaded cache, and one lookup in
+ * twenty is a store and remove instead, roughly the mix seen while shards chunk guild
+ * members. Run once with a single stripe, which is how the cache was locked before it was
+ * split, and once with the number of stripes the user cache uses.
+ *
+ * container: single threaded random lookups of snowflake ids in dpp::cache_container, which
+ * each cache stripe uses, and in the std::unordered_map it replaced.
+ */
+
+#define PRELOADED_USERS	100000
+#define CONTAINER_KEYS	2000000
+#define CONTAINER_LOOKUPS	10000000
+
+/* Snowflake-like ids: a millisecond timestamp in the top bits, and a small increment below */
+std::vector<uint64_t> make_ids(size_t n) {
+	std::vector<uint64_t> ids;
+	ids.reserve(n);
+	uint64_t timestamp = 1000000000000ull;
+	for (size_t i = 0; i < n; ++i) {
+		timestamp += 1 + i % 7;
+		ids.push_back((timestamp << 22) | (i & 0xFFF));
+	}
+	return ids;
+}
+
+template<typename M> double lookups(M& m, const std::vector<uint64_t>& ids, uintptr_t& sink) {
+	uint64_t seed = 0x9E3779B97F4A7C15ull;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < CONTAINER_LOOKUPS; ++i) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		auto it = m.find(ids[seed % ids.size()]);
+		if (it != m.end()) {
+			sink += (uintptr_t)it->second;
+		}
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / CONTAINER_LOOKUPS;
+}
+
+void container() {
+	std::vector<uint64_t> ids = make_ids(CONTAINER_KEYS);
+	/* Values are never dereferenced, only summed so the lookups can't be optimised away */
+	uintptr_t sink = 0;
+	dpp::cache_container flat;
+	std::unordered_map<uint64_t, dpp::managed*> node;
+	for (uint64_t id : ids) {
+		flat.insert({id, (dpp::managed*)(uintptr_t)id});
+		node.emplace(id, (dpp::managed*)(uintptr_t)id);
+	}
+	size_t node_bytes = node.bucket_count() * sizeof(void*) + node.size() * (sizeof(std::pair<const uint64_t, dpp::managed*>) + sizeof(void*) + sizeof(size_t));
+	std::cout << "container, " << CONTAINER_KEYS << " keys, " << CONTAINER_LOOKUPS << " random lookups" << std::endl;
+	std::cout << "  cache_container: " << lookups(flat, ids, sink) << "ns per lookup, " << flat.bytes() / (1024 * 1024) << "MB" << std::endl;
+	std::cout << "  std::unordered_map: " << lookups(node, ids, sink) << "ns per lookup, about " << node_bytes / (1024 * 1024) << "MB before allocator overhead" << std::endl;
+	if (sink == 42) {
+		std::cout << std::endl;
+	}
+}
+
+double contention(size_t stripes, unsigned threads, double seconds) {
+	dpp::cache c(stripes);
+	for (dpp::snowflake id = 1; id <= PRELOADED_USERS; ++id) {
+		dpp::user* u = new dpp::user();
+		u->id = id;
+		c.store(u);
+	}
+	std::atomic<bool> running(true);
+	std::atomic<uint64_t> ops(0);
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.emplace_back([&c, &running, &ops, t]() {
+			uint64_t seed = 0x9E3779B97F4A7C15ull * (t + 1);
+			uint64_t done = 0;
+			/* Ids stored by this thread don't collide with the preloaded ones or other threads' */
+			dpp::snowflake next_id = PRELOADED_USERS + 1 + t * (1ull << 40);
+			while (running) {
+				seed ^= seed << 13;
+				seed ^= seed >> 7;
+				seed ^= seed << 17;
+				if (seed % 20 == 0) {
+					/* Removed objects are retired, not freed, so guard them like the library does */
+					dpp::epoch_guard guard;
+					dpp::user* u = new dpp::user();
+					u->id = next_id++;
+					c.store(u);
+					c.remove(u);
+				} else {
+					c.find(1 + seed % PRELOADED_USERS);
+				}
+				done++;
+			}
+			ops += done;
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+	running = false;
+	for (auto& w : workers) {
+		w.join();
+	}
+	return ops / seconds;
+}
+
+int main(int argc, char** argv) {
+	unsigned threads = argc > 1 ? std::stoul(argv[1]) : std::max(2u, std::thread::hardware_concurrency());
+	double seconds = argc > 2 ? std::stod(argv[2]) : 5.0;
+
+	std::cout << "contention, " << threads << " threads, " << seconds << "s each" << std::endl;
+	for (size_t stripes : {1, 64}) {
+		double rate = contention(stripes, threads, seconds);
+		std::cout << "  " << stripes << " stripes: " << (uint64_t)(rate / 1000) << "k ops/s" << std::endl;
+	}
+
+	container();
+	return 0;
+}
@@ -0,0 +1,141 @@
+#undef DPP_BUILD
+#ifdef _WIN32
+_Pragma("warning( disable : 4251 )"); // 4251 warns when we export classes or structures with stl member variables
+#endif
+#include <dpp/dpp.h>
+#include <iostream>
+#include <chrono>
+#include <string>
+#include "../unittest/tls_server.h"
+
+/* Websocket receive benchmark. Build with -DDPP_BUILD_BENCH=ON and run ./wsbench [rounds]
+ *
+ * Replays gateway-like traffic through websocket_client::handle_buffer() in 16KB pieces, the
+ * most a TLS read returns. Each round is one 2MB frame, like a GUILD_CREATE for a large guild,
+ * followed by 2000 events of 100 to 1000 bytes. The client is connected to a local TLS stand-in
+ * first, as ssl_client connects in its constructor, but the traffic doesn't go over it.
+ *
+ * For comparison the same traffic goes through the parser the client used before frames were
+ * handled in place, which copied each frame out with substr() and then erased it from the
+ * front of the buffer.
+ */
+
+#define READ_SIZE	16 * 1024
+#define LARGE_FRAME	2 * 1024 * 1024
+#define SMALL_FRAMES	2000
+
+/* An unmasked, final text frame, as a server sends it */
+std::string frame(const std::string& payload) {
+	std::string f;
+	f += (char)(dpp::OP_TEXT | 0x80);
+	size_t n = payload.size();
+	if (n <= 125) {
+		f += (char)n;
+	} else if (n <= 65535) {
+		f += (char)126;
+		f += (char)(n >> 8);
+		f += (char)(n & 0xff);
+	} else {
+		f += (char)127;
+		for (int i = 7; i >= 0; --i) {
+			f += (char)((uint64_t)n >> (i * 8));
+		}
+	}
+	return f + payload;
+}
+
+size_t frames = 0;
+size_t frame_bytes = 0;
+
+class bench_client : public dpp::websocket_client {
+public:
+	bench_client(const tls_server& server) : dpp::websocket_client(server.host(), server.port(), "/") {
+		std::string upgrade = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n\r\n";
+		handle_buffer(upgrade);
+	}
+
+	using dpp::websocket_client::HandleFrame;
+
+	bool HandleFrame(std::string_view buffer) override {
+		frames++;
+		frame_bytes += buffer.size();
+		return true;
+	}
+};
+
+/* The previous parser, reduced to the copying it did for each frame */
+bool old_parseheader(std::string& data) {
+	if (data.size() < 4) {
+		return false;
+	}
+	unsigned char len1 = data[1];
+	unsigned int payloadstartoffset = 2;
+	uint64_t len = len1;
+	if (len1 == 126) {
+		len = ((unsigned char)data[2] << 8) | (unsigned char)data[3];
+		payloadstartoffset += 2;
+	} else if (len1 == 127) {
+		if (data.length() < 10) {
+			return false;
+		}
+		len = 0;
+		for (int v = 2, shift = 56; v < 10; ++v, shift -= 8) {
+			len |= (uint64_t)(unsigned char)data[v] << shift;
+		}
+		payloadstartoffset += 8;
+	}
+	if (data.length() < payloadstartoffset + len) {
+		return false;
+	}
+	std::string payload = data.substr(payloadstartoffset, len);
+	frames++;
+	frame_bytes += payload.size();
+	data.erase(data.begin(), data.begin() + payloadstartoffset + len);
+	return true;
+}
+
+/* Feed the traffic to a parser in reads, and return GB/s of traffic handled */
+template<typename F> double replay(const std::string& traffic, F parse) {
+	std::string buffer;
+	frames = frame_bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t pos = 0; pos < traffic.size(); pos += READ_SIZE) {
+		buffer.append(traffic, pos, READ_SIZE);
+		parse(buffer);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return traffic.size() / elapsed.count() / (1024.0 * 1024.0 * 1024.0);
+}
+
+int main(int argc, char** argv) {
+	int rounds = argc > 1 ? std::stoi(argv[1]) : 20;
+
+	std::string traffic;
+	for (int round = 0; round < rounds; ++round) {
+		traffic += frame(std::string(LARGE_FRAME, 'g'));
+		for (int i = 0; i < SMALL_FRAMES; ++i) {
+			traffic += frame(std::string(100 + (i * 37) % 900, 'e'));
+		}
+	}
+	size_t expected = rounds * (SMALL_FRAMES + 1);
+	std::cout << "websocket receive, " << traffic.size() / (1024 * 1024) << "MB in " << expected << " frames, " << READ_SIZE << " byte reads" << std::endl;
+
+	double old_rate = replay(traffic, [](std::string& buffer) {
+		while (old_parseheader(buffer));
+	});
+	std::cout << "  copy and erase each frame: " << old_rate << " GB/s, " << frames << " frames" << std::endl;
+
+	tls_server server;
+	{
+		bench_client client(server);
+		double rate = replay(traffic, [&client](std::string& buffer) {
+			client.handle_buffer(buffer);
+		});
+		std::cout << "  websocket_client: " << rate << " GB/s, " << frames << " frames" << std::endl;
+		if (frames != expected) {
+			std::cout << "  websocket_client handled " << frames << " frames, expected " << expected << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
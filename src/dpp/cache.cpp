@@ -20,24 +20,229 @@
  ************************************************************************************/
 #include <dpp/discord.h>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <algorithm>
 #include <iostream>
 #include <variant>
 #include <dpp/cache.h>
 #include <dpp/guild.h>
 
+/* Number of lock stripes for each of the major caches. The user cache is
+ * by far the busiest, as it is written to by every shard during guild
+ * member chunking, and read by almost every event.
+ */
+#ifndef DPP_USER_CACHE_STRIPES
+#define DPP_USER_CACHE_STRIPES 64
+#endif
+#ifndef DPP_GUILD_CACHE_STRIPES
+#define DPP_GUILD_CACHE_STRIPES 16
+#endif
+#ifndef DPP_ROLE_CACHE_STRIPES
+#define DPP_ROLE_CACHE_STRIPES 32
+#endif
+#ifndef DPP_CHANNEL_CACHE_STRIPES
+#define DPP_CHANNEL_CACHE_STRIPES 32
+#endif
+#ifndef DPP_EMOJI_CACHE_STRIPES
+#define DPP_EMOJI_CACHE_STRIPES 16
+#endif
+
+/* Seconds a retired object is kept for at least, even once no pinned thread can see it */
+#define RETIRE_GRACE_PERIOD 60
+
 namespace dpp {
 
-std::unordered_map<managed*, time_t> deletion_queue;
-std::mutex deletion_mutex;
+/* Because other threads may still be using an object for a short while after it is replaced or
+ * removed from a cache, we don't delete pointers straight away. They are retired, stamped with
+ * the current epoch and time. Any thread that may be looking at cached objects pins itself to the
+ * current epoch with an epoch_guard, and an object is freed once every pinned thread has pinned at a
+ * later epoch than the one it was retired in. Not every pointer is read under a guard, e.g.
+ * message::author, or pointers kept by user code, so an object is also kept for at least
+ * RETIRE_GRACE_PERIOD seconds, as it always was before guards existed.
+ */
+namespace {
+
+/**
+ * @brief A thread which takes part in epoch based reclamation
+ */
+struct epoch_participant {
+	/** Epoch the thread is pinned at, or zero if not pinned */
+	std::atomic<uint64_t> epoch{0};
+	/** Nesting depth of epoch_guard on this thread */
+	uint32_t depth = 0;
+};
+
+/**
+ * @brief An object waiting to be freed
+ */
+struct retired_object {
+	/** Epoch it was retired in */
+	uint64_t epoch;
+	/** Time it was retired */
+	time_t retired_at;
+	/** The object */
+	managed* object;
+};
+
+/**
+ * @brief Reclamation state shared by all caches.
+ * Allocated once and never freed, so that threads which exit during
+ * static destruction can still deregister themselves.
+ */
+struct reclamation_state {
+	/** Current epoch, starts at 1 as 0 means unpinned */
+	std::atomic<uint64_t> global_epoch{1};
+	/** Protects participants */
+	std::mutex participants_mutex;
+	/** All threads which have ever pinned and not yet exited */
+	std::vector<epoch_participant*> participants;
+	/** Protects retired */
+	std::mutex retired_mutex;
+	/** Retired objects in order of retirement */
+	std::deque<retired_object> retired;
+	/** Number of entries in retired, readable without the lock */
+	std::atomic<size_t> retired_count{0};
+	/** Time the oldest retired object's grace period ends, readable without the lock */
+	std::atomic<time_t> reclaim_due{0};
+	/** Held while a thread is reclaiming */
+	std::mutex reclaim_mutex;
+};
+
+reclamation_state& get_reclamation() {
+	static reclamation_state* state = new reclamation_state();
+	return *state;
+}
+
+/**
+ * @brief Registers the calling thread as a participant on first use,
+ * and removes it again when the thread exits
+ */
+struct participant_registration {
+	epoch_participant* participant = nullptr;
+
+	epoch_participant* get() {
+		if (!participant) {
+			participant = new epoch_participant();
+			reclamation_state& r = get_reclamation();
+			std::lock_guard<std::mutex> lock(r.participants_mutex);
+			r.participants.push_back(participant);
+		}
+		return participant;
+	}
+
+	~participant_registration() {
+		if (participant) {
+			reclamation_state& r = get_reclamation();
+			std::lock_guard<std::mutex> lock(r.participants_mutex);
+			r.participants.erase(std::remove(r.participants.begin(), r.participants.end(), participant), r.participants.end());
+			delete participant;
+		}
+	}
+};
+
+thread_local participant_registration local_participant;
+
+/**
+ * @brief Free every retired object that no pinned thread can still see, and
+ * whose grace period has passed. If another thread is already reclaiming, returns immediately.
+ */
+void reclaim() {
+	reclamation_state& r = get_reclamation();
+	std::unique_lock<std::mutex> reclaim_lock(r.reclaim_mutex, std::try_to_lock);
+	if (!reclaim_lock.owns_lock()) {
+		return;
+	}
+	/* Start a new epoch. Anything retired before now, and not visible to a thread
+	 * which pinned at or before its retirement, is safe to free.
+	 */
+	uint64_t safe = r.global_epoch.fetch_add(1) + 1;
+	{
+		std::lock_guard<std::mutex> lock(r.participants_mutex);
+		for (auto p : r.participants) {
+			uint64_t e = p->epoch.load();
+			if (e && e < safe) {
+				safe = e;
+			}
+		}
+	}
+	time_t expired = time(nullptr) - RETIRE_GRACE_PERIOD;
+	std::vector<managed*> to_free;
+	{
+		std::lock_guard<std::mutex> lock(r.retired_mutex);
+		while (!r.retired.empty() && r.retired.front().epoch < safe && r.retired.front().retired_at <= expired) {
+			to_free.push_back(r.retired.front().object);
+			r.retired.pop_front();
+		}
+		r.retired_count = r.retired.size();
+		if (!r.retired.empty()) {
+			r.reclaim_due = r.retired.front().retired_at + RETIRE_GRACE_PERIOD;
+		}
+	}
+	for (auto m : to_free) {
+		delete m;
+	}
+}
+
+/**
+ * @brief Retire an object which has been removed from a cache.
+ * Must be called after it is no longer reachable through the cache.
+ */
+void retire(managed* object) {
+	reclamation_state& r = get_reclamation();
+	{
+		std::lock_guard<std::mutex> lock(r.retired_mutex);
+		time_t now = time(nullptr);
+		if (r.retired.empty()) {
+			r.reclaim_due = now + RETIRE_GRACE_PERIOD;
+		}
+		r.retired.push_back({r.global_epoch.load(), now, object});
+		r.retired_count = r.retired.size();
+	}
+}
+
+};
+
+epoch_guard::epoch_guard() {
+	epoch_participant* p = local_participant.get();
+	if (p->depth++ == 0) {
+		reclamation_state& r = get_reclamation();
+		/* Publish our epoch, then check it didn't move underneath us. If it did,
+		 * a reclaimer may have scanned before seeing our pin, so pin again.
+		 */
+		uint64_t e;
+		do {
+			e = r.global_epoch.load();
+			p->epoch.store(e);
+		} while (r.global_epoch.load() != e);
+	}
+}
+
+epoch_guard::~epoch_guard() {
+	epoch_participant* p = local_participant.get();
+	if (--p->depth == 0) {
+		p->epoch.store(0);
+		reclamation_state& r = get_reclamation();
+		if (r.retired_count.load() > 0 && time(nullptr) >= r.reclaim_due.load()) {
+			reclaim();
+		}
+	}
+}
+
+size_t get_retired_count() {
+	return get_reclamation().retired_count.load();
+}
 
-#define cache_helper(type, cache_name, setter, getter, counter) \
+#define cache_helper(type, cache_name, setter, getter, counter, stripes) \
 cache* cache_name = nullptr; \
 type * setter (snowflake id) { \
 		return cache_name ? ( type * ) cache_name ->find(id) : nullptr; \
 } \
 cache* getter () { \
 	if (! cache_name ) { \
-		cache_name = new cache(); \
+		cache_name = new cache(stripes); \
 	} \
 	return cache_name ; \
 } \
@@ -46,30 +251,12 @@ uint64_t counter () { \
 }
 
 
-/* Because other threads and systems may run for a short while after an event is received, we don't immediately
- * delete pointers when objects are replaced. We put them into a queue, and periodically delete pointers in the
- * queue. This also rehashes unordered_maps to ensure they free their memory.
+/* Free anything retired which is no longer visible, and rehash unordered_maps to ensure they free their memory.
+ * Retired objects are normally freed when a guard is released after their grace period; this catches
+ * any left behind when no guards are being used.
  */
 void garbage_collection() {
-	time_t now = time(NULL);
-	bool repeat = false;
-	{
-		std::lock_guard<std::mutex> delete_lock(deletion_mutex);
-		do {
-			repeat = false;
-			for (auto g = deletion_queue.begin(); g != deletion_queue.end(); ++g) {
-				if (now > g->second + 60) {
-					delete g->first;
-					deletion_queue.erase(g);
-					repeat = true;
-					break;
-				}
-			}
-		} while (repeat);
-		if (deletion_queue.size() == 0) {
-			deletion_queue = {};
-		}
-	}
+	reclaim();
 	dpp::get_user_cache()->rehash();
 	dpp::get_channel_cache()->rehash();
 	dpp::get_guild_cache()->rehash();
@@ -77,85 +264,614 @@ void garbage_collection() {
 	dpp::get_emoji_cache()->rehash();
 }
 
-cache::cache() {
-	cache_map = new cache_container();
+/* Bounded user caching. Every object in a cache has an age, which is reset when it is stored or
+ * found, and every DPP_USER_SWEEP_INTERVAL seconds the first shard ages the user cache and works out the age at which
+ * users should be evicted, from the TTL and memory budget. Users are evicted right away. Guild
+ * members are evicted by the shard that owns their guild, as only that shard's thread may change
+ * the guild's member list.
+ */
+namespace {
+
+/* Age from which all users and their members are evicted, zero if nothing is to be. Users
+ * evicted individually to meet the memory budget are younger, and their members are found by
+ * their users being missing.
+ */
+std::atomic<uint16_t> user_eviction_age(0);
+
+/* Number of guild members evicted by evict_guild_members() */
+std::atomic<uint64_t> evicted_members(0);
+
+};
+
+void sweep_user_cache(time_t ttl, size_t memory_limit) {
+	cache* uc = get_user_cache();
+	uc->age();
+
+	/* Every user at least this old is evicted */
+	uint32_t cutoff = 0;
+	/* Then this many more users of exactly tie_age are evicted, to meet the memory budget */
+	uint16_t tie_age = 0;
+	size_t ties = 0;
+	if (ttl > 0) {
+		time_t sweeps = (ttl + DPP_USER_SWEEP_INTERVAL - 1) / DPP_USER_SWEEP_INTERVAL;
+		cutoff = (uint32_t)std::min<time_t>(sweeps, UINT16_MAX);
+	}
+	if (memory_limit > 0) {
+		std::vector<uint16_t> user_ages;
+		uint64_t memberships = 0;
+		for (size_t s = 0; s < uc->get_stripe_count(); ++s) {
+			std::shared_lock<std::shared_mutex> lock(uc->get_mutex(s));
+			cache_container& c = uc->get_container(s);
+			for (auto i = c.begin(); i != c.end(); ++i) {
+				user_ages.push_back(c.get_age(i));
+				memberships += ((user*)i->second)->refcount;
+			}
+		}
+		if (!user_ages.empty()) {
+			/* Estimate the cost of one user: the object itself, its share of the cache's slots,
+			 * and the average number of guild member entries that refer to it. A user's refcount
+			 * is the number of guilds it is a member of.
+			 */
+			size_t n = user_ages.size();
+			size_t member_size = sizeof(members_container::value_type) + 2 * sizeof(void*);
+			size_t per_user = user::get_slab().get_block_size() + uc->bytes() / n + (memberships * member_size) / n;
+			size_t keep = memory_limit / per_user;
+			if (keep < n) {
+				/* Keep the youngest users. Ages are coarse, so many users can share the age at
+				 * which the budget is met; evict all users older than that, and only as many
+				 * of that age as are needed. Never evict anything used since the last sweep,
+				 * as it is likely to be needed again straight away.
+				 */
+				std::nth_element(user_ages.begin(), user_ages.begin() + keep, user_ages.end());
+				uint16_t budget_age = user_ages[keep];
+				if (budget_age == 0) {
+					budget_age = 1;
+				} else {
+					tie_age = budget_age;
+					ties = std::count(user_ages.begin() + keep, user_ages.end(), budget_age);
+				}
+				uint32_t budget_cutoff = (uint32_t)budget_age + (tie_age ? 1 : 0);
+				if (cutoff && cutoff <= tie_age) {
+					/* The TTL already evicts every user of the tied age */
+					ties = 0;
+				}
+				cutoff = cutoff ? std::min(cutoff, budget_cutoff) : budget_cutoff;
+			}
+		}
+	}
+	/* Ages stop at UINT16_MAX, so past that only the tied users are evicted */
+	uint16_t full_cutoff = cutoff > UINT16_MAX ? 0 : (uint16_t)cutoff;
+	user_eviction_age = full_cutoff;
+	if (full_cutoff) {
+		uc->evict(full_cutoff, [](managed*) { return true; });
+	}
+	if (ties) {
+		/* Everything older has gone, so only users of the tied age remain to be considered */
+		uc->evict(tie_age, [&ties](managed*) {
+			if (ties == 0) {
+				return false;
+			}
+			ties--;
+			return true;
+		});
+	}
+}
+
+size_t evict_guild_members(uint32_t shard_id, snowflake keep) {
+	uint16_t cutoff = user_eviction_age;
+	if (!cutoff) {
+		return 0;
+	}
+	/* Guilds and users we look at below may be retired by other threads while we use them */
+	epoch_guard guard;
+	std::vector<guild*> guilds;
+	cache* gc = get_guild_cache();
+	for (size_t s = 0; s < gc->get_stripe_count(); ++s) {
+		std::shared_lock<std::shared_mutex> lock(gc->get_mutex(s));
+		cache_container& c = gc->get_container(s);
+		for (auto i = c.begin(); i != c.end(); ++i) {
+			if (((guild*)i->second)->shard_id == shard_id) {
+				guilds.push_back((guild*)i->second);
+			}
+		}
+	}
+	cache* uc = get_user_cache();
+	size_t total = 0;
+	for (guild* g : guilds) {
+		for (auto m = g->members.begin(); m != g->members.end();) {
+			uint16_t age = 0;
+			user* u = (user*)uc->peek(m->first, age);
+			/* A member whose user is already gone was used no more recently than the user was */
+			if (m->first != keep && (!u || age >= cutoff)) {
+				if (u) {
+					uint32_t refs = u->refcount;
+					while (refs > 0 && !u->refcount.compare_exchange_weak(refs, refs - 1)) {
+					}
+				}
+				m = g->members.erase(m);
+				total++;
+			} else {
+				++m;
+			}
+		}
+	}
+	evicted_members += total;
+	return total;
+}
+
+user* acquire_user(snowflake user_id) {
+	/* refcount is only added to under a read lock of the stripe, and only taken from
+	 * under a write lock, so a user can't gain a membership as it is being removed
+	 */
+	return (user*)get_user_cache()->find(user_id, [](managed* m) {
+		((user*)m)->refcount++;
+	});
+}
+
+user* store_user(user* u) {
+	user* cached = (user*)get_user_cache()->store_or_find(u, [](managed* m) {
+		((user*)m)->refcount++;
+	});
+	if (cached != u) {
+		/* Never cached, so nothing else can be using it */
+		delete u;
+	}
+	return cached;
+}
+
+bool release_user(snowflake user_id) {
+	return get_user_cache()->remove_if(user_id, [](managed* m) {
+		user* u = (user*)m;
+		uint32_t refs = u->refcount;
+		if (refs > 0) {
+			u->refcount = --refs;
+		}
+		return refs == 0;
+	});
+}
+
+uint64_t get_evicted_user_count() {
+	return get_user_cache()->get_evicted_count();
+}
+
+uint64_t get_evicted_member_count() {
+	return evicted_members;
+}
+
+/* Maximum load of a cache_container, as a fraction: three entries per four slots */
+#define CONTAINER_LOAD_NUM	3
+#define CONTAINER_LOAD_DEN	4
+/* Smallest non-empty slot array */
+#define CONTAINER_MIN_SLOTS	16
+
+cache_container::cache_container() : slots(nullptr), slot_count(0), slot_shift(64), ages(nullptr), element_count(0) {
+}
+
+cache_container::~cache_container() {
+	delete[] slots;
+	delete[] ages;
+}
+
+size_t cache_container::home(uint64_t key) const {
+	/* Fibonacci hashing. The top bits of the product are the best mixed. The
+	 * cache picks stripes from bits 32 upwards of the same product, so for any
+	 * realistic slot count the bits used here are independent of the stripe.
+	 */
+	return (size_t)((key * 0x9E3779B97F4A7C15ull) >> slot_shift);
+}
+
+size_t cache_container::slots_for(size_t elements) {
+	if (elements == 0) {
+		return 0;
+	}
+	size_t n = CONTAINER_MIN_SLOTS;
+	while (n * CONTAINER_LOAD_NUM < elements * CONTAINER_LOAD_DEN) {
+		n <<= 1;
+	}
+	return n;
+}
+
+void cache_container::resize(size_t new_count) {
+	value_type* old_slots = slots;
+	std::atomic<uint16_t>* old_ages = ages;
+	size_t old_count = slot_count;
+	slots = new_count ? new value_type[new_count]() : nullptr;
+	ages = new_count ? new std::atomic<uint16_t>[new_count]() : nullptr;
+	slot_count = new_count;
+	slot_shift = 64;
+	for (size_t n = new_count; n > 1; n >>= 1) {
+		slot_shift--;
+	}
+	for (size_t i = 0; i < old_count; ++i) {
+		if (old_slots[i].second) {
+			size_t j = home(old_slots[i].first);
+			while (slots[j].second) {
+				j = (j + 1) & (slot_count - 1);
+			}
+			slots[j] = old_slots[i];
+			ages[j].store(old_ages[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+	}
+	delete[] old_slots;
+	delete[] old_ages;
+}
+
+cache_container::iterator cache_container::find(uint64_t key) {
+	if (element_count == 0) {
+		return end();
+	}
+	size_t i = home(key);
+	while (slots[i].second) {
+		if (slots[i].first == key) {
+			return iterator(slots + i, slots + slot_count);
+		}
+		i = (i + 1) & (slot_count - 1);
+	}
+	return end();
+}
+
+std::pair<cache_container::iterator, bool> cache_container::insert(const value_type& value) {
+	if ((element_count + 1) * CONTAINER_LOAD_DEN > slot_count * CONTAINER_LOAD_NUM) {
+		resize(slots_for(element_count + 1));
+	}
+	size_t i = home(value.first);
+	while (slots[i].second) {
+		if (slots[i].first == value.first) {
+			return std::make_pair(iterator(slots + i, slots + slot_count), false);
+		}
+		i = (i + 1) & (slot_count - 1);
+	}
+	slots[i] = value;
+	ages[i].store(0, std::memory_order_relaxed);
+	element_count++;
+	return std::make_pair(iterator(slots + i, slots + slot_count), true);
+}
+
+void cache_container::erase(iterator it) {
+	size_t mask = slot_count - 1;
+	size_t hole = &(*it) - slots;
+	/* Backward shift deletion: pull later entries of the same probe run into the
+	 * hole, unless that would move them before their home slot.
+	 */
+	for (size_t j = (hole + 1) & mask; slots[j].second; j = (j + 1) & mask) {
+		size_t h = home(slots[j].first);
+		if (((j - h) & mask) >= ((j - hole) & mask)) {
+			slots[hole] = slots[j];
+			ages[hole].store(ages[j].load(std::memory_order_relaxed), std::memory_order_relaxed);
+			hole = j;
+		}
+	}
+	slots[hole] = value_type(0, nullptr);
+	element_count--;
+}
+
+size_t cache_container::erase(uint64_t key) {
+	auto it = find(key);
+	if (it == end()) {
+		return 0;
+	}
+	erase(it);
+	return 1;
+}
+
+void cache_container::clear() {
+	delete[] slots;
+	delete[] ages;
+	slots = nullptr;
+	ages = nullptr;
+	slot_count = element_count = 0;
+	slot_shift = 64;
+}
+
+void cache_container::reserve(size_t elements) {
+	size_t n = slots_for(elements);
+	if (n > slot_count) {
+		resize(n);
+	}
+}
+
+void cache_container::shrink_to_fit() {
+	size_t n = slots_for(element_count);
+	if (n < slot_count) {
+		resize(n);
+	}
+}
+
+size_t cache_container::size() const {
+	return element_count;
+}
+
+bool cache_container::empty() const {
+	return element_count == 0;
+}
+
+size_t cache_container::capacity() const {
+	return slot_count;
+}
+
+size_t cache_container::bytes() const {
+	return slot_count * (sizeof(value_type) + sizeof(std::atomic<uint16_t>));
+}
+
+uint16_t cache_container::get_age(iterator it) const {
+	return ages[&(*it) - slots].load(std::memory_order_relaxed);
+}
+
+void cache_container::touch(iterator it) {
+	std::atomic<uint16_t>& age = ages[&(*it) - slots];
+	/* Lookups are far more common than sweeps, so only write when the age
+	 * actually changes, to keep hot entries' cache lines shared between cores.
+	 */
+	if (age.load(std::memory_order_relaxed) != 0) {
+		age.store(0, std::memory_order_relaxed);
+	}
+}
+
+void cache_container::age_all() {
+	for (size_t i = 0; i < slot_count; ++i) {
+		if (slots[i].second) {
+			uint16_t a = ages[i].load(std::memory_order_relaxed);
+			if (a != UINT16_MAX) {
+				/* If touch() got in first, leave the entry at zero */
+				ages[i].compare_exchange_strong(a, a + 1, std::memory_order_relaxed);
+			}
+		}
+	}
+}
+
+cache_container::iterator cache_container::begin() {
+	return iterator(slots, slots + slot_count);
+}
+
+cache_container::iterator cache_container::end() {
+	return iterator(slots + slot_count, slots + slot_count);
+}
+
+cache::cache(size_t _stripe_count) : stripe_count(1), rehash_pause(0), evicted(0) {
+	/* Round up to a power of two so we can select a stripe with a mask */
+	while (stripe_count < _stripe_count) {
+		stripe_count <<= 1;
+	}
+	stripes = new cache_stripe[stripe_count];
 }
 
 cache::~cache() {
-	delete cache_map;
+	delete[] stripes;
+}
+
+cache::cache_stripe& cache::get_stripe(snowflake id) {
+	/* The low bits of a snowflake are a per-process increment, which clusters badly
+	 * when ids are created in bursts. Mix the whole id before choosing a stripe.
+	 */
+	uint64_t h = id * 0x9E3779B97F4A7C15ull;
+	return stripes[(h >> 32) & (stripe_count - 1)];
+}
+
+size_t cache::get_stripe_count() const {
+	return stripe_count;
 }
 
 uint64_t cache::count() {
-	std::lock_guard<std::mutex> lock(this->cache_mutex);
-	return cache_map->size();
+	uint64_t total = 0;
+	for (size_t s = 0; s < stripe_count; ++s) {
+		std::shared_lock<std::shared_mutex> lock(stripes[s].stripe_mutex);
+		total += stripes[s].cache_map.size();
+	}
+	return total;
+}
+
+std::shared_mutex& cache::get_mutex(size_t stripe) {
+	return stripes[stripe].stripe_mutex;
+}
+
+cache_container& cache::get_container(size_t stripe) {
+	return stripes[stripe].cache_map;
 }
 
 std::mutex& cache::get_mutex() {
-	return this->cache_mutex;
+	return legacy_mutex;
 }
 
-cache_container& cache::get_container() {
-	return *(this->cache_map);
+std::unordered_map<snowflake, managed*>& cache::get_container() {
+	/* There is no one map to lend out any more, so build a copy of all the stripes */
+	legacy_map.clear();
+	for (size_t s = 0; s < stripe_count; ++s) {
+		std::shared_lock<std::shared_mutex> lock(stripes[s].stripe_mutex);
+		for (auto& entry : stripes[s].cache_map) {
+			legacy_map.emplace(entry.first, entry.second);
+		}
+	}
+	return legacy_map;
 }
 
 void cache::store(managed* object) {
 	if (!object) {
 		return;
 	}
-	std::lock_guard<std::mutex> lock(this->cache_mutex);
-	auto existing = cache_map->find(object->id);
-	if (existing == cache_map->end()) {
-		(*cache_map)[object->id] = object;
-	} else if (object != existing->second) {
-		/* Flag old pointer for deletion and replace */
-		std::lock_guard<std::mutex> delete_lock(deletion_mutex);
-		deletion_queue[existing->second] = time(NULL);
-		(*cache_map)[object->id] = object;
+	managed* replaced = nullptr;
+	{
+		cache_stripe& st = get_stripe(object->id);
+		std::unique_lock<std::shared_mutex> lock(st.stripe_mutex);
+		auto existing = st.cache_map.find(object->id);
+		if (existing == st.cache_map.end()) {
+			st.cache_map.insert(std::make_pair(object->id, object));
+		} else {
+			if (object != existing->second) {
+				replaced = existing->second;
+				existing->second = object;
+			}
+			st.cache_map.touch(existing);
+		}
+	}
+	/* Retire old pointer once it is unreachable */
+	if (replaced) {
+		retire(replaced);
 	}
 }
 
+managed* cache::store_or_find(managed* object, std::function<void(managed*)> found) {
+	cache_stripe& st = get_stripe(object->id);
+	std::unique_lock<std::shared_mutex> lock(st.stripe_mutex);
+	auto existing = st.cache_map.find(object->id);
+	if (existing != st.cache_map.end()) {
+		st.cache_map.touch(existing);
+		found(existing->second);
+		return existing->second;
+	}
+	st.cache_map.insert(std::make_pair(object->id, object));
+	return object;
+}
+
 size_t cache::bytes() {
-	std::lock_guard<std::mutex> lock(cache_mutex);
-	return sizeof(this) + (cache_map->bucket_count() * sizeof(size_t));
+	size_t total = sizeof(*this) + (stripe_count * sizeof(cache_stripe));
+	for (size_t s = 0; s < stripe_count; ++s) {
+		std::shared_lock<std::shared_mutex> lock(stripes[s].stripe_mutex);
+		total += stripes[s].cache_map.bytes();
+	}
+	return total;
 }
 
 void cache::rehash() {
-	std::lock_guard<std::mutex> lock(cache_mutex);
-	cache_container* n = new cache_container();
-	n->reserve(cache_map->size());
-	for (auto t = cache_map->begin(); t != cache_map->end(); ++t) {
-		n->insert(*t);
+	double longest = 0;
+	for (size_t s = 0; s < stripe_count; ++s) {
+		/* Check without blocking lookups whether this stripe is worth shrinking. We
+		 * only do this once the slot array is four times larger than needed, so that
+		 * a stripe that shrinks and grows again doesn't get rehashed every minute.
+		 */
+		{
+			std::shared_lock<std::shared_mutex> lock(stripes[s].stripe_mutex);
+			const cache_container& c = stripes[s].cache_map;
+			if (c.capacity() <= CONTAINER_MIN_SLOTS || c.capacity() / 4 < (c.size() * CONTAINER_LOAD_DEN) / CONTAINER_LOAD_NUM) {
+				continue;
+			}
+		}
+		/* Shrinking moves the flat slot array into a smaller one, with no per-entry allocation */
+		std::unique_lock<std::shared_mutex> lock(stripes[s].stripe_mutex);
+		double start = dpp::utility::time_f();
+		stripes[s].cache_map.shrink_to_fit();
+		longest = std::max(longest, dpp::utility::time_f() - start);
 	}
-	delete cache_map;
-	cache_map = n;
+	rehash_pause = longest;
+}
+
+double cache::get_rehash_pause() const {
+	return rehash_pause;
 }
 
 void cache::remove(managed* object) {
 	if (!object) {
 		return;
 	}
-	std::lock_guard<std::mutex> lock(cache_mutex);
-	std::lock_guard<std::mutex> delete_lock(deletion_mutex);
-	auto existing = cache_map->find(object->id);
-	if (existing != cache_map->end()) {
-		cache_map->erase(existing);
-		deletion_queue[object] = time(NULL);
+	managed* removed = nullptr;
+	{
+		cache_stripe& st = get_stripe(object->id);
+		std::unique_lock<std::shared_mutex> lock(st.stripe_mutex);
+		auto existing = st.cache_map.find(object->id);
+		if (existing != st.cache_map.end()) {
+			removed = existing->second;
+			st.cache_map.erase(existing);
+		}
+	}
+	if (removed) {
+		retire(removed);
 	}
 }
 
 managed* cache::find(snowflake id) {
-	std::lock_guard<std::mutex> lock(cache_mutex);
-	auto r = cache_map->find(id);
-	if (r != cache_map->end()) {
+	cache_stripe& st = get_stripe(id);
+	std::shared_lock<std::shared_mutex> lock(st.stripe_mutex);
+	auto r = st.cache_map.find(id);
+	if (r != st.cache_map.end()) {
+		st.cache_map.touch(r);
+		return r->second;
+	}
+	return nullptr;
+}
+
+managed* cache::find(snowflake id, std::function<void(managed*)> found) {
+	cache_stripe& st = get_stripe(id);
+	std::shared_lock<std::shared_mutex> lock(st.stripe_mutex);
+	auto r = st.cache_map.find(id);
+	if (r != st.cache_map.end()) {
+		st.cache_map.touch(r);
+		found(r->second);
+		return r->second;
+	}
+	return nullptr;
+}
+
+bool cache::remove_if(snowflake id, std::function<bool(managed*)> can_remove) {
+	managed* removed = nullptr;
+	{
+		cache_stripe& st = get_stripe(id);
+		std::unique_lock<std::shared_mutex> lock(st.stripe_mutex);
+		auto existing = st.cache_map.find(id);
+		if (existing != st.cache_map.end() && can_remove(existing->second)) {
+			removed = existing->second;
+			st.cache_map.erase(existing);
+		}
+	}
+	if (removed) {
+		retire(removed);
+	}
+	return removed != nullptr;
+}
+
+managed* cache::peek(snowflake id, uint16_t& age) {
+	cache_stripe& st = get_stripe(id);
+	std::shared_lock<std::shared_mutex> lock(st.stripe_mutex);
+	auto r = st.cache_map.find(id);
+	if (r != st.cache_map.end()) {
+		age = st.cache_map.get_age(r);
 		return r->second;
 	}
+	age = 0;
 	return nullptr;
 }
 
-cache_helper(user, user_cache, find_user, get_user_cache, get_user_count);
-cache_helper(channel, channel_cache, find_channel, get_channel_cache, get_channel_count);
-cache_helper(role, role_cache, find_role, get_role_cache, get_role_count);
-cache_helper(guild, guild_cache, find_guild, get_guild_cache, get_guild_count);
-cache_helper(emoji, emoji_cache, find_emoji, get_emoji_cache, get_emoji_count);
+void cache::age() {
+	for (size_t s = 0; s < stripe_count; ++s) {
+		/* Ages are atomic, so this doesn't need to block lookups */
+		std::shared_lock<std::shared_mutex> lock(stripes[s].stripe_mutex);
+		stripes[s].cache_map.age_all();
+	}
+}
+
+size_t cache::evict(uint16_t min_age, std::function<bool(managed*)> can_evict) {
+	size_t total = 0;
+	std::vector<managed*> removed;
+	for (size_t s = 0; s < stripe_count; ++s) {
+		{
+			std::unique_lock<std::shared_mutex> lock(stripes[s].stripe_mutex);
+			cache_container& c = stripes[s].cache_map;
+			for (auto i = c.begin(); i != c.end(); ++i) {
+				if (c.get_age(i) >= min_age && can_evict(i->second)) {
+					removed.push_back(i->second);
+				}
+			}
+			/* Erasing shifts entries about, so it can't be done while iterating */
+			for (managed* m : removed) {
+				c.erase(m->id);
+			}
+		}
+		for (managed* m : removed) {
+			retire(m);
+		}
+		total += removed.size();
+		removed.clear();
+	}
+	evicted += total;
+	return total;
+}
+
+uint64_t cache::get_evicted_count() const {
+	return evicted;
+}
+
+cache_helper(user, user_cache, find_user, get_user_cache, get_user_count, DPP_USER_CACHE_STRIPES);
+cache_helper(channel, channel_cache, find_channel, get_channel_cache, get_channel_count, DPP_CHANNEL_CACHE_STRIPES);
+cache_helper(role, role_cache, find_role, get_role_cache, get_role_count, DPP_ROLE_CACHE_STRIPES);
+cache_helper(guild, guild_cache, find_guild, get_guild_cache, get_guild_count, DPP_GUILD_CACHE_STRIPES);
+cache_helper(emoji, emoji_cache, find_emoji, get_emoji_cache, get_emoji_count, DPP_EMOJI_CACHE_STRIPES);
 
 };
@@ -45,6 +45,8 @@ void to_json(nlohmann::json& j, const thread_metadata& tmdata) {
 	j["invitable"] = tmdata.invitable;
 }
 
+slab_helper(channel);
+
 channel::channel() :
 	managed(),
 	flags(0),
@@ -41,12 +41,12 @@ namespace dpp {
  */
 thread_local std::string audit_reason;
 
-cluster::cluster(const std::string &_token, uint32_t _intents, uint32_t _shards, uint32_t _cluster_id, uint32_t _maxclusters, bool comp, cache_policy_t policy)
-	: rest(nullptr), raw_rest(nullptr), compressed(comp), start_time(0), token(_token), last_identify(time(NULL) - 5), intents(_intents),
-	numshards(_shards), cluster_id(_cluster_id), maxclusters(_maxclusters), rest_ping(0.0), cache_policy(policy), ws_mode(ws_json)
+cluster::cluster(const std::string &_token, uint32_t _intents, uint32_t _shards, uint32_t _cluster_id, uint32_t _maxclusters, bool comp, cache_policy_t policy, uint32_t request_threads, uint32_t completion_threads, bool ordered_completions)
+	: rest(nullptr), raw_rest(nullptr), compressed(comp), transport_compression(tc_zlib_stream), start_time(0), shard_reactor(nullptr), token(_token), last_identify(time(NULL) - 5), intents(_intents),
+	numshards(_shards), cluster_id(_cluster_id), maxclusters(_maxclusters), rest_ping(0.0), cache_policy(policy), ws_mode(ws_json), ws_max_message_size(0)
 {
-	rest = new request_queue(this);
-	raw_rest = new request_queue(this);
+	rest = new request_queue(this, request_threads, completion_threads, ordered_completions);
+	raw_rest = new request_queue(this, request_threads, completion_threads, ordered_completions);
 #ifdef _WIN32
 	// Set up winsock.
 	WSADATA wsadata;
@@ -58,8 +58,24 @@ cluster::cluster(const std::string &_token, uint32_t _intents, uint32_t _shards,
 
 cluster::~cluster()
 {
+	/* Shards are stopped before the reactor they run on, and before the REST queues their handlers use */
+	for (auto& s : shards) {
+		delete s.second;
+	}
+	shards.clear();
 	delete rest;
 	delete raw_rest;
+	/* Nothing can change the caches any more, so the snapshot is consistent */
+	if (!cache_snapshot.empty()) {
+		try {
+			size_t saved = cache_snapshot_save(cache_snapshot);
+			log(ll_info, fmt::format("Saved {} cached objects to {}", saved, cache_snapshot));
+		}
+		catch (const std::exception &e) {
+			log(ll_error, fmt::format("Could not save cache snapshot: {}", e.what()));
+		}
+	}
+	delete shard_reactor;
 #ifdef _WIN32
 	WSACleanup();
 #endif
@@ -70,6 +86,74 @@ cluster& cluster::set_websocket_protocol(websocket_protocol_t mode) {
 	return *this;
 }
 
+cluster& cluster::set_websocket_max_message_size(size_t bytes) {
+	ws_max_message_size = bytes;
+	return *this;
+}
+
+cluster& cluster::set_transport_compression(transport_compression_t compression) {
+#ifndef HAVE_ZSTD
+	if (compression == tc_zstd_stream) {
+		throw dpp::exception("zstd-stream compression is not available, D++ was built without libzstd");
+	}
+#endif
+	transport_compression = compression;
+	return *this;
+}
+
+cluster& cluster::set_cache_snapshot(const std::string &filename) {
+	cache_snapshot = filename;
+	return *this;
+}
+
+cluster& cluster::set_rest_pool(size_t max_idle_per_host, time_t idle_seconds) {
+	rest->set_pool(max_idle_per_host, idle_seconds);
+	raw_rest->set_pool(max_idle_per_host, idle_seconds);
+	return *this;
+}
+
+http_pool_stats cluster::get_rest_pool_stats() {
+	return rest->get_pool_stats();
+}
+
+ratelimit_stats cluster::get_rest_ratelimit_stats() {
+	return rest->get_ratelimit_stats();
+}
+
+queue_memory_stats cluster::get_rest_memory_stats() {
+	return rest->get_memory_stats();
+}
+
+latency_histogram cluster::get_rest_latency_stats(http_priority lane) {
+	return rest->get_latency_stats(lane);
+}
+
+cluster& cluster::set_rest_response_cache(double ttl_seconds) {
+	rest->set_response_cache(ttl_seconds);
+	return *this;
+}
+
+coalesce_stats cluster::get_rest_coalesce_stats() {
+	return rest->get_coalesce_stats();
+}
+
+cluster& cluster::set_shard_threads(size_t threads) {
+	if (start_time) {
+		throw dpp::exception("set_shard_threads must be called before cluster::start");
+	}
+	if (threads && !reactor::supported()) {
+		log(ll_warning, "Shard threads are not supported on this platform, each shard will have its own thread");
+		return *this;
+	}
+	delete shard_reactor;
+	shard_reactor = threads ? new reactor(threads) : nullptr;
+	return *this;
+}
+
+reactor* cluster::get_reactor() {
+	return shard_reactor;
+}
+
 
 
 
@@ -120,14 +204,28 @@ void cluster::start(bool return_after) {
 	} else {
 		start_time = time(NULL);
 
+		if (!cache_snapshot.empty()) {
+			try {
+				double start = utility::time_f();
+				size_t loaded = cache_snapshot_load(cache_snapshot);
+				log(ll_info, fmt::format("Loaded {} cached objects from {} in {:.3f}s", loaded, cache_snapshot, utility::time_f() - start));
+			}
+			catch (const std::exception &e) {
+				log(ll_warning, fmt::format("Could not load cache snapshot, starting without it: {}", e.what()));
+			}
+		}
+
 		log(ll_debug, fmt::format("Starting with {} shards...", numshards));
 
 		for (uint32_t s = 0; s < numshards; ++s) {
 			/* Filter out shards that arent part of the current cluster, if the bot is clustered */
 			if (s % maxclusters == cluster_id) {
-				/* Each discord_client spawns its own thread in its Run() */
+				/* Each discord_client spawns its own thread in its Run(), unless there is a shard reactor */
 				try {
-					this->shards[s] = new discord_client(this, s, numshards, token, intents, compressed, ws_mode);
+					this->shards[s] = new discord_client(this, s, numshards, token, intents, compressed, ws_mode, transport_compression);
+					if (ws_max_message_size) {
+						this->shards[s]->set_max_message_size(ws_max_message_size);
+					}
 					this->shards[s]->Run();
 				}
 				catch (const std::exception &e) {
@@ -173,9 +271,13 @@ void cluster::set_dm_channel(snowflake user_id, snowflake channel_id) {
 	dm_channels[user_id] = channel_id;
 }
 
-void cluster::post_rest(const std::string &endpoint, const std::string &major_parameters, const std::string &parameters, http_method method, const std::string &postdata, json_encode_t callback, const std::string &filename, const std::string &filecontent) {
+void cluster::post_rest(const std::string &endpoint, const std::string &major_parameters, const std::string &parameters, http_method method, const std::string &postdata, json_encode_t callback, const std::string &filename, const std::string &filecontent, http_priority priority) {
+	post_rest(endpoint, major_parameters, parameters, method, postdata, callback, filename, filecontent, {}, priority);
+}
+
+void cluster::post_rest(const std::string &endpoint, const std::string &major_parameters, const std::string &parameters, http_method method, const std::string &postdata, json_encode_t callback, const std::string &filename, const std::string &filecontent, std::vector<http_upload> uploads, http_priority priority) {
 	/* NOTE: This is not a memory leak! The request_queue will free the http_request once it reaches the end of its lifecycle */
-	rest->post_request(new http_request(endpoint + "/" + major_parameters, parameters, [endpoint, callback, this](const http_request_completion_t& rv) {
+	http_request* req = new http_request(endpoint + "/" + major_parameters, parameters, [endpoint, callback, this](const http_request_completion_t& rv) {
 		json j;
 		if (rv.error == h_success && !rv.body.empty()) {
 			try {
@@ -190,7 +292,10 @@ void cluster::post_rest(const std::string &endpoint, const std::string &major_pa
 		if (callback) {
 			callback(j, rv);
 		}
-	}, postdata, method, get_audit_reason(), filename, filecontent));
+	}, postdata, method, get_audit_reason(), filename, filecontent);
+	req->uploads = std::move(uploads);
+	req->priority = priority;
+	rest->post_request(req);
 }
 
 void cluster::request(const std::string &url, http_method method, http_completion_event callback, const std::string &postdata, const std::string &mimetype, const std::multimap<std::string, std::string> &headers) {
@@ -171,7 +171,7 @@ void cluster::interaction_response_create(snowflake interaction_id, const std::s
 		if (callback) {
 			callback(confirmation_callback_t("confirmation", confirmation(), http));
 		}
-	}, r.msg->filename, r.msg->filecontent);
+	}, r.msg->filename, r.msg->filecontent, r.msg->get_uploads(), hp_interaction);
 }
 
 void cluster::interaction_response_edit(const std::string &token, const message &m, command_completion_event_t callback) {
@@ -179,7 +179,7 @@ void cluster::interaction_response_edit(const std::string &token, const message
 		if (callback) {
 			callback(confirmation_callback_t("confirmation", confirmation(), http));
 		}
-	}, m.filename, m.filecontent);
+	}, m.filename, m.filecontent, m.get_uploads(), hp_interaction);
 }
 
 };
\ No newline at end of file
@@ -31,31 +31,193 @@
 #include <dpp/nlohmann/json.hpp>
 #include <dpp/fmt/format.h>
 #include <dpp/etf.h>
+#include <chrono>
+#include <algorithm>
+#ifdef HAVE_ZLIB_NG
+#include <zlib-ng.h>
+#else
 #include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #define PATH_UNCOMPRESSED_JSON	"/?v=" DISCORD_API_VERSION "&encoding=json"
 #define PATH_COMPRESSED_JSON	"/?v=" DISCORD_API_VERSION "&encoding=json&compress=zlib-stream"
+#define PATH_ZSTD_JSON		"/?v=" DISCORD_API_VERSION "&encoding=json&compress=zstd-stream"
 #define PATH_UNCOMPRESSED_ETF	"/?v=" DISCORD_API_VERSION "&encoding=etf"
 #define PATH_COMPRESSED_ETF	"/?v=" DISCORD_API_VERSION "&encoding=etf&compress=zlib-stream"
-#define DECOMP_BUFFER_SIZE	512 * 1024
+#define PATH_ZSTD_ETF		"/?v=" DISCORD_API_VERSION "&encoding=etf&compress=zstd-stream"
+/* Smallest amount the decompression buffer is grown by at a time */
+#define DECOMP_MIN_GROWTH	16 * 1024
+/* Decompression buffers bigger than this are freed after each message, rather than kept */
+#define DECOMP_MAX_KEPT		4 * 1024 * 1024
+
+/* Seconds a shard must be ready, with its outbound queue empty, before it prunes
+ * anything from a cache snapshot that its GUILD_CREATEs and member chunks didn't confirm
+ */
+#define SNAPSHOT_PRUNE_DELAY	60
 
 namespace dpp {
 
 /* This is an internal class, defined externally as just a forward declaration for an opaque pointer.
- * This is because we don't want an external dependency on zlib's headers
+ * This is because we don't want an external dependency on zlib's headers.
+ * When zlib-ng is available, its native API is used, which differs from zlib's only in naming.
  */
 class zlibcontext {
 public:
+#ifdef HAVE_ZLIB_NG
+	zng_stream d_stream;
+
+	int init() {
+		return zng_inflateInit(&d_stream);
+	}
+
+	void end() {
+		zng_inflateEnd(&d_stream);
+	}
+
+	int inflate(int flush) {
+		return zng_inflate(&d_stream, flush);
+	}
+#else
 	z_stream d_stream;
+
+	int init() {
+		return inflateInit(&d_stream);
+	}
+
+	void end() {
+		inflateEnd(&d_stream);
+	}
+
+	int inflate(int flush) {
+		return ::inflate(&d_stream, flush);
+	}
+#endif
+	void set_input(const char* data, size_t length) {
+		d_stream.next_in = (decltype(d_stream.next_in))data;
+		d_stream.avail_in = (decltype(d_stream.avail_in))length;
+	}
+
+	void set_output(char* data, size_t length) {
+		d_stream.next_out = (decltype(d_stream.next_out))data;
+		d_stream.avail_out = (decltype(d_stream.avail_out))length;
+	}
+};
+
+/* Another internal class, defined externally as just a forward declaration for an opaque pointer */
+class zstdcontext {
+public:
+#ifdef HAVE_ZSTD
+	ZSTD_DStream* d_stream;
+
+	zstdcontext() : d_stream(ZSTD_createDStream()) {
+	}
+
+	~zstdcontext() {
+		ZSTD_freeDStream(d_stream);
+	}
+#endif
 };
 
-discord_client::discord_client(dpp::cluster* _cluster, uint32_t _shard_id, uint32_t _max_shards, const std::string &_token, uint32_t _intents, bool comp, websocket_protocol_t ws_proto)
-       : websocket_client(DEFAULT_GATEWAY, "443", comp ? (ws_proto == ws_json ? PATH_COMPRESSED_JSON : PATH_COMPRESSED_ETF) : (ws_proto == ws_json ? PATH_UNCOMPRESSED_JSON : PATH_UNCOMPRESSED_ETF)),
+zstd_stream::zstd_stream() : context(nullptr)
+{
+}
+
+zstd_stream::~zstd_stream()
+{
+	delete context;
+}
+
+bool zstd_stream::available()
+{
+#ifdef HAVE_ZSTD
+	return true;
+#else
+	return false;
+#endif
+}
+
+void zstd_stream::reset()
+{
+#ifdef HAVE_ZSTD
+	/* Only the session is reset, so the decompression window is allocated once */
+	if (!context) {
+		context = new zstdcontext();
+	}
+	if (!context->d_stream || ZSTD_isError(ZSTD_DCtx_reset(context->d_stream, ZSTD_reset_session_only))) {
+		throw dpp::exception("Can't initialise stream compression!");
+	}
+#else
+	throw dpp::exception("zstd-stream compression is not available, D++ was built without libzstd");
+#endif
+}
+
+/* Without libzstd there is nothing to decompress with, and reset() has already thrown */
+zstd_status zstd_stream::decompress([[maybe_unused]] std::string_view input, [[maybe_unused]] std::string& output, [[maybe_unused]] size_t max_size, std::string& error)
+{
+#ifdef HAVE_ZSTD
+	if (!context) {
+		error = "zstd-stream: reset() was not called";
+		return zs_corrupt;
+	}
+	ZSTD_inBuffer in = { input.data(), input.size(), 0 };
+	ZSTD_outBuffer out;
+	do {
+		size_t used = output.size();
+		size_t room = std::max({(in.size - in.pos) * 4, (size_t)DECOMP_MIN_GROWTH, used});
+		output.resize(used + room);
+		out = { output.data() + used, room, 0 };
+		size_t ret = ZSTD_decompressStream(context->d_stream, &out, &in);
+		output.resize(used + out.pos);
+		if (ZSTD_isError(ret)) {
+			error = fmt::format("zstd-stream: {}", ZSTD_getErrorName(ret));
+			return zs_corrupt;
+		}
+		if (output.size() > max_size) {
+			error = fmt::format("zstd-stream: message is over the limit of {} bytes", max_size);
+			return zs_too_big;
+		}
+	} while (in.pos < in.size || out.pos == out.size);
+	return zs_ok;
+#else
+	error = "zstd-stream compression is not available, D++ was built without libzstd";
+	return zs_corrupt;
+#endif
+}
+
+/* Gateway path for the compression and protocol. This is called before the base class connects,
+ * so it is also where unsupported compression is rejected.
+ */
+static const char* gateway_path(bool compressed, transport_compression_t compression, websocket_protocol_t protocol)
+{
+	if (!compressed) {
+		return protocol == ws_json ? PATH_UNCOMPRESSED_JSON : PATH_UNCOMPRESSED_ETF;
+	} else if (compression == tc_zstd_stream) {
+		if (!zstd_stream::available()) {
+			throw dpp::exception("zstd-stream compression is not available, D++ was built without libzstd");
+		}
+		return protocol == ws_json ? PATH_ZSTD_JSON : PATH_ZSTD_ETF;
+	}
+	return protocol == ws_json ? PATH_COMPRESSED_JSON : PATH_COMPRESSED_ETF;
+}
+
+discord_client::discord_client(dpp::cluster* _cluster, uint32_t _shard_id, uint32_t _max_shards, const std::string &_token, uint32_t _intents, bool comp, websocket_protocol_t ws_proto, transport_compression_t _compression)
+       : websocket_client(DEFAULT_GATEWAY, "443", gateway_path(comp, _compression, ws_proto)),
         runner(nullptr),
+	reconnector(nullptr),
+	terminating(false),
 	compressed(comp),
-	decomp_buffer(nullptr),
+	compression(_compression),
+	zstd(nullptr),
 	decompressed_total(0),
+	decompress_time(0),
 	connect_time(0),
+	snapshot_settled(0),
+	snapshot_pruned(false),
+	last_cache_sweep(time(nullptr)),
+	last_member_eviction(time(nullptr) - DPP_USER_SWEEP_INTERVAL / 2),
 	ping_start(0.0),
 	creator(_cluster),
 	heartbeat_interval(0),
@@ -80,12 +242,28 @@ discord_client::discord_client(dpp::cluster* _cluster, uint32_t _shard_id, uint3
 
 discord_client::~discord_client()
 {
+	std::thread* reconnecting = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(reconnect_mutex);
+		terminating = true;
+		std::swap(reconnecting, reconnector);
+	}
+	if (reconnecting) {
+		reconnecting->join();
+		delete reconnecting;
+	}
 	if (runner) {
+		/* Ends the read loop, and ThreadRun sees that the shard is terminating rather than reconnecting */
+		shutdown(sfd, 2);
 		runner->join();
 		delete runner;
 	}
+	/* Takes the shard out of the reactor, waiting for a disconnect callback that is running */
+	ssl_client::close();
+	EndZLib();
 	delete etf;
 	delete zlib;
+	delete zstd;
 }
 
 uint64_t discord_client::get_decompressed_bytes_in()
@@ -93,28 +271,39 @@ uint64_t discord_client::get_decompressed_bytes_in()
 	return decompressed_total;
 }
 
+double discord_client::get_decompression_rate()
+{
+	if (decompress_time == 0) {
+		return 0;
+	}
+	return (decompressed_total / 1048576.0) / (decompress_time / 1000000.0);
+}
+
 void discord_client::SetupZLib()
 {
-	if (compressed) {
-		zlib->d_stream.zalloc = (alloc_func)0;
-		zlib->d_stream.zfree = (free_func)0;
-		zlib->d_stream.opaque = (voidpf)0;
-		if (inflateInit(&(zlib->d_stream)) != Z_OK) {
+	if (compressed && compression == tc_zstd_stream) {
+		/* The stream is kept between connections, and just reset for the new one */
+		if (!zstd) {
+			zstd = new zstd_stream();
+		}
+		zstd->reset();
+		decompressed.clear();
+	} else if (compressed) {
+		zlib->d_stream.zalloc = nullptr;
+		zlib->d_stream.zfree = nullptr;
+		zlib->d_stream.opaque = nullptr;
+		if (zlib->init() != Z_OK) {
 			throw dpp::exception("Can't initialise stream compression!");
 		}
-		this->decomp_buffer = new unsigned char[DECOMP_BUFFER_SIZE];
+		/* Anything left over is part of a message from the last connection's stream */
+		decompressed.clear();
 	}
-
 }
 
 void discord_client::EndZLib()
 {
-	if (compressed) {
-		inflateEnd(&(zlib->d_stream));
-		if (this->decomp_buffer) {
-			delete[] this->decomp_buffer;
-			this->decomp_buffer = nullptr;
-		}
+	if (compressed && compression == tc_zlib_stream) {
+		zlib->end();
 	}
 }
 
@@ -122,88 +311,186 @@ void discord_client::ThreadRun()
 {
 	SetupZLib();
 	do {
-		bool error = false;
 		ready = false;
 		message_queue.clear();
 		ssl_client::read_loop();
-		ssl_client::close();
-		EndZLib();
-		SetupZLib();
-		do {
-			error = false;
-			try {
-				ssl_client::Connect();
-				websocket_client::Connect();
-			}
-			catch (const std::exception &e) {
-				log(dpp::ll_error, std::string("Error establishing connection, retry in 5 seconds: ") + e.what());
-				ssl_client::close();
-				std::this_thread::sleep_for(std::chrono::seconds(5));
-				error = true;
+		if (!terminating) {
+			Reconnect();
+		}
+	} while (!terminating);
+}
+
+void discord_client::Reconnect()
+{
+	bool error = false;
+	ssl_client::close();
+	EndZLib();
+	SetupZLib();
+	do {
+		error = false;
+		try {
+			ssl_client::Connect();
+			websocket_client::Connect();
+		}
+		catch (const std::exception &e) {
+			log(dpp::ll_error, std::string("Error establishing connection, retry in 5 seconds: ") + e.what());
+			ssl_client::close();
+			for (int i = 0; i < 50 && !terminating; ++i) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
 			}
-		} while (error);
-	} while(true);
+			error = true;
+		}
+	} while (error && !terminating);
+}
+
+void discord_client::ReactorDisconnected()
+{
+	std::lock_guard<std::mutex> lock(reconnect_mutex);
+	if (terminating) {
+		return;
+	}
+	if (reconnector) {
+		/* The last reconnection has finished, as it ends by adding the shard back to the reactor */
+		reconnector->join();
+		delete reconnector;
+	}
+	reconnector = new std::thread([this]() {
+		Reconnect();
+		reactor* shard_reactor = creator->get_reactor();
+		if (terminating) {
+			return;
+		} else if (!shard_reactor) {
+			log(dpp::ll_error, "Shard reactor has gone, can't resume handling the shard");
+			return;
+		}
+		ready = false;
+		message_queue.clear();
+		shard_reactor->add(this, std::bind(&discord_client::ReactorDisconnected, this));
+	});
 }
 
 void discord_client::Run()
 {
-	this->runner = new std::thread(&discord_client::ThreadRun, this);
-	this->thread_id = runner->native_handle();
+	reactor* shard_reactor = creator->get_reactor();
+	if (shard_reactor) {
+		SetupZLib();
+		ready = false;
+		message_queue.clear();
+		shard_reactor->add(this, std::bind(&discord_client::ReactorDisconnected, this));
+	} else {
+		this->runner = new std::thread(&discord_client::ThreadRun, this);
+		this->thread_id = runner->native_handle();
+	}
+}
+
+void discord_client::StreamBroken()
+{
+	decompressed.clear();
+	/* The I/O loop sees the connection end and reconnects, closing the socket and starting a new stream.
+	 * Closing it here would take the shard out of the reactor without reconnecting it.
+	 */
+	shutdown(sfd, 2);
+}
+
+int discord_client::InflateFrame(std::string_view buffer)
+{
+	/* The zlib stream is continuous, so each frame can be inflated as it arrives, straight
+	 * onto the end of the message so far. A message is complete when its last frame ends
+	 * with the zlib sync flush suffix; usually every frame is a whole message.
+	 */
+	zlib->set_input(buffer.data(), buffer.size());
+	do {
+		size_t used = decompressed.size();
+		size_t room = std::max({(size_t)zlib->d_stream.avail_in * 4, (size_t)DECOMP_MIN_GROWTH, used});
+		decompressed.resize(used + room);
+		zlib->set_output(decompressed.data() + used, room);
+		int ret = zlib->inflate(Z_SYNC_FLUSH);
+		size_t have = room - zlib->d_stream.avail_out;
+		decompressed.resize(used + have);
+		this->decompressed_total += have;
+		switch (ret)
+		{
+			case Z_NEED_DICT:
+			case Z_STREAM_ERROR:
+				this->Error(6000);
+				this->StreamBroken();
+				return -1;
+			break;
+			case Z_DATA_ERROR:
+				this->Error(6001);
+				this->StreamBroken();
+				return -1;
+			break;
+			case Z_MEM_ERROR:
+				this->Error(6002);
+				this->StreamBroken();
+				return -1;
+			break;
+			default:
+				/* Z_OK, or Z_BUF_ERROR if all the input was consumed */
+			break;
+		}
+		if (decompressed.size() > get_max_message_size()) {
+			this->Error(6003);
+			this->StreamBroken();
+			return -1;
+		}
+	} while (zlib->d_stream.avail_out == 0);
+	if (buffer.size() < 4 || (uint8_t)buffer[buffer.size() - 4] != 0x00 || (uint8_t)buffer[buffer.size() - 3] != 0x00 || (uint8_t)buffer[buffer.size() - 2] != 0xFF
+	|| (uint8_t)buffer[buffer.size() - 1] != 0xFF) {
+		return 0;
+	}
+	return 1;
+}
+
+int discord_client::DecompressZstdFrame(std::string_view buffer)
+{
+	size_t before = decompressed.size();
+	std::string error;
+	zstd_status status = zstd->decompress(buffer, decompressed, get_max_message_size(), error);
+	this->decompressed_total += decompressed.size() - before;
+	if (status != zs_ok) {
+		log(dpp::ll_error, error);
+		this->Error(status == zs_too_big ? 6003 : 6004);
+		this->StreamBroken();
+		return -1;
+	}
+	return 1;
 }
 
 bool discord_client::HandleFrame(const std::string &buffer)
 {
-	std::string& data = (std::string&)buffer;
+	return HandleFrame(std::string_view(buffer));
+}
+
+bool discord_client::HandleFrame(std::string_view buffer)
+{
+	std::string_view data = buffer;
 
-	/* gzip compression is a special case */
+	/* Compressed streams are a special case */
 	if (compressed) {
-		/* Check that we have a complete compressed frame */
-		if ((uint8_t)buffer[buffer.size() - 4] == 0x00 && (uint8_t)buffer[buffer.size() - 3] == 0x00 && (uint8_t)buffer[buffer.size() - 2] == 0xFF
-		&& (uint8_t)buffer[buffer.size() - 1] == 0xFF) {
-			/* Decompress buffer */
-			decompressed.clear();
-			zlib->d_stream.next_in = (Bytef *)buffer.c_str();
-			zlib->d_stream.avail_in = (uInt)buffer.size();
-			do {
-				int have = 0;
-				zlib->d_stream.next_out = (Bytef*)decomp_buffer;
-				zlib->d_stream.avail_out = DECOMP_BUFFER_SIZE;
-				int ret = inflate(&(zlib->d_stream), Z_NO_FLUSH);
-				have = DECOMP_BUFFER_SIZE - zlib->d_stream.avail_out;
-				switch (ret)
-				{
-					case Z_NEED_DICT:
-					case Z_STREAM_ERROR:
-						this->Error(6000);
-						this->close();
-						return true;
-					break;
-					case Z_DATA_ERROR:
-						this->Error(6001);
-						this->close();
-						return true;
-					break;
-					case Z_MEM_ERROR:
-						this->Error(6002);
-						this->close();
-						return true;
-					break;
-					case Z_OK:
-						this->decompressed.append((const char*)decomp_buffer, have);
-						this->decompressed_total += have;
-					break;
-					default:
-						/* Stub */
-					break;
-				}
-			} while (zlib->d_stream.avail_out == 0);
-			data = decompressed;
-		} else {
-			/* No complete compressed frame yet */
+		auto start = std::chrono::steady_clock::now();
+		int status = compression == tc_zstd_stream ? DecompressZstdFrame(buffer) : InflateFrame(buffer);
+		decompress_time += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		if (status < 0) {
+			return true;
+		} else if (status == 0) {
+			/* The rest of the message is in frames still to come */
 			return false;
 		}
+		data = decompressed;
 	}
 
+	/* Whatever happens to the message, the buffer is ready for the next one when this returns */
+	struct decompressed_reset {
+		std::string& buffer;
+		~decompressed_reset() {
+			buffer.clear();
+			if (buffer.capacity() > DECOMP_MAX_KEPT) {
+				buffer.shrink_to_fit();
+			}
+		}
+	} reset{decompressed};
 
 	json j;
 	
@@ -217,7 +504,7 @@ bool discord_client::HandleFrame(const std::string &buffer)
 	switch (protocol) {
 		case ws_json:
 			try {
-				j = json::parse(data);
+				j = json::parse(data.begin(), data.end());
 			}
 			catch (const std::exception &e) {
 				log(dpp::ll_error, fmt::format("discord_client::HandleFrame(JSON): {} [{}]", e.what(), data));
@@ -312,21 +599,22 @@ bool discord_client::HandleFrame(const std::string &buffer)
 			break;
 			case 0: {
 				std::string event = j["t"];
-				HandleEvent(event, j, data);
+				/* Keep cached objects seen by event handlers alive until they return */
+				epoch_guard pin;
+				/* Events keep the raw text of the frame, so this is where it is copied */
+				if (compressed) {
+					HandleEvent(event, j, decompressed);
+				} else {
+					HandleEvent(event, j, std::string(data));
+				}
 			}
 			break;
 			case 7:
 				log(dpp::ll_debug, fmt::format("Reconnection requested, closing socket {}", sessionid));
 				message_queue.clear();
 
+				/* The I/O loop sees the connection end and reconnects, closing the socket */
 				shutdown(sfd, 2);
-			#ifdef _WIN32
-				if (sfd >= 0 && sfd < FD_SETSIZE) {
-					closesocket(sfd);
-				}
-			#else
-				::close(sfd);
-			#endif
 
 			break;
 			/* Heartbeat ack */
@@ -385,6 +673,8 @@ void discord_client::Error(uint32_t errorcode)
 		{ 6000, "ZLib Stream Error" },
 		{ 6001, "ZLib Data Error" },
 		{ 6002, "ZLib Memory Error" },
+		{ 6003, "Decompressed message too large" },
+		{ 6004, "Zstd Decompression Error" },
 		{ 6666, "Hell freezing over" }
 	};
 	std::string error = "Unknown error";
@@ -441,8 +731,43 @@ void discord_client::one_second_timer()
 	auto first_iter = shards.begin();
 	if (first_iter != shards.end()) {
 		dpp::discord_client* first_shard = first_iter->second;
-		if ((time(NULL) % 60) == 0 && first_shard == this) {
+		if (first_shard == this && time(NULL) - last_cache_sweep >= DPP_USER_SWEEP_INTERVAL) {
+			last_cache_sweep = time(NULL);
 			dpp::garbage_collection();
+			if (creator->cache_policy.user_policy == dpp::cp_bounded) {
+				dpp::sweep_user_cache(creator->cache_policy.user_ttl, creator->cache_policy.user_memory_limit);
+			}
+		}
+	}
+
+	/* As often as users are swept, drop our own guilds' members whose users were evicted */
+	if (creator->cache_policy.user_policy == dpp::cp_bounded && time(NULL) - last_member_eviction >= DPP_USER_SWEEP_INTERVAL) {
+		last_member_eviction = time(NULL);
+		size_t evicted = dpp::evict_guild_members(this->shard_id, creator->me.id);
+		if (evicted) {
+			log(dpp::ll_debug, fmt::format("Evicted {} guild members", evicted));
+		}
+	}
+
+	/* Once we have been ready long enough for every GUILD_CREATE and requested member chunk
+	 * to arrive, drop whatever of ours came from a cache snapshot and was never confirmed
+	 */
+	if (!snapshot_pruned) {
+		bool settled = false;
+		if (this->is_connected()) {
+			std::lock_guard<std::mutex> locker(queue_mutex);
+			settled = message_queue.empty();
+		}
+		if (!settled) {
+			snapshot_settled = 0;
+		} else if (!snapshot_settled) {
+			snapshot_settled = time(NULL);
+		} else if (time(NULL) - snapshot_settled >= SNAPSHOT_PRUNE_DELAY) {
+			snapshot_pruned = true;
+			size_t pruned = dpp::cache_snapshot_prune(this->shard_id, this->max_shards);
+			if (pruned) {
+				log(dpp::ll_debug, fmt::format("Pruned {} guilds and members not confirmed since loading the cache snapshot", pruned));
+			}
 		}
 	}
 
@@ -457,14 +782,8 @@ void discord_client::one_second_timer()
 			log(dpp::ll_warning, fmt::format("Missed heartbeat ACK, forcing reconnection to session {}", sessionid));
 			message_queue.clear();
 
-		shutdown(sfd, 2);
-		#ifdef _WIN32
-			if (sfd >= 0 && sfd < FD_SETSIZE) {
-				closesocket(sfd);
-			}
-		#else
-			::close(sfd);
-		#endif
+			/* The I/O loop sees the connection end and reconnects, closing the socket */
+			shutdown(sfd, 2);
 			
 			return;
 		}
@@ -504,13 +823,15 @@ void discord_client::one_second_timer()
 uint64_t discord_client::get_guild_count() {
 	uint64_t total = 0;
 	dpp::cache* c = dpp::get_guild_cache();
-	dpp::cache_container& gc = c->get_container();
-	/* IMPORTANT: We must lock the container to iterate it */
-	std::lock_guard<std::mutex> lock(c->get_mutex());
-	for (auto g = gc.begin(); g != gc.end(); ++g) {
-		dpp::guild* gp = (dpp::guild*)g->second;
-		if (gp->shard_id == this->shard_id) {
-			total++;
+	for (size_t s = 0; s < c->get_stripe_count(); ++s) {
+		dpp::cache_container& gc = c->get_container(s);
+		/* IMPORTANT: We must lock the container to iterate it */
+		std::shared_lock<std::shared_mutex> lock(c->get_mutex(s));
+		for (auto g = gc.begin(); g != gc.end(); ++g) {
+			dpp::guild* gp = (dpp::guild*)g->second;
+			if (gp->shard_id == this->shard_id) {
+				total++;
+			}
 		}
 	}
 	return total;
@@ -519,18 +840,22 @@ uint64_t discord_client::get_guild_count() {
 uint64_t discord_client::get_member_count() {
 	uint64_t total = 0;
 	dpp::cache* c = dpp::get_guild_cache();
-	dpp::cache_container& gc = c->get_container();
-	/* IMPORTANT: We must lock the container to iterate it */
-	std::lock_guard<std::mutex> lock(c->get_mutex());
-	for (auto g = gc.begin(); g != gc.end(); ++g) {
-		dpp::guild* gp = (dpp::guild*)g->second;
-		if (gp->shard_id == this->shard_id) {
-			if (creator->cache_policy.user_policy == dpp::cp_aggressive) {
-				/* We can use actual member count if we are using full user caching */
-				total += gp->members.size();
-			} else {
-				/* Otherwise we use approximate guild member counts from guild_create */
-				total += gp->member_count;
+	for (size_t s = 0; s < c->get_stripe_count(); ++s) {
+		dpp::cache_container& gc = c->get_container(s);
+		/* IMPORTANT: We must lock the container to iterate it */
+		std::shared_lock<std::shared_mutex> lock(c->get_mutex(s));
+		for (auto g = gc.begin(); g != gc.end(); ++g) {
+			dpp::guild* gp = (dpp::guild*)g->second;
+			if (gp->shard_id == this->shard_id) {
+				if (creator->cache_policy.user_policy == dpp::cp_aggressive) {
+					/* We can use actual member count if we are using full user caching */
+					total += gp->members.size();
+				} else {
+					/* Otherwise, including cp_bounded which only holds recently seen members,
+					 * we use approximate guild member counts from guild_create
+					 */
+					total += gp->member_count;
+				}
 			}
 		}
 	}
@@ -540,13 +865,15 @@ uint64_t discord_client::get_member_count() {
 uint64_t discord_client::get_channel_count() {
 	uint64_t total = 0;
 	dpp::cache* c = dpp::get_guild_cache();
-	dpp::cache_container& gc = c->get_container();
-	/* IMPORTANT: We must lock the container to iterate it */
-	std::lock_guard<std::mutex> lock(c->get_mutex());
-	for (auto g = gc.begin(); g != gc.end(); ++g) {
-		dpp::guild* gp = (dpp::guild*)g->second;
-		if (gp->shard_id == this->shard_id) {
-			total += gp->channels.size();
+	for (size_t s = 0; s < c->get_stripe_count(); ++s) {
+		dpp::cache_container& gc = c->get_container(s);
+		/* IMPORTANT: We must lock the container to iterate it */
+		std::shared_lock<std::shared_mutex> lock(c->get_mutex(s));
+		for (auto g = gc.begin(); g != gc.end(); ++g) {
+			dpp::guild* gp = (dpp::guild*)g->second;
+			if (gp->shard_id == this->shard_id) {
+				total += gp->channels.size();
+			}
 		}
 	}
 	return total;
@@ -657,6 +984,9 @@ void voiceconn::connect(snowflake guild_id) {
 			try {
 				this->creator->log(ll_debug, fmt::format("Connecting voice for guild {} channel {}", guild_id, this->channel_id));
 				this->voiceclient = new discord_voice_client(creator->creator, this->channel_id, guild_id, this->token, this->session_id, this->websocket_hostname);
+				if (creator->creator->ws_max_message_size) {
+					this->voiceclient->set_max_message_size(creator->creator->ws_max_message_size);
+				}
 				/* Note: Spawns thread! */
 				this->voiceclient->Run();
 			}
@@ -187,12 +187,18 @@ int discord_voice_client::UDPRecv(char* data, size_t max_length)
 }
 
 bool discord_voice_client::HandleFrame(const std::string &data)
+{
+	return HandleFrame(std::string_view(data));
+}
+
+bool discord_voice_client::HandleFrame(std::string_view data)
 {
 	log(dpp::ll_trace, fmt::format("R: {}", data));
 	json j;
+	epoch_guard pin;
 	
 	try {
-		j = json::parse(data);
+		j = json::parse(data.begin(), data.end());
 	}
 	catch (const std::exception &e) {
 		log(dpp::ll_error, fmt::format("discord_voice_client::HandleFrame {} [{}]", e.what(), data));
@@ -217,7 +223,7 @@ bool discord_voice_client::HandleFrame(const std::string &data)
 
 					if (creator->dispatch.voice_client_disconnect)
 					{
-						voice_client_disconnect_t vcd(nullptr, data);
+						voice_client_disconnect_t vcd(nullptr, std::string(data));
 						vcd.voice_client = this;
 						vcd.user_id = u_id;
 						creator->dispatch.voice_client_disconnect(vcd);
@@ -239,7 +245,7 @@ bool discord_voice_client::HandleFrame(const std::string &data)
 					ssrcMap[u_ssrc] = u_id;
 
 					if (creator->dispatch.voice_client_speaking) {
-						voice_client_speaking_t vcs(nullptr, data);
+						voice_client_speaking_t vcs(nullptr, std::string(data));
 						vcs.voice_client = this;
 						vcs.user_id = u_id;
 						vcs.ssrc = u_ssrc;
@@ -309,7 +315,7 @@ bool discord_voice_client::HandleFrame(const std::string &data)
 
 				/* Fire on_voice_ready */
 				if (creator->dispatch.voice_ready) {
-					voice_ready_t rdy(nullptr, data);
+					voice_ready_t rdy(nullptr, std::string(data));
 					rdy.voice_client = this;
 					rdy.voice_channel_id = this->channel_id;
 					creator->dispatch.voice_ready(rdy);
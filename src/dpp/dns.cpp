@@ -0,0 +1,254 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * Copyright 2021 Craig Edwards and D++ contributors 
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#endif
+#include <string.h>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <dpp/dns.h>
+#include <dpp/discord.h>
+#include <dpp/dispatcher.h>
+#include <dpp/fmt/format.h>
+
+/* Most hostnames that can wait for the resolver thread at once. Requests for a hostname
+ * already waiting share its lookup, so this is only reached if something is resolving
+ * many different hostnames while the system resolver is stuck.
+ */
+#define DNS_MAX_QUEUED	256
+
+/* Most resolver threads. They are started as lookups queue up with none of them free, so
+ * one hostname whose lookup is stuck in getaddrinfo() doesn't hold up lookups of the others.
+ */
+#define DNS_RESOLVER_THREADS	4
+
+namespace dpp {
+
+namespace {
+
+/**
+ * @brief A lookup waiting for a resolver thread
+ */
+struct dns_lookup {
+	/** Cache key, hostname and port */
+	std::string key;
+	/** Hostname to resolve */
+	std::string hostname;
+	/** Port or service name */
+	std::string port;
+	/** Receives the addresses */
+	std::shared_ptr<std::promise<dns_result>> result;
+};
+
+/**
+ * @brief A hostname in the cache
+ */
+struct dns_cache_entry {
+	/** Time the addresses expire, on the dpp::utility::time_f() clock */
+	double expires = 0;
+	/** Addresses from the last successful lookup */
+	dns_result addresses;
+	/** The lookup running for the hostname, if there is one */
+	std::shared_future<dns_result> pending;
+};
+
+/**
+ * @brief The DNS cache. It is never destroyed, as the resolver threads may still be
+ * running when the program exits.
+ */
+struct dns_cache {
+	/** Mutex for entries, ttl, queue, resolvers and idle_resolvers */
+	std::mutex mutex;
+	/** Hostnames, by hostname and port */
+	std::unordered_map<std::string, dns_cache_entry> entries;
+	/** Seconds addresses are cached for */
+	time_t ttl = 300;
+	/** Lookups waiting for a resolver thread, in the order they were asked for */
+	std::deque<dns_lookup> queue;
+	/** Signalled when a lookup is queued */
+	std::condition_variable queued;
+	/** Number of resolver threads started */
+	unsigned resolvers = 0;
+	/** Number of resolver threads waiting for a lookup */
+	unsigned idle_resolvers = 0;
+	/** Metric counters, see dns_stats */
+	std::atomic<uint64_t> lookups{0}, cache_hits{0}, shared{0}, stale_used{0};
+};
+
+dns_cache& cache()
+{
+	static dns_cache* c = new dns_cache();
+	return *c;
+}
+
+/* Look a hostname up with the system resolver, which blocks */
+int lookup(const std::string& hostname, const std::string& port, dns_result& result)
+{
+	addrinfo hints, *addrs;
+	memset(&hints, 0, sizeof(addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	int status = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &addrs);
+	if (status != 0) {
+		return status;
+	}
+	for (addrinfo* a = addrs; a != nullptr; a = a->ai_next) {
+		result.push_back({a->ai_family, a->ai_socktype, a->ai_protocol, std::string((const char*)a->ai_addr, a->ai_addrlen)});
+	}
+	freeaddrinfo(addrs);
+	return 0;
+}
+
+/* A resolver thread. getaddrinfo() blocks, so every lookup runs on one of these, rather than
+ * on the threads which asked for them.
+ */
+void run_resolver()
+{
+	dns_cache& c = cache();
+	std::unique_lock<std::mutex> lock(c.mutex);
+	while (true) {
+		c.idle_resolvers++;
+		c.queued.wait(lock, [&c]() { return !c.queue.empty(); });
+		c.idle_resolvers--;
+		dns_lookup q = std::move(c.queue.front());
+		c.queue.pop_front();
+		lock.unlock();
+
+		dns_result addresses;
+		int status = lookup(q.hostname, q.port, addresses);
+
+		lock.lock();
+		dns_cache_entry& e = c.entries[q.key];
+		e.pending = std::shared_future<dns_result>();
+		if (status == 0 && !addresses.empty()) {
+			e.addresses = addresses;
+			e.expires = dpp::utility::time_f() + c.ttl;
+			q.result->set_value(std::move(addresses));
+		} else if (!e.addresses.empty()) {
+			/* The old addresses are more use than no addresses at all, e.g. during a DNS outage */
+			c.stale_used++;
+			q.result->set_value(e.addresses);
+		} else {
+			c.entries.erase(q.key);
+			q.result->set_exception(std::make_exception_ptr(dpp::exception(fmt::format("Couldn't resolve hostname '{}': {}", q.hostname, status ? gai_strerror(status) : "no addresses"))));
+		}
+	}
+}
+
+};
+
+const sockaddr* dns_address::get_sockaddr() const
+{
+	return (const sockaddr*)addr.data();
+}
+
+size_t dns_address::get_size() const
+{
+	return addr.size();
+}
+
+std::shared_future<dns_result> resolve_hostname_async(const std::string& hostname, const std::string& port)
+{
+	dns_cache& c = cache();
+	std::string key = hostname + ":" + port;
+	std::lock_guard<std::mutex> lock(c.mutex);
+	dns_cache_entry& e = c.entries[key];
+	if (!e.addresses.empty() && dpp::utility::time_f() < e.expires) {
+		c.cache_hits++;
+		std::promise<dns_result> cached;
+		cached.set_value(e.addresses);
+		return cached.get_future().share();
+	}
+	if (e.pending.valid()) {
+		c.shared++;
+		return e.pending;
+	}
+
+	if (c.queue.size() >= DNS_MAX_QUEUED) {
+		std::promise<dns_result> refused;
+		if (!e.addresses.empty()) {
+			c.stale_used++;
+			refused.set_value(e.addresses);
+		} else {
+			refused.set_exception(std::make_exception_ptr(dpp::exception(fmt::format("Couldn't resolve hostname '{}': too many lookups waiting", hostname))));
+			c.entries.erase(key);
+		}
+		return refused.get_future().share();
+	}
+	c.lookups++;
+	auto result = std::make_shared<std::promise<dns_result>>();
+	e.pending = result->get_future().share();
+	c.queue.push_back({key, hostname, port, result});
+	if (c.queue.size() > c.idle_resolvers && c.resolvers < DNS_RESOLVER_THREADS) {
+		/* Threads last for the life of the program, which the never destroyed cache outlives */
+		c.resolvers++;
+		std::thread(run_resolver).detach();
+	}
+	c.queued.notify_one();
+	return e.pending;
+}
+
+dns_result resolve_hostname(const std::string& hostname, const std::string& port, time_t timeout)
+{
+	std::shared_future<dns_result> result = resolve_hostname_async(hostname, port);
+	if (result.wait_for(std::chrono::seconds(timeout)) != std::future_status::ready) {
+		throw dpp::exception(fmt::format("Timed out resolving hostname '{}'", hostname));
+	}
+	return result.get();
+}
+
+void set_dns_cache_ttl(time_t seconds)
+{
+	dns_cache& c = cache();
+	std::lock_guard<std::mutex> lock(c.mutex);
+	c.ttl = seconds;
+	if (seconds == 0) {
+		for (auto& e : c.entries) {
+			e.second.expires = 0;
+		}
+	}
+}
+
+dns_stats get_dns_stats()
+{
+	dns_cache& c = cache();
+	dns_stats s;
+	s.lookups = c.lookups;
+	s.cache_hits = c.cache_hits;
+	s.shared = c.shared;
+	s.stale_used = c.stale_used;
+	std::lock_guard<std::mutex> lock(c.mutex);
+	s.entries = c.entries.size();
+	return s;
+}
+
+};
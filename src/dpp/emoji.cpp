@@ -28,6 +28,8 @@ namespace dpp {
 
 using json = nlohmann::json;
 
+slab_helper(emoji);
+
 emoji::emoji() : managed(), user_id(0), flags(0), image_data(nullptr)
 {
 }
@@ -52,6 +52,9 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 	if (!g) {
 		g = new dpp::guild();
 		newguild = true;
+	} else if (dpp::cache_snapshot_reconcile(g->id)) {
+		/* Loaded from a cache snapshot; refresh roles, channels and members as if new */
+		newguild = true;
 	}
 	g->fill_from_json(client, &d);
 	g->shard_id = client->shard_id;
@@ -67,6 +70,7 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 				}
 				r->fill_from_json(g->id, &role);
 				dpp::get_role_cache()->store(r);
+				dpp::cache_snapshot_confirm_object(g->id, r->id);
 				g->roles.push_back(r->id);
 			}
 		}
@@ -82,6 +86,7 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 			c->fill_from_json(&channel);
 			c->guild_id = g->id;
 			dpp::get_channel_cache()->store(c);
+			dpp::cache_snapshot_confirm_object(g->id, c->id);
 			g->channels.push_back(c->id);
 		}
 
@@ -93,19 +98,30 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 		}
 
 		/* Store guild members */
-		if (client->creator->cache_policy.user_policy == cp_aggressive) {
+		if (client->creator->cache_policy.user_policy == cp_aggressive || client->creator->cache_policy.user_policy == cp_bounded) {
 			g->members.reserve(d["members"].size());
 			for (auto & user : d["members"]) {
 				snowflake userid = SnowflakeNotNull(&(user["user"]), "id");
 				/* Only store ones we don't have already otherwise gm will leak */
-				if (g->members.find(userid) == g->members.end()) {
+				auto existing = g->members.find(userid);
+				if (existing != g->members.end()) {
+					/* Already known from a cache snapshot, just bring it up to date */
+					dpp::cache_snapshot_confirm_member(g->id, userid);
+					existing->second.fill_from_json(&(user["user"]), g->id, userid);
 					dpp::user* u = dpp::find_user(userid);
+					if (u && dpp::cache_snapshot_refresh_user(userid)) {
+						u->fill_from_json(&(user["user"]));
+					}
+				} else {
+					dpp::user* u = dpp::acquire_user(userid);
 					if (!u) {
 						u = new dpp::user();
 						u->fill_from_json(&(user["user"]));
-						dpp::get_user_cache()->store(u);
+						u = dpp::store_user(u);
 					} else {
-						u->refcount++;
+						if (dpp::cache_snapshot_refresh_user(userid)) {
+							u->fill_from_json(&(user["user"]));
+						}
 					}
 					dpp::guild_member gm;
 					gm.fill_from_json(&(user["user"]), g->id, userid);
@@ -124,12 +140,14 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 					e->fill_from_json(&emoji);
 					dpp::get_emoji_cache()->store(e);
 				}
+				dpp::cache_snapshot_confirm_object(g->id, e->id);
 				g->emojis.push_back(e->id);
 			}
 		}
 	}
 	dpp::get_guild_cache()->store(g);
 	if (newguild && g->id && (client->intents & dpp::i_guild_members)) {
+		/* Only full caching requests every member; cp_bounded caches members as they are seen */
 		if (client->creator->cache_policy.user_policy == cp_aggressive) {
 			json chunk_req = json({{"op", 8}, {"d", {{"guild_id",std::to_string(g->id)},{"query",""},{"limit",0}}}});
 			if (client->intents & dpp::i_guild_presences) {
@@ -73,13 +73,7 @@ void guild_delete::handle(discord_client* client, json &j, const std::string &ra
 			}
 			if (client->creator->cache_policy.user_policy != dpp::cp_none) {
 				for (auto gm = g->members.begin(); gm != g->members.end(); ++gm) {
-					dpp::user* u = dpp::find_user(gm->second.user_id);
-					if (u) {
-						u->refcount--;
-						if (u->refcount < 1) {
-							dpp::get_user_cache()->remove(u);
-						}
-					}
+					dpp::release_user(gm->second.user_id);
 				}
 			}
 			g->members.clear();
@@ -58,22 +58,30 @@ void guild_member_add::handle(discord_client* client, json &j, const std::string
 				client->creator->dispatch.guild_member_add(gmr);
 			}
 		} else {
-			dpp::user* u = dpp::find_user(SnowflakeNotNull(&(d["user"]), "id"));
+			snowflake userid = SnowflakeNotNull(&(d["user"]), "id");
+			auto existing = g->members.find(userid);
+			/* A member we already have doesn't add another guild to the user's refcount */
+			dpp::user* u = existing == g->members.end() ? dpp::acquire_user(userid) : dpp::find_user(userid);
 			if (!u) {
 				u = new dpp::user();
 				u->fill_from_json(&(d["user"]));
-				dpp::get_user_cache()->store(u);
+				u = dpp::store_user(u);
 			} else {
-				u->refcount++;
+				if (dpp::cache_snapshot_refresh_user(userid)) {
+					u->fill_from_json(&(d["user"]));
+				}
 			}
 			dpp::guild_member gm;
 			gmr.added = {};
-			if (u && u->id && g->members.find(u->id) == g->members.end()) {
+			if (u && u->id && existing == g->members.end()) {
 				gm.fill_from_json(&d, g->id, u->id);
 				g->members[u->id] = gm;
 				gmr.added = gm;
 			} else if (u && u->id) {
-				gmr.added = g->members.find(u->id)->second;
+				if (dpp::cache_snapshot_confirm_member(g->id, u->id)) {
+					existing->second.fill_from_json(&d, g->id, u->id);
+				}
+				gmr.added = existing->second;
 			}
 			if (client->creator->dispatch.guild_member_add) {
 				gmr.adding_guild = g;
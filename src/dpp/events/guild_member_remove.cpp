@@ -66,13 +66,7 @@ void guild_member_remove::handle(discord_client* client, json &j, const std::str
 		if (gmr.removing_guild && gmr.removed) {
 			auto i = gmr.removing_guild->members.find(gmr.removed->id);
 			if (i != gmr.removing_guild->members.end()) {
-				dpp::user* u = dpp::find_user(gmr.removed->id);
-				if (u) {
-					u->refcount--;
-					if (u->refcount < 1) {
-						dpp::get_user_cache()->remove(u);
-					}
-				}
+				dpp::release_user(gmr.removed->id);
 				gmr.removing_guild->members.erase(i);
 			}
 
@@ -64,6 +64,10 @@ void guild_member_update::handle(discord_client* client, json &j, const std::str
 			guild_member m;
 			m.fill_from_json(&user, g->id, u->id);
 			g->members[u->id] = m;
+			dpp::cache_snapshot_confirm_member(g->id, u->id);
+			if (dpp::cache_snapshot_refresh_user(u->id)) {
+				u->fill_from_json(&(d["user"]));
+			}
 
 			if (client->creator->dispatch.guild_member_update) {
 				dpp::guild_member_update_t gmu(client, raw);
@@ -49,21 +49,37 @@ void guild_members_chunk::handle(discord_client* client, json &j, const std::str
 	dpp::guild* g = dpp::find_guild(SnowflakeNotNull(&d, "guild_id"));
 	if (g) {
 		/* Store guild members */
-		if (client->creator->cache_policy.user_policy == cp_aggressive) {
+		if (client->creator->cache_policy.user_policy == cp_aggressive || client->creator->cache_policy.user_policy == cp_bounded) {
 			for (auto & userrec : d["members"]) {
 				json & userspart = userrec["user"];
-				dpp::user* u = dpp::find_user(SnowflakeNotNull(&userspart, "id"));
-				if (!u) {
-					u = new dpp::user();
-					u->fill_from_json(&userspart);
-					dpp::get_user_cache()->store(u);
-				}
-				if (g->members.find(u->id) == g->members.end()) {
+				snowflake userid = SnowflakeNotNull(&userspart, "id");
+				auto existing = g->members.find(userid);
+				if (existing == g->members.end()) {
+					/* The user's refcount is the number of guilds it is a member of */
+					dpp::user* u = dpp::acquire_user(userid);
+					if (!u) {
+						u = new dpp::user();
+						u->fill_from_json(&userspart);
+						u = dpp::store_user(u);
+					} else {
+						if (dpp::cache_snapshot_refresh_user(userid)) {
+							u->fill_from_json(&userspart);
+						}
+					}
 					dpp::guild_member gm;
 					gm.fill_from_json(&userrec, g->id, u->id);
 					g->members[u->id] = gm;
 					if (client->creator->dispatch.guild_members_chunk)
 						um[u->id] = gm;
+				} else if (dpp::cache_snapshot_confirm_member(g->id, userid)) {
+					/* Known from a cache snapshot, bring it up to date */
+					existing->second.fill_from_json(&userrec, g->id, userid);
+					dpp::user* u = dpp::find_user(userid);
+					if (u && dpp::cache_snapshot_refresh_user(userid)) {
+						u->fill_from_json(&userspart);
+					}
+					if (client->creator->dispatch.guild_members_chunk)
+						um[userid] = existing->second;
 				}
 			}
 		}
@@ -25,6 +25,10 @@
 #include <dpp/discordevents.h>
 #include <dpp/stringops.h>
 #include <dpp/nlohmann/json.hpp>
+#include <atomic>
+#include <mutex>
+#include <string_view>
+#include <algorithm>
 
 using json = nlohmann::json;
 
@@ -125,7 +129,7 @@ void from_json(const nlohmann::json& j, guild_member& gm) {
 std::string guild_member::build_json() const {
 	json j;
 	if (!this->nickname.empty())
-		j["nick"] = this->nickname;
+		j["nick"] = this->nickname.str();
 	if (this->roles.size()) {
 		j["roles"] = {};
 		for (auto & role : roles) {
@@ -153,6 +157,153 @@ bool guild_member::is_pending() const {
 	return flags & dpp::gm_pending;
 }
 
+size_t guild_member::heap_bytes() const {
+	return roles.heap_bytes() + nickname.bytes();
+}
+
+/** Number of lock stripes of the intern table, so shards filling members don't contend */
+#define INTERNED_STRIPES 64
+
+/**
+ * @brief A shared interned string value.
+ * Holders that already own a reference may add and drop references without
+ * locking, as long as the count stays above zero. Taking a reference from the
+ * table, and dropping the last one, happen under the mutex of the entry's
+ * stripe, so an entry can't be found in the table while it is being erased.
+ */
+struct interned_string::entry {
+	std::atomic<uint32_t> refs;
+	const std::string value;
+	/** Index of the stripe of the intern table holding this entry */
+	const size_t stripe;
+
+	entry(const std::string& v, size_t s) : refs(1), value(v), stripe(s) {
+	}
+};
+
+/**
+ * @brief A lock stripe of the intern table. Values are spread over the stripes by hash.
+ */
+struct interned_stripe {
+	std::mutex mutex;
+	std::unordered_map<std::string_view, interned_string::entry*> table;
+};
+
+static interned_stripe* interned_stripes = new interned_stripe[INTERNED_STRIPES];
+static const std::string interned_empty;
+
+interned_string::interned_string() : e(nullptr) {
+}
+
+interned_string::interned_string(const std::string& value) : e(nullptr) {
+	*this = value;
+}
+
+interned_string::interned_string(const interned_string& other) : e(other.e) {
+	if (e) {
+		e->refs++;
+	}
+}
+
+interned_string::interned_string(interned_string&& other) noexcept : e(other.e) {
+	other.e = nullptr;
+}
+
+interned_string::~interned_string() {
+	release();
+}
+
+void interned_string::release() {
+	if (!e) {
+		return;
+	}
+	uint32_t r = e->refs.load();
+	while (r > 1) {
+		if (e->refs.compare_exchange_weak(r, r - 1)) {
+			e = nullptr;
+			return;
+		}
+	}
+	/* Probably the last reference, this must be done under the stripe's lock */
+	interned_stripe& stripe = interned_stripes[e->stripe];
+	std::lock_guard<std::mutex> lock(stripe.mutex);
+	if (--e->refs == 0) {
+		stripe.table.erase(std::string_view(e->value));
+		delete e;
+	}
+	e = nullptr;
+}
+
+interned_string& interned_string::operator=(const interned_string& other) {
+	if (e != other.e) {
+		release();
+		e = other.e;
+		if (e) {
+			e->refs++;
+		}
+	}
+	return *this;
+}
+
+interned_string& interned_string::operator=(interned_string&& other) noexcept {
+	if (this != &other) {
+		release();
+		e = other.e;
+		other.e = nullptr;
+	}
+	return *this;
+}
+
+interned_string& interned_string::operator=(const std::string& value) {
+	if (e && e->value == value) {
+		return *this;
+	}
+	release();
+	if (value.empty()) {
+		return *this;
+	}
+	size_t index = std::hash<std::string_view>()(value) % INTERNED_STRIPES;
+	interned_stripe& stripe = interned_stripes[index];
+	std::lock_guard<std::mutex> lock(stripe.mutex);
+	auto i = stripe.table.find(std::string_view(value));
+	if (i != stripe.table.end()) {
+		e = i->second;
+		e->refs++;
+	} else {
+		e = new entry(value, index);
+		stripe.table.emplace(std::string_view(e->value), e);
+	}
+	return *this;
+}
+
+const std::string& interned_string::str() const {
+	return e ? e->value : interned_empty;
+}
+
+interned_string::operator const std::string&() const {
+	return str();
+}
+
+bool interned_string::empty() const {
+	return e == nullptr;
+}
+
+size_t interned_string::bytes() const {
+	if (!e) {
+		return 0;
+	}
+	uint32_t r = std::max(e->refs.load(), (uint32_t)1);
+	return (sizeof(entry) + e->value.capacity()) / r;
+}
+
+bool interned_string::operator==(const interned_string& other) const {
+	return e == other.e;
+}
+
+bool interned_string::operator!=(const interned_string& other) const {
+	return e != other.e;
+}
+
 bool guild::is_large() const {
 	return this->flags & g_large;
 }
@@ -269,6 +420,15 @@ std::string guild::build_json(bool with_id) const {
 	return j.dump();
 }
 
+size_t guild::members_bytes() const {
+	/* Each node of an unordered_map holds the value and a next pointer */
+	size_t total = members.bucket_count() * sizeof(void*) + members.size() * (sizeof(members_container::value_type) + sizeof(void*));
+	for (auto& m : members) {
+		total += m.second.heap_bytes();
+	}
+	return total;
+}
+
 void guild::rehash_members() {
 	members_container n;
 	n.reserve(members.size());
@@ -396,7 +556,7 @@ uint64_t guild::base_permissions(const user* member) const
 	auto mi = members.find(member->id);
 	if (mi == members.end())
 		return 0;
-	guild_member gm = mi->second;
+	const guild_member& gm = mi->second;
 
 	uint64_t permissions = everyone->permissions;
 
@@ -428,7 +588,7 @@ uint64_t guild::permission_overwrites(const uint64_t base_permissions, const use
 	auto mi = members.find(member->id);
 	if (mi == members.end())
 		return 0;
-	guild_member gm = mi->second;
+	const guild_member& gm = mi->second;
 	uint64_t allow = 0;
 	uint64_t deny = 0;
 
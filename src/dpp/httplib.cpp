@@ -646,7 +646,9 @@ template <typename BindOrConnect>
 socket_t create_socket(const char *host, int port, int address_family,
                        int socket_flags, bool tcp_nodelay,
                        SocketOptions socket_options,
-                       BindOrConnect bind_or_connect) {
+                       BindOrConnect bind_or_connect,
+                       // D++ local change: only create_client_socket passes this
+                       const AddressResolver &resolver = AddressResolver()) {
   // Get address info
   struct addrinfo hints;
   struct addrinfo *result;
@@ -659,12 +661,34 @@ socket_t create_socket(const char *host, int port, int address_family,
 
   auto service = std::to_string(port);
 
-  if (getaddrinfo(host, service.c_str(), &hints, &result)) {
+  // D++ local change: client connections may be resolved by the address
+  // resolver, into addrinfo nodes of our own which must not be passed to
+  // freeaddrinfo
+  std::vector<ResolvedAddress> resolved;
+  std::vector<struct addrinfo> nodes;
+  if (resolver) {
+    if (!resolver(host, port, address_family, resolved) || resolved.empty()) {
+      return INVALID_SOCKET;
+    }
+    nodes.resize(resolved.size());
+    for (size_t i = 0; i < resolved.size(); i++) {
+      nodes[i].ai_family = resolved[i].family;
+      nodes[i].ai_socktype = resolved[i].socktype;
+      nodes[i].ai_protocol = resolved[i].protocol;
+      nodes[i].ai_addr = reinterpret_cast<struct sockaddr *>(&resolved[i].addr[0]);
+      nodes[i].ai_addrlen = static_cast<socklen_t>(resolved[i].addr.size());
+      nodes[i].ai_next = i + 1 < resolved.size() ? &nodes[i + 1] : nullptr;
+    }
+    result = nodes.data();
+  } else if (getaddrinfo(host, service.c_str(), &hints, &result)) {
 #ifdef __linux__
     res_init();
 #endif
     return INVALID_SOCKET;
   }
+  auto free_result = [&]() {
+    if (nodes.empty()) { freeaddrinfo(result); }
+  };
 
   for (auto rp = result; rp; rp = rp->ai_next) {
     // Create a socket
@@ -714,14 +738,14 @@ socket_t create_socket(const char *host, int port, int address_family,
 
     // bind or connect
     if (bind_or_connect(sock, *rp)) {
-      freeaddrinfo(result);
+      free_result();
       return sock;
     }
 
     close_socket(sock);
   }
 
-  freeaddrinfo(result);
+  free_result();
   return INVALID_SOCKET;
 }
 
@@ -798,7 +822,9 @@ socket_t create_client_socket(
     SocketOptions socket_options, time_t connection_timeout_sec,
     time_t connection_timeout_usec, time_t read_timeout_sec,
     time_t read_timeout_usec, time_t write_timeout_sec,
-    time_t write_timeout_usec, const std::string &intf, Error &error) {
+    time_t write_timeout_usec, const std::string &intf,
+    const AddressResolver &resolver, // D++ local change
+    Error &error) {
   auto sock = create_socket(
       host, port, address_family, 0, tcp_nodelay, std::move(socket_options),
       [&](socket_t sock, struct addrinfo &ai) -> bool {
@@ -844,7 +870,8 @@ socket_t create_client_socket(
 
         error = Error::Success;
         return true;
-      });
+      },
+      resolver);
 
   if (sock != INVALID_SOCKET) {
     error = Error::Success;
@@ -3852,6 +3879,7 @@ void ClientImpl::copy_settings(const ClientImpl &rhs) {
   compress_ = rhs.compress_;
   decompress_ = rhs.decompress_;
   interface_ = rhs.interface_;
+  address_resolver_ = rhs.address_resolver_; // D++ local change
   proxy_host_ = rhs.proxy_host_;
   proxy_port_ = rhs.proxy_port_;
   proxy_basic_auth_username_ = rhs.proxy_basic_auth_username_;
@@ -3873,13 +3901,13 @@ socket_t ClientImpl::create_client_socket(Error &error) const {
         proxy_host_.c_str(), proxy_port_, address_family_, tcp_nodelay_,
         socket_options_, connection_timeout_sec_, connection_timeout_usec_,
         read_timeout_sec_, read_timeout_usec_, write_timeout_sec_,
-        write_timeout_usec_, interface_, error);
+        write_timeout_usec_, interface_, address_resolver_, error);
   }
   return detail::create_client_socket(
       host_.c_str(), port_, address_family_, tcp_nodelay_, socket_options_,
       connection_timeout_sec_, connection_timeout_usec_, read_timeout_sec_,
       read_timeout_usec_, write_timeout_sec_, write_timeout_usec_, interface_,
-      error);
+      address_resolver_, error);
 }
 
 bool ClientImpl::create_and_connect_socket(Socket &socket,
@@ -5023,6 +5051,11 @@ void ClientImpl::set_decompress(bool on) { decompress_ = on; }
 
 void ClientImpl::set_interface(const char *intf) { interface_ = intf; }
 
+// D++ local change
+void ClientImpl::set_address_resolver(AddressResolver resolver) {
+  address_resolver_ = std::move(resolver);
+}
+
 void ClientImpl::set_proxy(const char *host, int port) {
   proxy_host_ = host;
   proxy_port_ = port;
@@ -6139,6 +6172,11 @@ void Client::set_interface(const char *intf) {
   cli_->set_interface(intf);
 }
 
+// D++ local change
+void Client::set_address_resolver(AddressResolver resolver) {
+  cli_->set_address_resolver(std::move(resolver));
+}
+
 void Client::set_proxy(const char *host, int port) {
   cli_->set_proxy(host, port);
 }
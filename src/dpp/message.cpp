@@ -342,6 +342,23 @@ message& message::set_file_content(const std::string &fc)
 	return *this;
 }
 
+message& message::add_file(const std::string &fn, const std::string &fc)
+{
+	uploads.emplace_back(fn, fc);
+	return *this;
+}
+
+message& message::add_file(const http_upload &file)
+{
+	uploads.push_back(file);
+	return *this;
+}
+
+const std::vector<http_upload>& message::get_uploads() const
+{
+	return uploads;
+}
+
 message& message::set_content(const std::string &c)
 {
 	content = utility::utf8substr(c, 0, 2000);
@@ -740,6 +757,7 @@ message& message::fill_from_json(json* d, cache_policy_t cp) {
 	this->type = Int8NotNull(d, "type");
 	this->author = nullptr;
 	user* authoruser = nullptr;
+	bool new_author = false;
 	/* May be null, if its null cache it from the partial */
 	if (d->find("author") != d->end()) {
 		json &j_author = (*d)["author"];
@@ -749,13 +767,18 @@ message& message::fill_from_json(json* d, cache_policy_t cp) {
 			this->author = &self_author;
 			self_author.fill_from_json(&j_author);
 		} else {
-			/* User caching on - aggressive or lazy - create a cached user entry */
+			/* User caching on - aggressive, lazy or bounded - create a cached user entry */
 			authoruser = find_user(SnowflakeNotNull(&j_author, "id"));
 			if (!authoruser) {
 				/* User does not exist yet, cache the partial as a user record */
-				authoruser = new user();
-				authoruser->fill_from_json(&j_author);
-				get_user_cache()->store(authoruser);
+				user* u = new user();
+				u->fill_from_json(&j_author);
+				/* Another shard may have cached the same user meanwhile */
+				authoruser = (user*)get_user_cache()->store_or_find(u, [](managed*) {});
+				new_author = authoruser == u;
+				if (!new_author) {
+					delete u;
+				}
 			}
 			this->author = authoruser;
 		}
@@ -808,10 +831,17 @@ message& message::fill_from_json(json* d, cache_policy_t cp) {
 			/* User caching off! Just fill in directly but dont store member to guild */
 			this->member.fill_from_json(&mi, g->id, uid);
 		} else {
-			/* User caching on, lazy or aggressive - cache the member information */
+			/* User caching on, lazy, aggressive or bounded - cache the member information */
 			auto thismember = g->members.find(uid);
 			if (thismember == g->members.end()) {
 				if (uid != 0 && authoruser) {
+					/* The user's refcount is the number of guilds it is a member of */
+					if (!new_author && !acquire_user(authoruser->id)) {
+						/* Released by another shard since we found it; cache it again */
+						user* u = new user(*authoruser);
+						u->refcount = 1;
+						store_user(u);
+					}
 					guild_member gm;
 					gm.fill_from_json(&mi, g->id, uid);
 					g->members[authoruser->id] = gm;
@@ -23,26 +23,53 @@
 #include <io.h>
 #pragma comment(lib,"ws2_32")
 #endif
+#include <memory>
+#include <limits>
+#include <fstream>
+#include <random>
 #include <dpp/queues.h>
 #include <dpp/cluster.h>
+#include <dpp/cache.h>
+#include <dpp/dns.h>
 #define CPPHTTPLIB_OPENSSL_SUPPORT
 #include <dpp/httplib.h>
 #include <dpp/fmt/format.h>
 #include <dpp/stringops.h>
 #include <dpp/version.h>
+#include <dpp/nlohmann/json.hpp>
+
+using json = nlohmann::json;
 
 namespace dpp {
 
 static std::string http_version = "DiscordBot (https://github.com/brainboxdotcc/DPP, " + std::to_string(DPP_VERSION_MAJOR) + "." + std::to_string(DPP_VERSION_MINOR) + "." + std::to_string(DPP_VERSION_PATCH) + ")";
 static const char* DISCORD_HOST = "https://discord.com";
 
+/* REST connections resolve their hosts through the DNS cache, like shards do. Only our own
+ * httplib clients are given this, so other httplib users in the process are unaffected.
+ */
+static bool resolve_through_cache(const char* host, int port, int address_family, std::vector<httplib::ResolvedAddress>& addresses)
+{
+	try {
+		for (auto& a : resolve_hostname(host, std::to_string(port))) {
+			if (address_family == AF_UNSPEC || a.family == address_family) {
+				addresses.push_back({a.family, a.socktype, a.protocol, a.addr});
+			}
+		}
+	}
+	catch (const dpp::exception&) {
+		return false;
+	}
+	return true;
+}
+
 http_request::http_request(const std::string &_endpoint, const std::string &_parameters, http_completion_event completion, const std::string &_postdata, http_method _method, const std::string &audit_reason, const std::string &filename, const std::string &filecontent)
- : complete_handler(completion), completed(false), non_discord(false), endpoint(_endpoint), parameters(_parameters), postdata(_postdata),  method(_method), reason(audit_reason), file_name(filename), file_content(filecontent), mimetype("application/json")
+ : complete_handler(completion), completed(false), non_discord(false), endpoint(_endpoint), parameters(_parameters), postdata(_postdata),  method(_method), reason(audit_reason), file_name(filename), file_content(filecontent), mimetype("application/json"), ratelimit_retries(0), priority(hp_normal), queued_at(0)
 {
 }
 
 http_request::http_request(const std::string &_url, http_completion_event completion, http_method _method, const std::string &_postdata, const std::string &_mimetype, const std::multimap<std::string, std::string> &_headers)
- : complete_handler(completion), completed(false), non_discord(true), endpoint(_url), postdata(_postdata), method(_method), mimetype(_mimetype), req_headers(_headers)
+ : complete_handler(completion), completed(false), non_discord(true), endpoint(_url), postdata(_postdata), method(_method), mimetype(_mimetype), req_headers(_headers), ratelimit_retries(0), priority(hp_normal), queued_at(0)
 {
 }
 
@@ -54,37 +81,291 @@ void http_request::complete(const http_request_completion_t &c) {
 		complete_handler(c);
 }
 
-/* Fill a http_request_completion_t from a HTTP result */
-void populate_result(const std::string &url, cluster* owner, http_request_completion_t& rv, const httplib::Result &res) {
+/* Read a numeric header, or 0 if it is missing. Rate limit times have a fractional part, which
+ * must be read the same way whatever the user's locale.
+ */
+template <typename T> static T header_value(const httplib::Result &res, const char* name) {
+	T value = 0;
+	std::istringstream iss(res->get_header_value(name));
+	iss.imbue(std::locale::classic());
+	iss >> value;
+	return value;
+}
+
+/* Fill a http_request_completion_t from a HTTP result. The body and header values are moved out of the result. */
+void populate_result(const std::string &url, cluster* owner, http_request_completion_t& rv, httplib::Result &res) {
 	rv.status = res->status;
-	rv.body = res->body;
-	for (auto &v : res->headers) {
-		rv.headers[v.first] = v.second;
-	}
 
 	/* This will be ignored for non-discord requests without rate limit headers */
 
-	rv.ratelimit_limit = from_string<uint64_t>(res->get_header_value("X-RateLimit-Limit"), std::dec);
-	rv.ratelimit_remaining = from_string<uint64_t>(res->get_header_value("X-RateLimit-Remaining"), std::dec);
-	rv.ratelimit_reset_after = from_string<uint64_t>(res->get_header_value("X-RateLimit-Reset-After"), std::dec);
+	rv.ratelimit_limit = header_value<uint64_t>(res, "X-RateLimit-Limit");
+	rv.ratelimit_remaining = header_value<uint64_t>(res, "X-RateLimit-Remaining");
+	rv.ratelimit_reset_after_precise = header_value<double>(res, "X-RateLimit-Reset-After");
 	rv.ratelimit_bucket = res->get_header_value("X-RateLimit-Bucket");
 	rv.ratelimit_global = (res->get_header_value("X-RateLimit-Global") == "true");
+	if (rv.status == 429) {
+		/* The Retry-After header is in whole seconds, the retry_after in the body has millisecond precision */
+		rv.ratelimit_retry_after_precise = header_value<double>(res, "Retry-After");
+	}
+
+	rv.body = std::move(res->body);
+	for (auto &v : res->headers) {
+		rv.headers[v.first] = std::move(v.second);
+	}
+
 	owner->rest_ping = rv.latency;
-	if (res->get_header_value("X-RateLimit-Retry-After") != "") {
-		rv.ratelimit_retry_after = from_string<uint64_t>(res->get_header_value("X-RateLimit-Retry-After"), std::dec);
+	if (rv.status == 429) {
+		try {
+			json j = json::parse(rv.body);
+			if (j.find("retry_after") != j.end() && j["retry_after"].is_number()) {
+				rv.ratelimit_retry_after_precise = j["retry_after"].get<double>();
+			}
+		}
+		catch (const std::exception &) {
+			/* Not JSON, keep the header value */
+		}
 	}
+	/* The whole second fields are kept for code written against them */
+	rv.ratelimit_reset_after = (uint64_t)rv.ratelimit_reset_after_precise;
+	rv.ratelimit_retry_after = (uint64_t)rv.ratelimit_retry_after_precise;
 	if (rv.status == 429) {
-		owner->log(ll_warning, fmt::format("Rate limited on endpoint {}, reset after {}s!", url, rv.ratelimit_retry_after ? rv.ratelimit_retry_after : rv.ratelimit_reset_after));
+		owner->log(ll_warning, fmt::format("Rate limited on endpoint {}, reset after {}s!", url, rv.ratelimit_retry_after_precise ? rv.ratelimit_retry_after_precise : rv.ratelimit_reset_after_precise));
 	}
 	if (url != "/api/v" DISCORD_API_VERSION "/gateway/bot") {	// Squelch this particular api endpoint or it generates a warning the minute we boot a cluster
 		if (rv.ratelimit_global) {
-			owner->log(ll_warning, fmt::format("At global rate limit on endpoint {}, reset after {}s", url, rv.ratelimit_retry_after ? rv.ratelimit_retry_after : rv.ratelimit_reset_after));
+			owner->log(ll_warning, fmt::format("At global rate limit on endpoint {}, reset after {}s", url, rv.ratelimit_retry_after_precise ? rv.ratelimit_retry_after_precise : rv.ratelimit_reset_after_precise));
 		} else if (rv.ratelimit_remaining == 1) {
-			owner->log(ll_warning, fmt::format("Near endpoint {} rate limit, reset after {}s", url, rv.ratelimit_retry_after ? rv.ratelimit_retry_after : rv.ratelimit_reset_after));
+			owner->log(ll_warning, fmt::format("Near endpoint {} rate limit, reset after {}s", url, rv.ratelimit_retry_after_precise ? rv.ratelimit_retry_after_precise : rv.ratelimit_reset_after_precise));
 		}
 	}
 }
 
+/* Work out the rate limit route of a request. Discord limits each route separately for each value of its
+ * major parameters (the channel, guild or webhook it acts on), and several routes may share one bucket.
+ * The key keeps the major parameters and replaces the other ids; the route replaces all of them, so that
+ * it can be matched up with the bucket hash Discord tells us for it.
+ */
+static void get_route(const http_request* req, std::string& key, std::string& route, std::string& major) {
+	static const char* method_names[] = { "GET", "POST", "PUT", "PATCH", "DELETE" };
+	std::string path = req->parameters.empty() ? req->endpoint : req->endpoint + "/" + req->parameters;
+	size_t query = path.find('?');
+	if (query != std::string::npos) {
+		path.resize(query);
+	}
+	auto is_id = [](const std::string& seg) {
+		return !seg.empty() && std::all_of(seg.begin(), seg.end(), [](unsigned char c) { return isdigit(c); });
+	};
+	key = route = std::string(method_names[req->method]) + " ";
+	major.clear();
+	std::string prev, prev2;
+	size_t start = 0;
+	while (start <= path.length()) {
+		size_t end = path.find('/', start);
+		if (end == std::string::npos) {
+			end = path.length();
+		}
+		std::string seg = path.substr(start, end - start);
+		if (start > 0) {
+			key += "/";
+			route += "/";
+		}
+		if (is_id(seg) && (prev == "channels" || prev == "guilds" || prev == "webhooks" || prev == "interactions")) {
+			/* Major parameter. Each interaction is answered through its own id and token, like a webhook. */
+			key += seg;
+			route += "{id}";
+			major += seg + "/";
+		} else if ((prev2 == "webhooks" || prev2 == "interactions") && is_id(prev)) {
+			/* A webhook or interaction token is part of its major parameter */
+			key += seg;
+			route += "{token}";
+			major += seg + "/";
+		} else if (prev == "reactions") {
+			key += "{emoji}";
+			route += "{emoji}";
+		} else if (is_id(seg)) {
+			key += "{id}";
+			route += "{id}";
+		} else {
+			key += seg;
+			route += seg;
+		}
+		prev2 = prev;
+		prev = seg;
+		start = end + 1;
+	}
+}
+
+http_upload::http_upload(const std::string &_name, std::string _content, const std::string &_mimetype)
+ : name(_name), mimetype(_mimetype), content(std::make_shared<const std::string>(std::move(_content))), size(0)
+{
+}
+
+http_upload::http_upload(const std::string &_name, size_t _size, upload_reader _reader, const std::string &_mimetype)
+ : name(_name), mimetype(_mimetype), size(_size), reader(_reader)
+{
+}
+
+http_upload http_upload::from_file(const std::string &name, const std::string &path, const std::string &mimetype)
+{
+	/* Copies of the upload share the open file, and may be read by more than one worker */
+	struct open_file {
+		std::mutex mutex;
+		std::ifstream stream;
+	};
+	auto file = std::make_shared<open_file>();
+	file->stream.open(path, std::ios_base::binary | std::ios_base::ate);
+	if (!file->stream.is_open()) {
+		throw dpp::exception("Can't open file to upload: " + path);
+	}
+	size_t size = (size_t)file->stream.tellg();
+	return http_upload(name, size, [file](size_t offset, char* buffer, size_t length) -> size_t {
+		std::lock_guard<std::mutex> lock(file->mutex);
+		file->stream.clear();
+		file->stream.seekg((std::streamoff)offset);
+		file->stream.read(buffer, (std::streamsize)length);
+		return (size_t)file->stream.gcount();
+	}, mimetype);
+}
+
+size_t http_upload::length() const
+{
+	return reader ? size : (content ? content->length() : 0);
+}
+
+namespace {
+
+/**
+ * @brief A multipart/form-data request body, written to the connection a piece at a time.
+ * The pieces point into the request's own strings and files, so nothing is copied into the body.
+ */
+class multipart_body {
+	/**
+	 * @brief A piece of the body, either text or a file read as it is sent
+	 */
+	struct piece {
+		/** Text, if file is nullptr */
+		const char* data;
+		/** File to read the piece from */
+		const http_upload* file;
+		/** Length of the piece */
+		size_t size;
+	};
+
+	/** Boundaries and part headers. A deque, as pieces point into its strings */
+	std::deque<std::string> texts;
+
+	/** Pieces, in order */
+	std::vector<piece> pieces;
+
+	/** Buffer files are read into */
+	std::string chunk;
+
+	/** Boundary between the parts */
+	std::string boundary;
+
+	void add(const char* data, const http_upload* file, size_t size) {
+		if (size) {
+			pieces.push_back({data, file, size});
+			length += size;
+		}
+	}
+
+	void add_text(std::string&& text) {
+		texts.emplace_back(std::move(text));
+		add(texts.back().data(), nullptr, texts.back().length());
+	}
+
+	void add_part_header(const std::string& field, const std::string& filename, const std::string& mimetype) {
+		std::string h = "--" + boundary + "\r\nContent-Disposition: form-data; name=\"" + field + "\"";
+		if (!filename.empty()) {
+			h += "; filename=\"" + filename + "\"";
+		}
+		add_text(h + "\r\nContent-Type: " + mimetype + "\r\n\r\n");
+	}
+
+public:
+	/** Total length of the body */
+	size_t length = 0;
+
+	/**
+	 * @brief Build the pieces of a body
+	 * 
+	 * @param req request, which must outlive the body
+	 */
+	multipart_body(const http_request& req) {
+		static const char chars[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+		thread_local std::mt19937 rng(std::random_device{}());
+		std::uniform_int_distribution<size_t> pick(0, sizeof(chars) - 2);
+		boundary = "--dpp-";
+		for (int i = 0; i < 24; ++i) {
+			boundary += chars[pick(rng)];
+		}
+
+		add_part_header("payload_json", "", req.mimetype);
+		add(req.postdata.data(), nullptr, req.postdata.length());
+		bool legacy_file = !req.file_name.empty() && !req.file_content.empty();
+		/* A single file is sent as "file", which every endpoint taking a file accepts. Several are numbered. */
+		bool numbered = req.uploads.size() + (legacy_file ? 1 : 0) > 1;
+		size_t n = 0;
+		auto field = [&]() {
+			return numbered ? "files[" + std::to_string(n++) + "]" : std::string("file");
+		};
+		if (legacy_file) {
+			add_text("\r\n");
+			add_part_header(field(), req.file_name, "application/octet-stream");
+			add(req.file_content.data(), nullptr, req.file_content.length());
+		}
+		for (auto& u : req.uploads) {
+			add_text("\r\n");
+			add_part_header(field(), u.name, u.mimetype);
+			if (u.reader) {
+				add(nullptr, &u, u.size);
+			} else if (u.content) {
+				add(u.content->data(), nullptr, u.content->length());
+			}
+		}
+		add_text("\r\n--" + boundary + "--\r\n");
+	}
+
+	/**
+	 * @brief Get the Content-Type of the body
+	 * 
+	 * @return std::string content type, including the boundary
+	 */
+	std::string content_type() const {
+		return "multipart/form-data; boundary=" + boundary;
+	}
+
+	/**
+	 * @brief Write the next part of the body, as a httplib::ContentProvider
+	 * 
+	 * @param offset offset of the body to write from
+	 * @param sink where to write it
+	 * @return true if something was written
+	 */
+	bool provide(size_t offset, httplib::DataSink& sink) {
+		size_t start = 0;
+		for (auto& p : pieces) {
+			if (offset < start + p.size) {
+				size_t from = offset - start;
+				size_t n = p.size - from;
+				if (!p.file) {
+					return sink.write(p.data + from, n);
+				}
+				/* Files are read a chunk at a time, into the same buffer */
+				n = std::min(n, (size_t)65536);
+				chunk.resize(n);
+				size_t got = p.file->reader(from, &chunk[0], n);
+				return got && got <= n && sink.write(chunk.data(), got);
+			}
+			start += p.size;
+		}
+		return false;
+	}
+};
+
+};
+
 /* Returns true if the request has been made */
 bool http_request::is_completed()
 {
@@ -92,7 +373,7 @@ bool http_request::is_completed()
 }
 
 /* Execute a HTTP request */
-http_request_completion_t http_request::Run(cluster* owner) {
+http_request_completion_t http_request::Run(cluster* owner, http_connection_pool* pool) {
 
 	http_request_completion_t rv;
 	double start = dpp::utility::time_f();
@@ -109,283 +390,858 @@ http_request_completion_t http_request::Run(cluster* owner) {
 		}
 	}
 
-	httplib::Client cli(_host.c_str());
-	/* This is for a reason :( - Some systems have really out of date cert stores */
-	cli.enable_server_certificate_verification(false);
-	cli.set_follow_location(true);
-
 	rv.ratelimit_limit = rv.ratelimit_remaining = rv.ratelimit_reset_after = rv.ratelimit_retry_after = 0;
+	rv.ratelimit_reset_after_precise = rv.ratelimit_retry_after_precise = 0;
 	rv.status = 0;
 	rv.latency = 0;
 	rv.ratelimit_global = false;
 
+	/* Headers are sent with each request rather than set as the client's defaults,
+	 * as pooled connections are shared by requests with different headers.
+	 */
+	httplib::Headers headers;
 	if (non_discord) {
 		/* Requests outside of Discord have their own headers an NEVER EVER send a bot token! */
-		httplib::Headers headers;
 		for (auto& r : req_headers) {
 			headers.emplace(r.first, r.second);
 		};
-		cli.set_default_headers(headers);
 	} else {
 		/* Always attach token and correct user agent when sending REST to Discord */
-		httplib::Headers headers = {
+		headers = {
 			{"Authorization", std::string("Bot ") + owner->token},
 			{"User-Agent", http_version}
 		};
 		if (!reason.empty()) {
 			headers.emplace("X-Audit-Log-Reason", reason);
 		}
-		cli.set_default_headers(headers);
 		if (!empty(parameters)) {
 			_url = endpoint + "/" +parameters;
 		}
 	}
 
+	httplib::Client* cli = nullptr;
+	std::unique_ptr<httplib::Client> own_cli;
+	if (pool) {
+		cli = pool->acquire(_host);
+	} else {
+		own_cli = std::make_unique<httplib::Client>(_host.c_str());
+		cli = own_cli.get();
+		/* This is for a reason :( - Some systems have really out of date cert stores */
+		cli->enable_server_certificate_verification(false);
+		cli->set_follow_location(true);
+		cli->set_address_resolver(resolve_through_cache);
+	}
+
+	/* Files for Discord are sent as a multipart body, streamed from the request's strings and files */
+	std::unique_ptr<multipart_body> multipart;
+	if (!non_discord && method != m_get && method != m_delete && ((!file_name.empty() && !file_content.empty()) || !uploads.empty())) {
+		multipart = std::make_unique<multipart_body>(*this);
+	}
+	auto provider = [&multipart](size_t offset, size_t, httplib::DataSink& sink) {
+		return multipart->provide(offset, sink);
+	};
+
 	/* Because of the design of cpp-httplib we can't create a httplib::Result once and make this code
 	 * shorter. We have to use "auto res = ...". This is because httplib::Result has no default constructor
 	 * and needs to be passed a result and some other blackboxed rammel.
 	 */
-	switch (method) {
-		case m_get: {
-			if (auto res = cli.Get(_url.c_str())) {
+	auto send = [&]() {
+		if (multipart) {
+			auto res = method == m_post ? cli->Post(_url.c_str(), headers, multipart->length, provider, multipart->content_type().c_str())
+				: method == m_patch ? cli->Patch(_url.c_str(), headers, multipart->length, provider, multipart->content_type().c_str())
+				: cli->Put(_url.c_str(), headers, multipart->length, provider, multipart->content_type().c_str());
+			if (res) {
 				rv.latency = dpp::utility::time_f() - start;
 				populate_result(_url, owner, rv, res);
 			} else {
 				rv.error = (http_error)res.error();
 			}
+			return;
 		}
-		break;
-		case m_post: {
-			/* POST supports post data body */
-			if (!file_name.empty() && !file_content.empty()) {
-				if (non_discord) {
-					/* Outside Discord just post a standard non-multipart POST body */
-					if (auto res = cli.Post(_url.c_str(), postdata, mimetype.c_str())) {
-						rv.latency = dpp::utility::time_f() - start;
-						populate_result(_url, owner, rv, res);
-					} else {
-						rv.error = (http_error)res.error();
-					}
+		switch (method) {
+			case m_get: {
+				if (auto res = cli->Get(_url.c_str(), headers)) {
+					rv.latency = dpp::utility::time_f() - start;
+					populate_result(_url, owner, rv, res);
 				} else {
-					/* Special multipart mime body for Discord */
-					httplib::MultipartFormDataItems items = {
-						{ "payload_json", postdata, "", mimetype.c_str() },
-						{ "file", file_content, file_name, "application/octet-stream" }
-					};
-					if (auto res = cli.Post(_url.c_str(), items)) {
-						rv.latency = dpp::utility::time_f() - start;
-						populate_result(_url, owner, rv, res);
-					} else {
-						rv.error = (http_error)res.error();
-					}
+					rv.error = (http_error)res.error();
 				}
-			} else {
-				/* Without a filename attached, use the same for both */
-				if (auto res = cli.Post(_url.c_str(), postdata, mimetype.c_str())) {
+			}
+			break;
+			case m_post: {
+				/* POST supports post data body. Outside Discord, files are not sent as a multipart body */
+				if (auto res = cli->Post(_url.c_str(), headers, postdata, mimetype.c_str())) {
 					rv.latency = dpp::utility::time_f() - start;
 					populate_result(_url, owner, rv, res);
 				} else {
 					rv.error = (http_error)res.error();
 				}
 			}
-		}
-		break;
-		case m_patch: {
-			if (auto res = cli.Patch(_url.c_str(), postdata.c_str(), mimetype.c_str())) {
-				rv.latency = dpp::utility::time_f() - start;
-				populate_result(_url, owner, rv, res);
-			} else {
-				rv.error = (http_error)res.error();
-			}
-		}
-		break;
-		case m_put: {
-			/* PUT supports post data body */
-			if (auto res = cli.Put(_url.c_str(), postdata.c_str(), mimetype.c_str())) {
-				rv.latency = dpp::utility::time_f() - start;
-				populate_result(_url, owner, rv, res);
-			} else {
-				rv.error = (http_error)res.error();
+			break;
+			case m_patch: {
+				if (auto res = cli->Patch(_url.c_str(), headers, postdata, mimetype.c_str())) {
+					rv.latency = dpp::utility::time_f() - start;
+					populate_result(_url, owner, rv, res);
+				} else {
+					rv.error = (http_error)res.error();
+				}
 			}
+			break;
+			case m_put: {
+				/* PUT supports post data body */
+				if (auto res = cli->Put(_url.c_str(), headers, postdata, mimetype.c_str())) {
+					rv.latency = dpp::utility::time_f() - start;
+					populate_result(_url, owner, rv, res);
+				} else {
+					rv.error = (http_error)res.error();
+				}
 
-		}
-		break;
-		case m_delete: {
-			if (auto res = cli.Delete(_url.c_str())) {
-				rv.latency = dpp::utility::time_f() - start;
-				populate_result(_url, owner, rv, res);
-			} else {
-				rv.error = (http_error)res.error();
 			}
+			break;
+			case m_delete: {
+				if (auto res = cli->Delete(_url.c_str(), headers)) {
+					rv.latency = dpp::utility::time_f() - start;
+					populate_result(_url, owner, rv, res);
+				} else {
+					rv.error = (http_error)res.error();
+				}
 
+			}
+			break;
 		}
-		break;
+	};
+
+	bool reused = cli->is_socket_open() > 0;
+	bool retried = false;
+	send();
+
+	/* The server may have closed a keep-alive connection while it sat idle in the pool, in which case
+	 * the request fails without a reply. Retry once on a new connection, unless it failed after it was
+	 * sent and isn't safe to send twice.
+	 */
+	if (reused && (rv.error == h_write || (rv.error == h_read && method != m_post && method != m_patch))) {
+		retried = true;
+		reused = false;
+		rv.error = h_success;
+		start = dpp::utility::time_f();
+		send();
 	}
+
+	if (pool) {
+		pool->record(reused, rv.error == h_success, rv.latency, retried);
+		pool->release(_host, cli);
+	}
+
 	/* Set completion flag */
 	completed = true;
 	return rv;
 }
 
-request_queue::request_queue(class cluster* owner) : creator(owner), terminating(false), globally_ratelimited(false), globally_limited_for(0)
+double latency_histogram::upper_bound(size_t bucket)
+{
+	/* Finer around the 3 second deadline of interaction responses */
+	static const double bounds[] = { 0.05, 0.1, 0.25, 0.5, 1, 1.5, 2, 2.5, 3, 5, 10 };
+	return bucket < sizeof(bounds) / sizeof(bounds[0]) ? bounds[bucket] : std::numeric_limits<double>::infinity();
+}
+
+void latency_histogram::add(double latency)
+{
+	size_t b = 0;
+	while (b < buckets.size() - 1 && latency > upper_bound(b)) {
+		b++;
+	}
+	buckets[b]++;
+	count++;
+	total += latency;
+	max = std::max(max, latency);
+}
+
+double latency_histogram::percentile(double p) const
+{
+	uint64_t seen = 0;
+	for (size_t b = 0; b < buckets.size(); ++b) {
+		seen += buckets[b];
+		if (count && seen >= p / 100.0 * count) {
+			return std::min(upper_bound(b), max);
+		}
+	}
+	return 0;
+}
+
+http_connection_pool::http_connection_pool(size_t max_idle_per_host, time_t idle_seconds)
+ : max_idle(max_idle_per_host), idle_timeout(idle_seconds), requests(0), connections_opened(0), connections_reused(0), retries(0), idle_closed(0),
+ new_latency_us(0), reused_latency_us(0), new_count(0), reused_count(0)
 {
-	in_thread = new std::thread(&request_queue::in_loop, this);
-	out_thread = new std::thread(&request_queue::out_loop, this);
+}
+
+http_connection_pool::~http_connection_pool()
+{
+	for (auto& host : idle) {
+		for (auto& c : host.second) {
+			delete c.client;
+		}
+	}
+}
+
+void http_connection_pool::configure(size_t max_idle_per_host, time_t idle_seconds)
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	max_idle = max_idle_per_host;
+	idle_timeout = idle_seconds;
+}
+
+httplib::Client* http_connection_pool::acquire(const std::string& host)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool_mutex);
+		auto h = idle.find(host);
+		if (h != idle.end() && !h->second.empty()) {
+			/* Take the most recently used, which is the least likely to have been closed by the server */
+			httplib::Client* c = h->second.back().client;
+			h->second.pop_back();
+			return c;
+		}
+	}
+	httplib::Client* c = new httplib::Client(host.c_str());
+	/* This is for a reason :( - Some systems have really out of date cert stores */
+	c->enable_server_certificate_verification(false);
+	c->set_follow_location(true);
+	c->set_keep_alive(true);
+	c->set_address_resolver(resolve_through_cache);
+	/* Requests are written in several pieces, which Nagle would hold back on a reused connection */
+	c->set_tcp_nodelay(true);
+	return c;
+}
+
+void http_connection_pool::release(const std::string& host, httplib::Client* client)
+{
+	if (client->is_socket_open()) {
+		std::lock_guard<std::mutex> lock(pool_mutex);
+		std::vector<idle_connection>& conns = idle[host];
+		if (conns.size() < max_idle) {
+			conns.push_back({client, time(nullptr)});
+			return;
+		}
+	}
+	/* Closed, or the pool for this host is full */
+	delete client;
+}
+
+void http_connection_pool::prune()
+{
+	std::vector<httplib::Client*> expired;
+	{
+		std::lock_guard<std::mutex> lock(pool_mutex);
+		time_t now = time(nullptr);
+		for (auto& host : idle) {
+			/* Connections are in order of last use, so the expired ones are at the front */
+			auto c = host.second.begin();
+			while (c != host.second.end() && now - c->last_used >= idle_timeout) {
+				expired.push_back(c->client);
+				++c;
+			}
+			host.second.erase(host.second.begin(), c);
+		}
+	}
+	/* Closing a TLS connection sends a close_notify, so do it outside the lock */
+	for (auto c : expired) {
+		delete c;
+	}
+	idle_closed += expired.size();
+}
+
+void http_connection_pool::record(bool reused, bool success, double latency, bool retried)
+{
+	requests++;
+	if (retried) {
+		retries++;
+	}
+	if (reused) {
+		connections_reused++;
+	} else {
+		connections_opened++;
+	}
+	if (success) {
+		uint64_t us = (uint64_t)(latency * 1000000.0);
+		if (reused) {
+			reused_latency_us += us;
+			reused_count++;
+		} else {
+			new_latency_us += us;
+			new_count++;
+		}
+	}
+}
+
+http_pool_stats http_connection_pool::get_stats()
+{
+	http_pool_stats s;
+	s.requests = requests;
+	s.connections_opened = connections_opened;
+	s.connections_reused = connections_reused;
+	s.retries = retries;
+	s.idle_closed = idle_closed;
+	uint64_t n = new_count, r = reused_count;
+	s.new_connection_latency = n ? (double)new_latency_us / n / 1000000.0 : 0;
+	s.reused_connection_latency = r ? (double)reused_latency_us / r / 1000000.0 : 0;
+	return s;
+}
+
+request_queue::request_queue(class cluster* owner, uint32_t request_threads, uint32_t completion_threads, bool ordered) : creator(owner), ordered_completions(ordered), ratelimits_avoided(0), ratelimits_received(0), ratelimits_retried(0), live_requests(0), live_completions(0), live_bytes(0), high_water_bytes(0), cache_ttl(0), cache_pruned_at(0), gets_coalesced(0), cache_hits(0), terminating(false), globally_ratelimited(false), globally_limited_until(0)
+{
+	ordered_out.resize(std::max(completion_threads, (uint32_t)1));
+	for (uint32_t i = 0; i < std::max(request_threads, (uint32_t)1); ++i) {
+		in_threads.push_back(new std::thread(&request_queue::in_loop, this, false));
+	}
+	in_threads.push_back(new std::thread(&request_queue::in_loop, this, true));
+	for (size_t i = 0; i < ordered_out.size(); ++i) {
+		out_threads.push_back(new std::thread(&request_queue::out_loop, this, i));
+	}
 }
 
 request_queue::~request_queue()
 {
 	creator->log(ll_debug, "REST request_queue shutting down");
-	terminating = true;
-	in_ready.notify_one();
-	out_ready.notify_one();
-	in_thread->join();
-	out_thread->join();
-	delete in_thread;
-	delete out_thread;
+	{
+		std::lock_guard<std::mutex> lock(in_mutex);
+		std::lock_guard<std::mutex> out_lock(out_mutex);
+		terminating = true;
+	}
+	in_ready.notify_all();
+	fast_ready.notify_all();
+	out_ready.notify_all();
+	for (auto t : in_threads) {
+		t->join();
+		delete t;
+	}
+	for (auto t : out_threads) {
+		t->join();
+		delete t;
+	}
+	/* Requests which never got as far as their callback */
+	for (auto& q : requests_in) {
+		for (auto req : q.second.requests) {
+			delete req;
+		}
+	}
+	for (auto& c : coalescing) {
+		for (auto req : c.second) {
+			delete req;
+		}
+	}
+	for (auto& c : responses_out) {
+		delete c.request;
+	}
+	for (auto& o : ordered_out) {
+		for (auto& c : o) {
+			delete c.request;
+		}
+	}
 }
 
-void request_queue::in_loop()
+/* Approximate heap footprint of a request and of a reply, for queue_memory_stats */
+static uint64_t footprint(const http_request* req)
 {
-	while (!terminating) {
-		std::mutex mtx;
-		std::unique_lock<std::mutex> lock{ mtx };			
-		in_ready.wait_for(lock, std::chrono::seconds(1));
-		/* New request to be sent! */
+	uint64_t bytes = sizeof(http_request) + req->endpoint.capacity() + req->parameters.capacity() + req->postdata.capacity() + req->reason.capacity() + req->file_name.capacity() + req->file_content.capacity();
+	for (auto& u : req->uploads) {
+		/* Files read from elsewhere as they are sent don't count */
+		bytes += sizeof(http_upload) + (u.content ? u.content->capacity() : 0);
+	}
+	return bytes;
+}
 
-		if (!globally_ratelimited) {
+static uint64_t footprint(const http_request_completion_t& rv)
+{
+	uint64_t bytes = rv.body.capacity() + rv.ratelimit_bucket.capacity();
+	for (auto& h : rv.headers) {
+		bytes += h.first.capacity() + h.second.capacity();
+	}
+	return bytes;
+}
 
-			std::map<std::string, std::vector<http_request*>> requests_in_copy;
-			{
-				/* Make a safe copy within a mutex */
-				std::lock_guard<std::mutex> lock(in_mutex);	
-				requests_in_copy = requests_in;
+void request_queue::add_bytes(uint64_t bytes)
+{
+	uint64_t now = (live_bytes += bytes);
+	uint64_t high = high_water_bytes;
+	while (now > high && !high_water_bytes.compare_exchange_weak(high, now));
+}
+
+timer_wheel::timer_wheel(size_t slot_count, double tick_seconds) : slots(slot_count), tick(tick_seconds), current(0), count(0)
+{
+}
+
+size_t timer_wheel::slot_for(uint64_t tick_number) const
+{
+	return tick_number % slots.size();
+}
+
+void timer_wheel::add(const std::string& key, double when)
+{
+	uint64_t t = (uint64_t)(when / tick);
+	if (count == 0) {
+		/* Nothing is waiting, so there are no slots to pass over before this one */
+		current = t;
+	}
+	/* Anything already due goes in the next slot to be collected */
+	slots[slot_for(std::max(t, current))].emplace_back(when, key);
+	count++;
+}
+
+void timer_wheel::collect(double now, std::deque<std::string>& due)
+{
+	uint64_t end = (uint64_t)(now / tick);
+	while (count && current < end) {
+		auto& slot = slots[slot_for(current)];
+		for (size_t i = 0; i < slot.size();) {
+			/* Keys due in a later turn of the wheel stay put */
+			if ((uint64_t)(slot[i].first / tick) <= current) {
+				due.emplace_back(std::move(slot[i].second));
+				slot[i] = std::move(slot.back());
+				slot.pop_back();
+				count--;
+			} else {
+				++i;
 			}
+		}
+		current++;
+	}
+}
 
-			for (auto & bucket : requests_in_copy) {
-				for (auto req : bucket.second) {
-
-					http_request_completion_t rv;
-					auto currbucket = buckets.find(bucket.first);
-
-					if (currbucket != buckets.end()) {
-						/* There's a bucket for this request. Check its status. If the bucket says to wait,
-						* skip all requests in this bucket till its ok.
-						*/
-						if (currbucket->second.remaining < 1) {
-							uint64_t wait = (currbucket->second.retry_after ? currbucket->second.retry_after : currbucket->second.reset_after);
-							if ((uint64_t)time(nullptr) > currbucket->second.timestamp + wait) {
-								/* Time has passed, we can process this bucket again. send its request. */
-								rv = req->Run(creator);
-							} else {
-								/* Time not up yet, emit signal and wait */
-								std::this_thread::sleep_for(std::chrono::milliseconds(50));
-								in_ready.notify_one();
-								break;
-							}
-						} else {
-							/* There's limit remaining, we can just run the request */
-							rv = req->Run(creator);
-						}
-					} else {
-						/* No bucket for this endpoint yet. Just send it, and make one from its reply */
-						rv = req->Run(creator);
-					}
+double timer_wheel::next_tick() const
+{
+	return count ? (current + 1) * tick : 0;
+}
 
-					bucket_t newbucket;
-					newbucket.limit = rv.ratelimit_limit;
-					newbucket.remaining = rv.ratelimit_remaining;
-					newbucket.reset_after = rv.ratelimit_reset_after;
-					newbucket.retry_after = rv.ratelimit_retry_after;
-					newbucket.timestamp = time(NULL);
-					globally_ratelimited = rv.ratelimit_global;
-					if (globally_ratelimited) {
-						globally_limited_for = (newbucket.retry_after ? newbucket.retry_after : newbucket.reset_after);
-					}
-					buckets[req->endpoint] = newbucket;
-
-					/* Make a new entry in the completion list and notify */
-					{
-						std::lock_guard<std::mutex> lock(out_mutex);
-						http_request_completion_t* hrc = new http_request_completion_t();
-						*hrc = rv;
-						responses_out.push(std::make_pair(hrc, req));
-						out_ready.notify_one();
-					}
-				}
+size_t timer_wheel::size() const
+{
+	return count;
+}
+
+std::string request_queue::bucket_for(const std::string& key, const route_queue& q)
+{
+	auto rb = route_buckets.find(q.route);
+	if (rb == route_buckets.end()) {
+		return key;
+	}
+	return rb->second + ":" + q.major;
+}
+
+void request_queue::make_ready(std::string&& key)
+{
+	auto q = requests_in.find(key);
+	if (q != requests_in.end()) {
+		ready[q->second.priority].push_back(std::move(key));
+	}
+}
+
+http_request* request_queue::next_request(double now, std::string& key, std::string& bucket, http_priority lowest)
+{
+	waiting.collect(now, due);
+	for (auto& k : due) {
+		make_ready(std::move(k));
+	}
+	due.clear();
+	int lane = hp_interaction;
+	while (lane <= lowest) {
+		if (ready[lane].empty()) {
+			/* Only move on to the next lane once everything in this one has been sent or put aside */
+			lane++;
+			continue;
+		}
+		std::string k = std::move(ready[lane].front());
+		ready[lane].pop_front();
+		auto q = requests_in.find(k);
+		if (q == requests_in.end()) {
+			continue;
+		}
+		if (q->second.requests.empty()) {
+			requests_in.erase(q);
+			continue;
+		}
+		std::string b = bucket_for(k, q->second);
+		/* Another worker is sending a request in this bucket. The next one must wait for its reply. */
+		if (busy_buckets.find(b) != busy_buckets.end()) {
+			parked[b].push_back(k);
+			continue;
+		}
+		auto currbucket = buckets.find(b);
+		if (currbucket != buckets.end() && currbucket->second.remaining < 1 && now < currbucket->second.reset_at) {
+			/* The bucket is used up. Sending now would just get a 429, so wait for it to reset. */
+			held_buckets.insert(b);
+			waiting.add(k, currbucket->second.reset_at);
+			continue;
+		}
+		/* There's limit remaining, the bucket has reset, or we don't know of a limit for it yet */
+		if (held_buckets.erase(b)) {
+			ratelimits_avoided++;
+		}
+		http_request* req = q->second.requests.front();
+		q->second.requests.pop_front();
+		key = k;
+		bucket = b;
+		if (q->second.requests.empty()) {
+			requests_in.erase(q);
+		} else {
+			/* The rest of the queue waits for this request's reply */
+			parked[b].push_back(k);
+		}
+		return req;
+	}
+	return nullptr;
+}
+
+void request_queue::prune_buckets()
+{
+	/* A bucket which reset a while ago tells us nothing we won't learn from the next reply */
+	double now = dpp::utility::time_f();
+	for (auto b = buckets.begin(); b != buckets.end();) {
+		if (now > b->second.reset_at + 60 && busy_buckets.find(b->first) == busy_buckets.end()) {
+			held_buckets.erase(b->first);
+			b = buckets.erase(b);
+		} else {
+			++b;
+		}
+	}
+}
+
+void request_queue::prune_cache()
+{
+	double now = dpp::utility::time_f();
+	cache_pruned_at = now;
+	for (auto c = response_cache.begin(); c != response_cache.end();) {
+		if (now >= c->second.expires) {
+			c = response_cache.erase(c);
+		} else {
+			++c;
+		}
+	}
+}
+
+/* The url a request is made to, which identifies identical requests */
+static std::string request_url(const http_request* req)
+{
+	return req->parameters.empty() ? req->endpoint : req->endpoint + "/" + req->parameters;
+}
+
+/* GETs can share a reply if nothing but the url sets them apart. Requests to Discord all have the same headers. */
+static bool coalescable(const http_request* req)
+{
+	return req->method == m_get && req->postdata.empty() && req->req_headers.empty();
+}
+
+void request_queue::invalidate_cache(const std::string& url)
+{
+	std::string path = url.substr(0, url.find('?'));
+	/* The url itself, with any query, and the urls below it all sort together after it */
+	for (auto c = response_cache.lower_bound(path); c != response_cache.end() && c->first.compare(0, path.length(), path) == 0;) {
+		char next = c->first.length() > path.length() ? c->first[path.length()] : '/';
+		if (next == '/' || next == '?') {
+			c = response_cache.erase(c);
+		} else {
+			++c;
+		}
+	}
+	/* If it is one object of a collection, e.g. a member, then the collection too. Nothing
+	 * further up, so a new message doesn't drop the channel, nor a member change the guild.
+	 */
+	size_t slash = path.rfind('/');
+	if (slash == std::string::npos || slash == 0) {
+		return;
+	}
+	std::string last = path.substr(slash + 1);
+	if (last == "@me" || (!last.empty() && std::all_of(last.begin(), last.end(), [](unsigned char c) { return isdigit(c); }))) {
+		std::string parent = path.substr(0, slash);
+		response_cache.erase(parent);
+		std::string q = parent + "?";
+		for (auto c = response_cache.lower_bound(q); c != response_cache.end() && c->first.compare(0, q.length(), q) == 0;) {
+			c = response_cache.erase(c);
+		}
+	}
+}
+
+void request_queue::complete_request(http_request* req, http_request_completion_t&& rv, const std::string& major)
+{
+	latencies[req->priority].add(dpp::utility::time_f() - req->queued_at);
+	add_bytes(footprint(rv));
+	live_completions++;
+	std::lock_guard<std::mutex> lock(out_mutex);
+	if (ordered_completions && !major.empty() && ordered_out.size() > 1) {
+		/* Completions for the same channel, guild or webhook always go to the same thread */
+		ordered_out[std::hash<std::string>()(major) % ordered_out.size()].push_back({req, std::move(rv)});
+		out_ready.notify_all();
+	} else {
+		responses_out.push_back({req, std::move(rv)});
+		out_ready.notify_one();
+	}
+}
+
+void request_queue::in_loop(bool fast)
+{
+	std::condition_variable& wakeup = fast ? fast_ready : in_ready;
+	std::unique_lock<std::mutex> lock(in_mutex);
+	while (!terminating) {
+		double now = dpp::utility::time_f();
+
+		/* Interaction endpoints aren't bound by the global rate limit, so the interaction lane's worker carries on */
+		if (globally_ratelimited && !fast) {
+			if (now < globally_limited_until) {
+				in_ready.wait_for(lock, std::chrono::microseconds((int64_t)((globally_limited_until - now) * 1000000.0) + 1));
+				continue;
 			}
+			globally_ratelimited = false;
+		}
 
-			{
-				std::lock_guard<std::mutex> lock(in_mutex);
-				bool again = false;
-				do {
-					again = false;
-					for (auto & bucket : requests_in) {
-						for (auto req = bucket.second.begin(); req != bucket.second.end(); ++req) {
-							if ((*req)->is_completed()) {
-								requests_in[bucket.first].erase(req);
-								again = true;
-								goto out;	/* Only clean way out of a nested loop */
-							}
-						}
-					}
-					out:;
-				} while (again);
+		std::string key, bucket;
+		http_request* req = next_request(now, key, bucket, fast ? hp_interaction : hp_bulk);
+		if (!req) {
+			/* Nothing can be sent yet; sleep until a request is posted, a bucket is freed, or a limit resets */
+			double next_ready = now + 1;
+			if (waiting.size()) {
+				next_ready = std::min(next_ready, waiting.next_tick());
+			}
+			if (wakeup.wait_for(lock, std::chrono::microseconds((int64_t)((next_ready - now) * 1000000.0) + 1)) == std::cv_status::timeout) {
+				prune_buckets();
+				prune_cache();
+				lock.unlock();
+				pool.prune();
+				lock.lock();
+			}
+			continue;
+		}
+
+		/* New request to be sent! */
+		busy_buckets.insert(bucket);
+		lock.unlock();
+
+		http_request_completion_t rv = req->Run(creator, &pool);
+
+		std::string route, major;
+		get_route(req, key, route, major);
+
+		lock.lock();
+		now = dpp::utility::time_f();
+		busy_buckets.erase(bucket);
+		auto p = parked.find(bucket);
+		if (p != parked.end()) {
+			/* Queues waiting on this bucket can try again */
+			for (auto& k : p->second) {
+				make_ready(std::move(k));
 			}
+			parked.erase(p);
+		}
+		if (!rv.ratelimit_bucket.empty()) {
+			/* Now we know which bucket this route shares, later requests will be counted against it */
+			route_buckets[route] = rv.ratelimit_bucket;
+			bucket = rv.ratelimit_bucket + ":" + major;
+		}
+		if (!rv.ratelimit_bucket.empty() || rv.status == 429) {
+			bucket_t newbucket;
+			newbucket.limit = rv.ratelimit_limit;
+			newbucket.remaining = rv.status == 429 ? 0 : rv.ratelimit_remaining;
+			newbucket.reset_after = rv.ratelimit_reset_after_precise;
+			newbucket.retry_after = rv.ratelimit_retry_after_precise;
+			newbucket.timestamp = time(NULL);
+			newbucket.reset_at = now + (rv.ratelimit_retry_after_precise ? rv.ratelimit_retry_after_precise : rv.ratelimit_reset_after_precise);
+			if (rv.ratelimit_global) {
+				/* A global 429 says nothing about this bucket */
+				newbucket.remaining = std::max(rv.ratelimit_remaining, (uint64_t)1);
+				globally_ratelimited = true;
+				globally_limited_until = newbucket.reset_at;
+			}
+			buckets[bucket] = newbucket;
+		}
 
+		if (rv.status == 429) {
+			ratelimits_received++;
+		}
+		/* Send a rate limited request again once its bucket resets, if it came from Discord */
+		if (rv.status == 429 && (!rv.ratelimit_bucket.empty() || rv.ratelimit_global) && req->ratelimit_retries < 3) {
+			req->ratelimit_retries++;
+			ratelimits_retried++;
+			route_queue& q = requests_in[key];
+			q.route = route;
+			q.major = major;
+			q.requests.push_front(req);
+			q.priority = std::min(q.priority, req->priority);
+			if (!q.scheduled) {
+				q.scheduled = true;
+				ready[q.priority].push_back(key);
+			}
 		} else {
-			if (globally_limited_for > 0) {
-				std::this_thread::sleep_for(std::chrono::seconds(globally_limited_for));
-				globally_limited_for = 0;
+			if (coalescable(req)) {
+				std::string url = request_url(req);
+				auto c = coalescing.find(url);
+				if (c != coalescing.end()) {
+					/* Identical GETs posted while this one was in flight get a copy of its reply */
+					for (auto follower : c->second) {
+						follower->completed = true;
+						http_request_completion_t copy = rv;
+						complete_request(follower, std::move(copy), major);
+					}
+					coalescing.erase(c);
+				}
+				if (cache_ttl > 0 && rv.error == h_success && rv.status >= 200 && rv.status < 300) {
+					/* The workers may be too busy to ever time out and prune the cache while waiting */
+					if (now - cache_pruned_at > 1) {
+						prune_cache();
+					}
+					response_cache[url] = {now + cache_ttl, rv};
+				}
+			} else if (req->method != m_get && !response_cache.empty()) {
+				/* A GET may have been answered while this request was in flight, from before it made its change */
+				invalidate_cache(request_url(req));
 			}
-			globally_ratelimited = false;
-			in_ready.notify_one();
+			/* Move the reply into the completion list and notify */
+			complete_request(req, std::move(rv), major);
 		}
+
+		/* The next request in this bucket, and any other queues sharing it, can go now */
+		in_ready.notify_all();
+		fast_ready.notify_all();
 	}
 	creator->log(ll_debug, "REST in-queue shutting down");
 }
 
-void request_queue::out_loop()
+void request_queue::out_loop(size_t index)
 {
+	std::unique_lock<std::mutex> lock(out_mutex);
+	auto& mine = ordered_out[index];
 	while (!terminating) {
 
-		std::mutex mtx;
-		std::unique_lock<std::mutex> lock{ mtx };			
-		out_ready.wait_for(lock, std::chrono::seconds(1));
-		time_t now = time(nullptr);
+		if (mine.empty() && responses_out.empty()) {
+			out_ready.wait_for(lock, std::chrono::seconds(1));
+		}
 
-		/* A request has been completed! */
-		std::pair<http_request_completion_t*, http_request*> queue_head = {};
-		{
-			std::lock_guard<std::mutex> lock(out_mutex);
-			if (responses_out.size()) {
-				queue_head = responses_out.front();
-				responses_out.pop();
+		/* Call every completion that's ready, not just one per wakeup. Our own ordered
+		 * completions come first, as no other thread can take them.
+		 */
+		while (!terminating && (!mine.empty() || !responses_out.empty())) {
+			auto& from = mine.empty() ? responses_out : mine;
+			{
+				completion c = std::move(from.front());
+				from.pop_front();
+				lock.unlock();
+				{
+					epoch_guard pin;
+					c.request->complete(c.result);
+				}
+				/* Nothing refers to the request or its reply once the callback has returned, so free both now */
+				live_bytes -= footprint(c.request) + footprint(c.result);
+				live_requests--;
+				live_completions--;
+				delete c.request;
 			}
+			lock.lock();
 		}
+	}
+	creator->log(ll_debug, "REST out-queue shutting down");
+}
 
-		if (queue_head.first && queue_head.second) {
-			queue_head.second->complete(*queue_head.first);
-		}
+void request_queue::set_pool(size_t max_idle_per_host, time_t idle_seconds)
+{
+	pool.configure(max_idle_per_host, idle_seconds);
+}
 
-		/* Queue deletions for 60 seconds from now */
-		responses_to_delete.insert(std::make_pair(now + 60, queue_head));
+http_pool_stats request_queue::get_pool_stats()
+{
+	return pool.get_stats();
+}
 
-		/* Check for deletable items every second regardless of select status */
-		while (responses_to_delete.size() && now >= responses_to_delete.begin()->first) {
-			delete responses_to_delete.begin()->second.first;
-			delete responses_to_delete.begin()->second.second;
-			responses_to_delete.erase(responses_to_delete.begin());
-		}
+ratelimit_stats request_queue::get_ratelimit_stats()
+{
+	ratelimit_stats s;
+	s.avoided = ratelimits_avoided;
+	s.received = ratelimits_received;
+	s.retried = ratelimits_retried;
+	std::lock_guard<std::mutex> lock(in_mutex);
+	s.buckets = buckets.size();
+	return s;
+}
+
+latency_histogram request_queue::get_latency_stats(http_priority lane)
+{
+	std::lock_guard<std::mutex> lock(in_mutex);
+	return latencies.at(lane);
+}
+
+void request_queue::set_response_cache(double ttl_seconds)
+{
+	std::lock_guard<std::mutex> lock(in_mutex);
+	cache_ttl = ttl_seconds;
+	if (cache_ttl <= 0) {
+		response_cache.clear();
 	}
-	creator->log(ll_debug, "REST out-queue shutting down");
+}
+
+coalesce_stats request_queue::get_coalesce_stats()
+{
+	coalesce_stats s;
+	s.coalesced = gets_coalesced;
+	s.cache_hits = cache_hits;
+	std::lock_guard<std::mutex> lock(in_mutex);
+	s.cache_entries = response_cache.size();
+	return s;
+}
+
+queue_memory_stats request_queue::get_memory_stats()
+{
+	queue_memory_stats s;
+	s.requests = live_requests;
+	s.completions = live_completions;
+	s.bytes = live_bytes;
+	s.high_water_bytes = high_water_bytes;
+	return s;
 }
 
 /* Post a http_request into the queue */
 void request_queue::post_request(http_request* req)
 {
+	std::string key, route, major;
+	get_route(req, key, route, major);
+	add_bytes(footprint(req));
+	live_requests++;
+	if (!req->queued_at) {
+		req->queued_at = dpp::utility::time_f();
+	}
 	std::lock_guard<std::mutex> lock(in_mutex);
-	requests_in[req->endpoint].push_back(req);
-	in_ready.notify_one();
+	if (coalescable(req)) {
+		std::string url = request_url(req);
+		auto c = response_cache.find(url);
+		if (c != response_cache.end()) {
+			if (req->queued_at < c->second.expires) {
+				cache_hits++;
+				req->completed = true;
+				http_request_completion_t copy = c->second.result;
+				complete_request(req, std::move(copy), major);
+				return;
+			}
+			response_cache.erase(c);
+		}
+		auto f = coalescing.find(url);
+		if (f != coalescing.end()) {
+			/* An identical GET is already queued or in flight, this one will get a copy of its reply */
+			gets_coalesced++;
+			f->second.push_back(req);
+			return;
+		}
+		coalescing.emplace(url, std::vector<http_request*>());
+	} else if (req->method != m_get && !response_cache.empty()) {
+		/* Later GETs must not be answered from before this request's change */
+		invalidate_cache(request_url(req));
+	}
+	route_queue& q = requests_in[key];
+	q.route = route;
+	q.major = major;
+	q.requests.push_back(req);
+	q.priority = std::min(q.priority, req->priority);
+	if (!q.scheduled) {
+		q.scheduled = true;
+		ready[q.priority].push_back(key);
+		in_ready.notify_one();
+		if (q.priority == hp_interaction) {
+			fast_ready.notify_one();
+		}
+	}
 }
 
 std::string url_encode(const std::string &value) {
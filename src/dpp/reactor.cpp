@@ -0,0 +1,524 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * Copyright 2021 Craig Edwards and D++ contributors 
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+#include <errno.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <dpp/reactor.h>
+#include <dpp/sslclient.h>
+#include <dpp/discord.h>
+#include <dpp/dispatcher.h>
+#include <dpp/fmt/format.h>
+
+namespace dpp {
+
+#ifdef __linux__
+
+/**
+ * @brief A thread of a reactor, with its own epoll instance
+ */
+class reactor_thread {
+	/**
+	 * @brief A connection handled by the thread
+	 */
+	struct connection {
+		/** Called when the connection ends */
+		reactor_disconnect_t on_disconnect;
+		/** Socket of the connection, as it was when it was added */
+		int fd = -1;
+		/** Events watched on fd */
+		uint32_t events = 0;
+		/** File descriptors from custom_readable_fd and custom_writeable_fd, and the events watched on them */
+		std::map<int, uint32_t> custom;
+	};
+
+	/** Connections, by client */
+	std::unordered_map<ssl_client*, connection> connections;
+	/** Owner of each watched file descriptor */
+	std::unordered_map<int, ssl_client*> owners;
+
+	/** Protects adding and removing */
+	std::mutex mutex;
+	/** Notified when connections are removed */
+	std::condition_variable removed;
+	/** Connections to add, from other threads */
+	std::vector<std::pair<ssl_client*, reactor_disconnect_t>> adding;
+	/** Connections to remove, from other threads */
+	std::vector<ssl_client*> removing;
+
+	/** The thread */
+	std::thread runner;
+	/** True when the thread should exit */
+	std::atomic<bool> terminating;
+
+	/* Watch, change or stop watching a file descriptor. Events of 0 means stop watching. */
+	void watch(int fd, uint32_t old_events, uint32_t new_events);
+	/* Update watched events from the client's state */
+	void sync(ssl_client* client, connection& c);
+	/* Remove a connection from the thread, optionally calling its on_disconnect */
+	void detach(ssl_client* client, bool disconnected);
+	/* Handle adds and removes from other threads */
+	void handle_requests();
+	/* The thread's loop */
+	void run();
+
+public:
+	/** epoll instance */
+	int epoll_fd;
+	/** eventfd used to wake the thread */
+	int wake_fd;
+	/** Number of connections on the thread, including ones waiting to be added */
+	std::atomic<size_t> count;
+
+	reactor_thread();
+	~reactor_thread();
+
+	/* Queue a connection to be added */
+	void add(ssl_client* client, reactor_disconnect_t on_disconnect);
+	/* Remove a connection, waiting for the thread to let go of it. Returns false if the
+	 * connection moved to another thread instead, so needs removing from there.
+	 */
+	bool remove(ssl_client* client);
+	/* Wake the thread from epoll_wait */
+	void wake();
+};
+
+reactor_thread::reactor_thread() : terminating(false), epoll_fd(-1), wake_fd(-1), count(0)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		throw dpp::exception(fmt::format("Can't create epoll instance: {}", strerror(errno)));
+	}
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd == -1) {
+		::close(epoll_fd);
+		throw dpp::exception(fmt::format("Can't create eventfd: {}", strerror(errno)));
+	}
+	watch(wake_fd, 0, EPOLLIN);
+	runner = std::thread(&reactor_thread::run, this);
+}
+
+reactor_thread::~reactor_thread()
+{
+	terminating = true;
+	wake();
+	runner.join();
+	::close(wake_fd);
+	::close(epoll_fd);
+}
+
+void reactor_thread::wake()
+{
+	uint64_t one = 1;
+	if (::write(wake_fd, &one, sizeof(one)) < 0) {
+		/* The counter is already non-zero, so the thread will wake anyway */
+	}
+}
+
+void reactor_thread::add(ssl_client* client, reactor_disconnect_t on_disconnect)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		client->io_thread = this;
+		adding.emplace_back(client, on_disconnect);
+	}
+	wake();
+}
+
+bool reactor_thread::remove(ssl_client* client)
+{
+	if (std::this_thread::get_id() == runner.get_id()) {
+		/* Called from one of our own handlers, so there is no need to wait */
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto i = adding.begin(); i != adding.end(); ++i) {
+				if (i->first == client) {
+					adding.erase(i);
+					count--;
+					client->io_thread = nullptr;
+					return true;
+				}
+			}
+		}
+		detach(client, false);
+		return true;
+	}
+	std::unique_lock<std::mutex> lock(mutex);
+	if (client->io_thread == this) {
+		removing.push_back(client);
+		wake();
+		removed.wait(lock, [this, client]() { return client->io_thread != this; });
+	}
+	return client->io_thread == nullptr;
+}
+
+void reactor_thread::watch(int fd, uint32_t old_events, uint32_t new_events)
+{
+	if (old_events == new_events || fd < 0) {
+		return;
+	}
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = new_events;
+	ev.data.fd = fd;
+	if (new_events == 0) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+	} else if (old_events == 0) {
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1 && errno == EEXIST) {
+			epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+		}
+	} else if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1 && errno == ENOENT) {
+		/* A file descriptor which was closed and reopened is no longer in the epoll set */
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+	}
+}
+
+void reactor_thread::sync(ssl_client* client, connection& c)
+{
+	uint32_t events = EPOLLIN | (client->wants_write() ? (uint32_t)EPOLLOUT : 0);
+	watch(c.fd, c.events, events);
+	c.events = events;
+
+	if (!client->custom_readable_fd && !client->custom_writeable_fd && c.custom.empty()) {
+		return;
+	}
+	/* The custom file descriptors can change at any time, e.g. once voice is connected */
+	std::map<int, uint32_t> custom;
+	if (client->custom_readable_fd) {
+		int fd = (int)client->custom_readable_fd();
+		if (fd >= 0 && fd != c.fd) {
+			custom[fd] |= EPOLLIN;
+		}
+	}
+	if (client->custom_writeable_fd) {
+		int fd = (int)client->custom_writeable_fd();
+		if (fd >= 0 && fd != c.fd) {
+			custom[fd] |= EPOLLOUT;
+		}
+	}
+	for (auto& w : c.custom) {
+		if (custom.find(w.first) == custom.end()) {
+			watch(w.first, w.second, 0);
+			owners.erase(w.first);
+		}
+	}
+	for (auto& w : custom) {
+		auto old = c.custom.find(w.first);
+		watch(w.first, old == c.custom.end() ? 0 : old->second, w.second);
+		owners[w.first] = client;
+	}
+	c.custom = custom;
+}
+
+void reactor_thread::detach(ssl_client* client, bool disconnected)
+{
+	auto i = connections.find(client);
+	if (i == connections.end()) {
+		return;
+	}
+	connection& c = i->second;
+	watch(c.fd, c.events, 0);
+	owners.erase(c.fd);
+	for (auto& w : c.custom) {
+		watch(w.first, w.second, 0);
+		owners.erase(w.first);
+	}
+	reactor_disconnect_t on_disconnect = c.on_disconnect;
+	connections.erase(i);
+	count--;
+	/* io_thread still points here while the callback runs, so a remove() from another thread,
+	 * e.g. when the connection is being destroyed, waits for the callback to return
+	 */
+	if (disconnected && on_disconnect) {
+		on_disconnect();
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto removal = std::find(removing.begin(), removing.end(), client);
+		auto readded = std::find_if(adding.begin(), adding.end(), [client](const auto& a) { return a.first == client; });
+		if (removal != removing.end() && readded != adding.end()) {
+			/* The callback added the connection back, but it was removed meanwhile, which wins */
+			adding.erase(readded);
+			count--;
+			readded = adding.end();
+		}
+		if (readded == adding.end() && client->io_thread == this) {
+			client->io_thread = nullptr;
+		}
+		removing.erase(std::remove(removing.begin(), removing.end(), client), removing.end());
+	}
+	removed.notify_all();
+}
+
+void reactor_thread::handle_requests()
+{
+	std::vector<std::pair<ssl_client*, reactor_disconnect_t>> to_add;
+	std::vector<ssl_client*> to_remove;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		to_add.swap(adding);
+		to_remove.swap(removing);
+	}
+	for (auto& a : to_add) {
+		ssl_client* client = a.first;
+		connection& c = connections[client];
+		c.on_disconnect = a.second;
+		c.fd = (int)client->sfd;
+		try {
+			client->set_nonblocking();
+		}
+		catch (const std::exception &e) {
+			client->log(ll_warning, fmt::format("Read loop ended: {}", e.what()));
+			detach(client, true);
+			continue;
+		}
+		owners[c.fd] = client;
+		sync(client, c);
+	}
+	for (auto client : to_remove) {
+		detach(client, false);
+	}
+}
+
+void reactor_thread::run()
+{
+	const int max_events = 128;
+	epoll_event events[max_events];
+	std::vector<ssl_client*> ended, timed;
+
+	while (!terminating) {
+		handle_requests();
+
+		/* Wake up for the next second's timers, or in 50ms if there are custom file descriptors to keep up with */
+		bool custom = false;
+		for (auto& c : connections) {
+			sync(c.first, c.second);
+			custom = custom || c.first->custom_readable_fd || c.first->custom_writeable_fd;
+		}
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		int timeout = 1000 - (int)(std::chrono::duration_cast<std::chrono::milliseconds>(now).count() % 1000);
+		if (custom && timeout > 50) {
+			timeout = 50;
+		}
+
+		int n = epoll_wait(epoll_fd, events, max_events, timeout);
+		if (n < 0) {
+			/* Interrupted by a signal */
+			n = 0;
+		}
+
+		ended.clear();
+		for (int e = 0; e < n; ++e) {
+			int fd = events[e].data.fd;
+			uint32_t ev = events[e].events;
+			if (fd == wake_fd) {
+				uint64_t value;
+				if (::read(wake_fd, &value, sizeof(value)) < 0) {
+					/* Already cleared */
+				}
+				continue;
+			}
+			/* The owner may have gone during this batch of events */
+			auto o = owners.find(fd);
+			if (o == owners.end()) {
+				continue;
+			}
+			ssl_client* client = o->second;
+			connection& c = connections[client];
+			try {
+				if (fd == c.fd) {
+					if (ev & EPOLLERR) {
+						client->log(dpp::ll_error, fmt::format("Error on SSL connection: {}", strerror(errno)));
+						ended.push_back(client);
+					} else if (!client->handle_io(ev & (EPOLLIN | EPOLLHUP), ev & EPOLLOUT) || (ev & EPOLLHUP)) {
+						ended.push_back(client);
+					}
+				} else {
+					if ((ev & EPOLLOUT) && client->custom_writeable_fd && client->custom_writeable_fd() == fd) {
+						client->custom_writeable_ready();
+					}
+					if ((ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) && client->custom_readable_fd && client->custom_readable_fd() == fd) {
+						client->custom_readable_ready();
+					}
+				}
+			}
+			catch (const std::exception &e) {
+				client->log(ll_warning, fmt::format("Read loop ended: {}", e.what()));
+				ended.push_back(client);
+			}
+		}
+		for (auto client : ended) {
+			detach(client, true);
+		}
+
+		/* Once a second timers. Handlers may remove connections, so work from a copy of the list. */
+		time_t t = time(nullptr);
+		timed.clear();
+		for (auto& c : connections) {
+			if (c.first->last_tick != t) {
+				timed.push_back(c.first);
+			}
+		}
+		ended.clear();
+		for (auto client : timed) {
+			auto c = connections.find(client);
+			if (c == connections.end()) {
+				continue;
+			}
+			try {
+				client->one_second_timer();
+				client->last_tick = t;
+				if ((int)client->sfd != c->second.fd) {
+					ended.push_back(client);
+				}
+			}
+			catch (const std::exception &e) {
+				client->log(ll_warning, fmt::format("Read loop ended: {}", e.what()));
+				ended.push_back(client);
+			}
+		}
+		for (auto client : ended) {
+			detach(client, true);
+		}
+	}
+
+	/* The reactor is being destroyed. Whatever is left is no longer handled. */
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& c : connections) {
+		c.first->io_thread = nullptr;
+	}
+	for (auto& a : adding) {
+		a.first->io_thread = nullptr;
+	}
+	removed.notify_all();
+}
+
+reactor::reactor(size_t thread_count)
+{
+	if (thread_count == 0) {
+		thread_count = 1;
+	}
+	try {
+		for (size_t t = 0; t < thread_count; ++t) {
+			threads.push_back(new reactor_thread());
+		}
+	}
+	catch (const std::exception&) {
+		for (auto t : threads) {
+			delete t;
+		}
+		throw;
+	}
+}
+
+reactor::~reactor()
+{
+	for (auto t : threads) {
+		delete t;
+	}
+}
+
+bool reactor::supported()
+{
+	return true;
+}
+
+void reactor::add(ssl_client* client, reactor_disconnect_t on_disconnect)
+{
+	reactor_thread* least = threads[0];
+	for (auto t : threads) {
+		if (t->count < least->count) {
+			least = t;
+		}
+	}
+	least->count++;
+	least->add(client, on_disconnect);
+}
+
+void reactor::remove(ssl_client* client)
+{
+	/* A disconnect callback can add the connection to another thread while it is being removed */
+	reactor_thread* t;
+	while ((t = client->io_thread) != nullptr && !t->remove(client)) {
+	}
+}
+
+size_t reactor::get_connection_count() const
+{
+	size_t total = 0;
+	for (auto t : threads) {
+		total += t->count;
+	}
+	return total;
+}
+
+#else
+
+/* No epoll on this platform. Connections run their own read_loop() instead. */
+class reactor_thread {
+};
+
+reactor::reactor(size_t thread_count)
+{
+	throw dpp::exception("dpp::reactor is only supported on Linux");
+}
+
+reactor::~reactor()
+{
+}
+
+bool reactor::supported()
+{
+	return false;
+}
+
+void reactor::add(ssl_client* client, reactor_disconnect_t on_disconnect)
+{
+}
+
+void reactor::remove(ssl_client* client)
+{
+}
+
+size_t reactor::get_connection_count() const
+{
+	return 0;
+}
+
+#endif
+
+size_t reactor::get_thread_count() const
+{
+	return threads.size();
+}
+
+};
@@ -27,6 +27,8 @@ using json = nlohmann::json;
 
 namespace dpp {
 
+slab_helper(role);
+
 role::role() :
 	managed(),
 	guild_id(0),
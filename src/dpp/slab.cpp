@@ -0,0 +1,164 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * Copyright 2021 Craig Edwards and D++ contributors 
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <dpp/slab.h>
+#include <atomic>
+#include <algorithm>
+#include <new>
+
+/* Bytes per slab. Large enough that bulk guild loads carve few slabs, small
+ * enough that a rarely used type doesn't waste much.
+ */
+#define SLAB_SIZE		(64 * 1024)
+/* Maximum number of distinct slab allocators in the process */
+#define MAX_ALLOCATORS		32
+/* Blocks kept per thread before half are handed back to the shared list */
+#define THREAD_CACHE_LIMIT	128
+
+namespace dpp {
+
+namespace {
+
+/* Allocators are given a slot in each thread's cache in the order they are created */
+std::atomic<size_t> next_thread_index{0};
+
+/**
+ * @brief One thread's cache of free blocks for every allocator
+ */
+struct thread_cache {
+	struct entry {
+		/** Allocator the blocks belong to */
+		slab_allocator* owner = nullptr;
+		/** First free block, linked through their first word */
+		void* head = nullptr;
+		/** Number of free blocks */
+		size_t count = 0;
+	};
+
+	entry entries[MAX_ALLOCATORS];
+
+	/* Hand everything back when the thread exits, so other threads can use it */
+	~thread_cache() {
+		for (auto& e : entries) {
+			if (e.owner && e.head) {
+				void* tail = e.head;
+				while (*(void**)tail) {
+					tail = *(void**)tail;
+				}
+				e.owner->release(e.head, tail, e.count);
+			}
+		}
+	}
+};
+
+thread_local thread_cache local_cache;
+
+};
+
+slab_allocator::slab_allocator(size_t size) : free_list(nullptr), free_count(0)
+{
+	block_size = (std::max(size, sizeof(void*)) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+	blocks_per_slab = std::max((size_t)SLAB_SIZE / block_size, (size_t)1);
+	thread_index = next_thread_index++;
+}
+
+void slab_allocator::refill(size_t count) {
+	thread_cache::entry& e = local_cache.entries[thread_index];
+	std::lock_guard<std::mutex> lock(slab_mutex);
+	if (!free_list) {
+		/* Carve a new slab into blocks and chain them onto the shared list */
+		char* slab = (char*)::operator new(blocks_per_slab * block_size);
+		slabs.push_back(slab);
+		for (size_t i = 0; i < blocks_per_slab; ++i) {
+			void* block = slab + ((blocks_per_slab - 1 - i) * block_size);
+			*(void**)block = free_list;
+			free_list = block;
+		}
+		free_count += blocks_per_slab;
+	}
+	while (count-- && free_list) {
+		void* block = free_list;
+		free_list = *(void**)block;
+		free_count--;
+		*(void**)block = e.head;
+		e.head = block;
+		e.count++;
+	}
+}
+
+void* slab_allocator::allocate() {
+	if (thread_index >= MAX_ALLOCATORS) {
+		return ::operator new(block_size);
+	}
+	thread_cache::entry& e = local_cache.entries[thread_index];
+	e.owner = this;
+	if (!e.head) {
+		refill(THREAD_CACHE_LIMIT / 2);
+	}
+	void* block = e.head;
+	e.head = *(void**)block;
+	e.count--;
+	return block;
+}
+
+void slab_allocator::deallocate(void* block) {
+	if (!block) {
+		return;
+	}
+	if (thread_index >= MAX_ALLOCATORS) {
+		::operator delete(block);
+		return;
+	}
+	thread_cache::entry& e = local_cache.entries[thread_index];
+	e.owner = this;
+	*(void**)block = e.head;
+	e.head = block;
+	e.count++;
+	if (e.count > THREAD_CACHE_LIMIT) {
+		/* Detach half the cache and give it back to the shared list */
+		void* head = e.head;
+		void* tail = head;
+		for (size_t i = 1; i < THREAD_CACHE_LIMIT / 2; ++i) {
+			tail = *(void**)tail;
+		}
+		e.head = *(void**)tail;
+		*(void**)tail = nullptr;
+		e.count -= THREAD_CACHE_LIMIT / 2;
+		release(head, tail, THREAD_CACHE_LIMIT / 2);
+	}
+}
+
+void slab_allocator::release(void* head, void* tail, size_t count) {
+	std::lock_guard<std::mutex> lock(slab_mutex);
+	*(void**)tail = free_list;
+	free_list = head;
+	free_count += count;
+}
+
+size_t slab_allocator::get_block_size() const {
+	return block_size;
+}
+
+size_t slab_allocator::bytes() {
+	std::lock_guard<std::mutex> lock(slab_mutex);
+	return slabs.size() * blocks_per_slab * block_size;
+}
+
+};
@@ -0,0 +1,728 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * Copyright 2021 Craig Edwards and D++ contributors 
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <dpp/discord.h>
+#include <dpp/cache.h>
+#include <dpp/guild.h>
+#include <dpp/dispatcher.h>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <unordered_set>
+#include <unordered_map>
+#include <type_traits>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+namespace dpp {
+
+/* A cache snapshot is a flat binary file. Every value is written as a fixed size field in
+ * host byte order, strings and lists are length prefixed, and nothing is a pointer. A
+ * snapshot can be read straight out of a mapped or loaded buffer with no fixups, but only
+ * on the platform that wrote it.
+ *
+ * header:	"DPPCACHE", uint32 version
+ * sections:	uint8 type, uint64 count, then count records of (uint32 length, fields...)
+ * end:		uint8 ss_end
+ */
+
+#define SNAPSHOT_MAGIC		"DPPCACHE"
+#define SNAPSHOT_VERSION	2
+
+/**
+ * @brief Types of section in a snapshot
+ */
+enum snapshot_section : uint8_t {
+	ss_end = 0,
+	ss_user,
+	ss_role,
+	ss_channel,
+	ss_emoji,
+	ss_guild
+};
+
+/**
+ * @brief Builds a snapshot in memory
+ */
+class snapshot_writer {
+public:
+	std::string buffer;
+
+	template<typename T> void put(T v) {
+		static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "snapshot fields must be plain numbers");
+		buffer.append((const char*)&v, sizeof(T));
+	}
+
+	void put_string(const std::string& s) {
+		put<uint32_t>((uint32_t)s.size());
+		buffer.append(s);
+	}
+
+	void put_hash(const utility::iconhash& h) {
+		put<uint64_t>(h.first);
+		put<uint64_t>(h.second);
+	}
+
+	template<typename C> void put_ids(const C& ids) {
+		put<uint32_t>((uint32_t)ids.size());
+		for (snowflake id : ids) {
+			put<uint64_t>(id);
+		}
+	}
+
+	void put_time(time_t t) {
+		put<int64_t>((int64_t)t);
+	}
+
+	/* Records are length prefixed, so a reader can skip any it can't use */
+	size_t begin_record() {
+		size_t pos = buffer.size();
+		put<uint32_t>(0);
+		return pos;
+	}
+
+	void end_record(size_t pos) {
+		uint32_t len = (uint32_t)(buffer.size() - pos - sizeof(uint32_t));
+		std::memcpy(&buffer[pos], &len, sizeof(len));
+	}
+};
+
+/**
+ * @brief Reads fields back out of a snapshot buffer
+ */
+class snapshot_reader {
+	const char* pos;
+	const char* last;
+public:
+	snapshot_reader(const char* begin, const char* end) : pos(begin), last(end) {
+	}
+
+	template<typename T> T get() {
+		T v;
+		if ((size_t)(last - pos) < sizeof(T)) {
+			throw dpp::exception("Cache snapshot is truncated");
+		}
+		std::memcpy(&v, pos, sizeof(T));
+		pos += sizeof(T);
+		return v;
+	}
+
+	std::string get_string() {
+		uint32_t len = get<uint32_t>();
+		if ((size_t)(last - pos) < len) {
+			throw dpp::exception("Cache snapshot is truncated");
+		}
+		std::string s(pos, len);
+		pos += len;
+		return s;
+	}
+
+	utility::iconhash get_hash() {
+		utility::iconhash h;
+		h.first = get<uint64_t>();
+		h.second = get<uint64_t>();
+		return h;
+	}
+
+	template<typename C> void get_ids(C& ids) {
+		uint32_t n = get<uint32_t>();
+		ids.clear();
+		ids.reserve(n);
+		while (n--) {
+			ids.push_back(get<uint64_t>());
+		}
+	}
+
+	time_t get_time() {
+		return (time_t)get<int64_t>();
+	}
+
+	/**
+	 * @brief Split off a reader for the next record, and skip past it
+	 * 
+	 * @return snapshot_reader reader for the record's fields
+	 */
+	snapshot_reader record() {
+		uint32_t len = get<uint32_t>();
+		if ((size_t)(last - pos) < len) {
+			throw dpp::exception("Cache snapshot is truncated");
+		}
+		snapshot_reader r(pos, pos + len);
+		pos += len;
+		return r;
+	}
+};
+
+/* Everything loaded from a snapshot is tracked until an event confirms it is still current.
+ * Whatever a shard hasn't had confirmed once it settles is dropped by cache_snapshot_prune().
+ */
+static std::mutex snapshot_mutex;
+/* Guilds which haven't yet been refreshed by a GUILD_CREATE */
+static std::unordered_set<snowflake> snapshot_guilds;
+/* Members of each guild which no GUILD_CREATE, chunk or member event has mentioned */
+static std::unordered_map<snowflake, std::unordered_set<snowflake>> snapshot_members;
+/* Roles, channels and emojis of each guild which its GUILD_CREATE didn't list */
+static std::unordered_map<snowflake, std::unordered_set<snowflake>> snapshot_objects;
+/* Users which haven't been refreshed from an event */
+static std::unordered_set<snowflake> snapshot_users;
+/* True while any of the above is non-empty, so event handlers can skip the lock */
+static std::atomic<bool> snapshot_pending(false);
+
+static void write_object(snapshot_writer& w, const user* u) {
+	w.put<uint64_t>(u->id);
+	w.put_string(u->username);
+	w.put<uint16_t>(u->discriminator);
+	w.put_hash(u->avatar);
+	w.put<uint32_t>(u->flags);
+	w.put<uint32_t>(u->refcount);
+}
+
+static void read_object(snapshot_reader& r, user* u) {
+	u->id = r.get<uint64_t>();
+	u->username = r.get_string();
+	u->discriminator = r.get<uint16_t>();
+	u->avatar = r.get_hash();
+	u->flags = r.get<uint32_t>();
+	u->refcount = r.get<uint32_t>();
+}
+
+static void write_object(snapshot_writer& w, const role* rl) {
+	w.put<uint64_t>(rl->id);
+	w.put_string(rl->name);
+	w.put<uint64_t>(rl->guild_id);
+	w.put<uint32_t>(rl->colour);
+	w.put<uint8_t>(rl->position);
+	w.put<uint64_t>(rl->permissions);
+	w.put<uint8_t>(rl->flags);
+	w.put<uint64_t>(rl->integration_id);
+	w.put<uint64_t>(rl->bot_id);
+	w.put_string(rl->unicode_emoji);
+	w.put_hash(rl->icon);
+}
+
+static void read_object(snapshot_reader& r, role* rl) {
+	rl->id = r.get<uint64_t>();
+	rl->name = r.get_string();
+	rl->guild_id = r.get<uint64_t>();
+	rl->colour = r.get<uint32_t>();
+	rl->position = r.get<uint8_t>();
+	rl->permissions = r.get<uint64_t>();
+	rl->flags = r.get<uint8_t>();
+	rl->integration_id = r.get<uint64_t>();
+	rl->bot_id = r.get<uint64_t>();
+	rl->unicode_emoji = r.get_string();
+	rl->icon = r.get_hash();
+}
+
+static void write_object(snapshot_writer& w, const channel* c) {
+	w.put<uint64_t>(c->id);
+	w.put<uint8_t>(c->flags);
+	w.put<uint64_t>(c->guild_id);
+	w.put<uint16_t>(c->position);
+	w.put_string(c->name);
+	w.put_string(c->topic);
+	w.put<uint64_t>(c->last_message_id);
+	w.put<uint8_t>(c->user_limit);
+	w.put<uint16_t>(c->bitrate);
+	w.put<uint16_t>(c->rate_limit_per_user);
+	w.put<uint64_t>(c->owner_id);
+	w.put<uint64_t>(c->parent_id);
+	w.put_time(c->last_pin_timestamp);
+	w.put_ids(c->recipients);
+	w.put<uint32_t>((uint32_t)c->permission_overwrites.size());
+	for (auto& po : c->permission_overwrites) {
+		w.put<uint64_t>(po.id);
+		w.put<uint8_t>(po.type);
+		w.put<uint64_t>(po.allow);
+		w.put<uint64_t>(po.deny);
+	}
+	w.put<uint8_t>(c->message_count);
+	w.put<uint8_t>(c->member_count);
+	w.put<uint8_t>(c->metadata.archived);
+	w.put_time(c->metadata.archive_timestamp);
+	w.put<uint16_t>(c->metadata.auto_archive_duration);
+	w.put<uint8_t>(c->metadata.locked);
+	w.put<uint8_t>(c->metadata.invitable);
+}
+
+static void read_object(snapshot_reader& r, channel* c) {
+	c->id = r.get<uint64_t>();
+	c->flags = r.get<uint8_t>();
+	c->guild_id = r.get<uint64_t>();
+	c->position = r.get<uint16_t>();
+	c->name = r.get_string();
+	c->topic = r.get_string();
+	c->last_message_id = r.get<uint64_t>();
+	c->user_limit = r.get<uint8_t>();
+	c->bitrate = r.get<uint16_t>();
+	c->rate_limit_per_user = r.get<uint16_t>();
+	c->owner_id = r.get<uint64_t>();
+	c->parent_id = r.get<uint64_t>();
+	c->last_pin_timestamp = r.get_time();
+	r.get_ids(c->recipients);
+	uint32_t overwrites = r.get<uint32_t>();
+	c->permission_overwrites.clear();
+	c->permission_overwrites.reserve(overwrites);
+	while (overwrites--) {
+		permission_overwrite po;
+		po.id = r.get<uint64_t>();
+		po.type = r.get<uint8_t>();
+		po.allow = r.get<uint64_t>();
+		po.deny = r.get<uint64_t>();
+		c->permission_overwrites.push_back(po);
+	}
+	c->message_count = r.get<uint8_t>();
+	c->member_count = r.get<uint8_t>();
+	c->metadata.archived = r.get<uint8_t>();
+	c->metadata.archive_timestamp = r.get_time();
+	c->metadata.auto_archive_duration = r.get<uint16_t>();
+	c->metadata.locked = r.get<uint8_t>();
+	c->metadata.invitable = r.get<uint8_t>();
+}
+
+static void write_object(snapshot_writer& w, const emoji* e) {
+	w.put<uint64_t>(e->id);
+	w.put_string(e->name);
+	w.put<uint64_t>(e->user_id);
+	w.put<uint8_t>(e->flags);
+}
+
+static void read_object(snapshot_reader& r, emoji* e) {
+	e->id = r.get<uint64_t>();
+	e->name = r.get_string();
+	e->user_id = r.get<uint64_t>();
+	e->flags = r.get<uint8_t>();
+}
+
+static void write_object(snapshot_writer& w, const guild* g) {
+	w.put<uint64_t>(g->id);
+	w.put<uint16_t>(g->shard_id);
+	w.put<uint32_t>(g->flags);
+	w.put_string(g->name);
+	w.put_string(g->description);
+	w.put_string(g->vanity_url_code);
+	w.put_hash(g->icon);
+	w.put_hash(g->splash);
+	w.put_hash(g->discovery_splash);
+	w.put<uint64_t>(g->owner_id);
+	w.put<uint8_t>(g->voice_region);
+	w.put<uint64_t>(g->afk_channel_id);
+	w.put<uint8_t>(g->afk_timeout);
+	w.put<uint64_t>(g->widget_channel_id);
+	w.put<uint8_t>(g->verification_level);
+	w.put<uint8_t>(g->default_message_notifications);
+	w.put<uint8_t>(g->explicit_content_filter);
+	w.put<uint8_t>(g->mfa_level);
+	w.put<uint64_t>(g->application_id);
+	w.put<uint64_t>(g->system_channel_id);
+	w.put<uint64_t>(g->rules_channel_id);
+	w.put<uint32_t>(g->member_count);
+	w.put_hash(g->banner);
+	w.put<uint8_t>(g->premium_tier);
+	w.put<uint16_t>(g->premium_subscription_count);
+	w.put<uint64_t>(g->public_updates_channel_id);
+	w.put<uint16_t>(g->max_video_channel_users);
+	w.put_ids(g->roles);
+	w.put_ids(g->channels);
+	w.put_ids(g->threads);
+	w.put_ids(g->emojis);
+	w.put<uint64_t>(g->members.size());
+	for (auto& m : g->members) {
+		const guild_member& gm = m.second;
+		w.put<uint64_t>(gm.user_id);
+		w.put_ids(gm.roles);
+		w.put_string(gm.nickname);
+		w.put_time(gm.joined_at);
+		w.put_time(gm.premium_since);
+		w.put<uint8_t>(gm.flags);
+	}
+}
+
+static void read_object(snapshot_reader& r, guild* g) {
+	g->id = r.get<uint64_t>();
+	g->shard_id = r.get<uint16_t>();
+	g->flags = r.get<uint32_t>();
+	g->name = r.get_string();
+	g->description = r.get_string();
+	g->vanity_url_code = r.get_string();
+	g->icon = r.get_hash();
+	g->splash = r.get_hash();
+	g->discovery_splash = r.get_hash();
+	g->owner_id = r.get<uint64_t>();
+	g->voice_region = (region)r.get<uint8_t>();
+	g->afk_channel_id = r.get<uint64_t>();
+	g->afk_timeout = r.get<uint8_t>();
+	g->widget_channel_id = r.get<uint64_t>();
+	g->verification_level = r.get<uint8_t>();
+	g->default_message_notifications = r.get<uint8_t>();
+	g->explicit_content_filter = r.get<uint8_t>();
+	g->mfa_level = r.get<uint8_t>();
+	g->application_id = r.get<uint64_t>();
+	g->system_channel_id = r.get<uint64_t>();
+	g->rules_channel_id = r.get<uint64_t>();
+	g->member_count = r.get<uint32_t>();
+	g->banner = r.get_hash();
+	g->premium_tier = r.get<uint8_t>();
+	g->premium_subscription_count = r.get<uint16_t>();
+	g->public_updates_channel_id = r.get<uint64_t>();
+	g->max_video_channel_users = r.get<uint16_t>();
+	r.get_ids(g->roles);
+	r.get_ids(g->channels);
+	r.get_ids(g->threads);
+	r.get_ids(g->emojis);
+	uint64_t members = r.get<uint64_t>();
+	g->members.clear();
+	g->members.reserve(members);
+	while (members--) {
+		guild_member gm;
+		gm.guild_id = g->id;
+		gm.user_id = r.get<uint64_t>();
+		r.get_ids(gm.roles);
+		gm.nickname = r.get_string();
+		gm.joined_at = r.get_time();
+		gm.premium_since = r.get_time();
+		gm.flags = r.get<uint8_t>();
+		g->members[gm.user_id] = gm;
+	}
+}
+
+/* Write every object in a cache as one section */
+template<typename T> static size_t write_section(snapshot_writer& w, snapshot_section type, cache* c) {
+	w.put<uint8_t>(type);
+	size_t count_pos = w.buffer.size();
+	w.put<uint64_t>(0);
+	uint64_t count = 0;
+	for (size_t s = 0; s < c->get_stripe_count(); ++s) {
+		std::shared_lock<std::shared_mutex> lock(c->get_mutex(s));
+		for (auto& entry : c->get_container(s)) {
+			size_t rec = w.begin_record();
+			write_object(w, (const T*)entry.second);
+			w.end_record(rec);
+			count++;
+		}
+	}
+	std::memcpy(&w.buffer[count_pos], &count, sizeof(count));
+	return count;
+}
+
+/**
+ * @brief An object read from a snapshot, held until the whole snapshot has been read
+ */
+struct staged_object {
+	snapshot_section type;
+	cache* c;
+	std::unique_ptr<managed> object;
+};
+
+/* Read a section. Nothing is cached yet, so a snapshot which turns out to be corrupt further on leaves the caches untouched. */
+template<typename T> static void read_section(snapshot_reader& r, snapshot_section type, cache* c, std::vector<staged_object>& staged) {
+	uint64_t count = r.get<uint64_t>();
+	while (count--) {
+		snapshot_reader rec = r.record();
+		std::unique_ptr<T> object(new T());
+		read_object(rec, object.get());
+		staged.push_back({type, c, std::move(object)});
+	}
+}
+
+/* Cache everything read from a snapshot. Objects already in the cache are live, so they win. */
+static size_t commit_staged(std::vector<staged_object>& staged) {
+	size_t loaded = 0;
+	/* Roles, channels and emojis which came from the snapshot, rather than being live */
+	std::unordered_set<snowflake> loaded_objects;
+	std::lock_guard<std::mutex> lock(snapshot_mutex);
+	for (staged_object& s : staged) {
+		if (s.c->find(s.object->id)) {
+			continue;
+		}
+		managed* object = s.object.release();
+		s.c->store(object);
+		loaded++;
+		switch (s.type) {
+			case ss_user:
+				snapshot_users.insert(object->id);
+			break;
+			case ss_role:
+			case ss_channel:
+			case ss_emoji:
+				loaded_objects.insert(object->id);
+			break;
+			case ss_guild: {
+				guild* g = (guild*)object;
+				snapshot_guilds.insert(g->id);
+				std::unordered_set<snowflake>& members = snapshot_members[g->id];
+				for (auto& m : g->members) {
+					members.insert(m.first);
+				}
+				std::unordered_set<snowflake>& objects = snapshot_objects[g->id];
+				for (const std::vector<snowflake>* list : { &g->roles, &g->channels, &g->emojis }) {
+					for (snowflake id : *list) {
+						if (loaded_objects.find(id) != loaded_objects.end()) {
+							objects.insert(id);
+						}
+					}
+				}
+			}
+			break;
+			default:
+			break;
+		}
+		snapshot_pending = true;
+	}
+	return loaded;
+}
+
+size_t cache_snapshot_save(const std::string& filename) {
+	snapshot_writer w;
+	size_t total = 0;
+	epoch_guard pin;
+
+	w.buffer.append(SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC));
+	w.put<uint32_t>(SNAPSHOT_VERSION);
+	total += write_section<user>(w, ss_user, get_user_cache());
+	total += write_section<role>(w, ss_role, get_role_cache());
+	total += write_section<channel>(w, ss_channel, get_channel_cache());
+	total += write_section<emoji>(w, ss_emoji, get_emoji_cache());
+	total += write_section<guild>(w, ss_guild, get_guild_cache());
+	w.put<uint8_t>(ss_end);
+
+	/* Write to a temporary file and rename it over the old one, so a crash
+	 * part way through never leaves a truncated snapshot behind
+	 */
+	std::string temp = filename + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		out.write(w.buffer.data(), w.buffer.size());
+		if (!out) {
+			throw dpp::exception("Can't write cache snapshot " + temp);
+		}
+	}
+	std::remove(filename.c_str());
+	if (std::rename(temp.c_str(), filename.c_str()) != 0) {
+		throw dpp::exception("Can't rename cache snapshot to " + filename);
+	}
+	return total;
+}
+
+size_t cache_snapshot_load(const std::string& filename) {
+	std::ifstream in(filename, std::ios::binary);
+	if (!in) {
+		return 0;
+	}
+	std::string buffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	snapshot_reader r(buffer.data(), buffer.data() + buffer.size());
+
+	std::string magic(strlen(SNAPSHOT_MAGIC), 0);
+	for (auto& ch : magic) {
+		ch = r.get<char>();
+	}
+	if (magic != SNAPSHOT_MAGIC || r.get<uint32_t>() != SNAPSHOT_VERSION) {
+		throw dpp::exception("Not a cache snapshot, or from a different version: " + filename);
+	}
+
+	std::vector<staged_object> staged;
+	uint8_t type;
+	while ((type = r.get<uint8_t>()) != ss_end) {
+		switch (type) {
+			case ss_user:
+				read_section<user>(r, ss_user, get_user_cache(), staged);
+			break;
+			case ss_role:
+				read_section<role>(r, ss_role, get_role_cache(), staged);
+			break;
+			case ss_channel:
+				read_section<channel>(r, ss_channel, get_channel_cache(), staged);
+			break;
+			case ss_emoji:
+				read_section<emoji>(r, ss_emoji, get_emoji_cache(), staged);
+			break;
+			case ss_guild:
+				read_section<guild>(r, ss_guild, get_guild_cache(), staged);
+			break;
+			default:
+				throw dpp::exception("Unknown section in cache snapshot " + filename);
+		}
+	}
+	return commit_staged(staged);
+}
+
+bool cache_snapshot_reconcile(snowflake guild_id) {
+	if (!snapshot_pending) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(snapshot_mutex);
+	return snapshot_guilds.erase(guild_id) > 0;
+}
+
+bool cache_snapshot_confirm_member(snowflake guild_id, snowflake user_id) {
+	if (!snapshot_pending) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(snapshot_mutex);
+	auto g = snapshot_members.find(guild_id);
+	return g != snapshot_members.end() && g->second.erase(user_id) > 0;
+}
+
+bool cache_snapshot_confirm_object(snowflake guild_id, snowflake id) {
+	if (!snapshot_pending) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(snapshot_mutex);
+	auto g = snapshot_objects.find(guild_id);
+	return g != snapshot_objects.end() && g->second.erase(id) > 0;
+}
+
+bool cache_snapshot_refresh_user(snowflake user_id) {
+	if (!snapshot_pending) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(snapshot_mutex);
+	return snapshot_users.erase(user_id) > 0;
+}
+
+/* Drop a guild member, and its user once it is no longer a member of any guild */
+static void prune_member(guild* g, snowflake user_id) {
+	auto m = g->members.find(user_id);
+	if (m == g->members.end()) {
+		return;
+	}
+	release_user(user_id);
+	g->members.erase(m);
+}
+
+/* Drop a role, channel or emoji of a guild which its GUILD_CREATE didn't list */
+static void prune_object(guild* g, snowflake id) {
+	for (std::vector<snowflake>* list : { &g->roles, &g->channels, &g->emojis }) {
+		list->erase(std::remove(list->begin(), list->end(), id), list->end());
+	}
+	if (role* r = find_role(id)) {
+		get_role_cache()->remove(r);
+	} else if (channel* c = find_channel(id)) {
+		get_channel_cache()->remove(c);
+	} else if (emoji* e = find_emoji(id)) {
+		get_emoji_cache()->remove(e);
+	}
+}
+
+/* Drop a guild which never had a GUILD_CREATE, along with everything it refers to */
+static void prune_guild(guild* g) {
+	get_guild_cache()->remove(g);
+	for (snowflake id : g->emojis) {
+		emoji* e = find_emoji(id);
+		if (e) {
+			get_emoji_cache()->remove(e);
+		}
+	}
+	for (snowflake id : g->roles) {
+		role* r = find_role(id);
+		if (r) {
+			get_role_cache()->remove(r);
+		}
+	}
+	for (snowflake id : g->channels) {
+		channel* c = find_channel(id);
+		if (c) {
+			get_channel_cache()->remove(c);
+		}
+	}
+	while (!g->members.empty()) {
+		prune_member(g, g->members.begin()->first);
+	}
+}
+
+size_t cache_snapshot_prune(uint32_t shard_id, uint32_t max_shards) {
+	if (!snapshot_pending || max_shards == 0) {
+		return 0;
+	}
+	std::vector<snowflake> guilds;
+	std::vector<std::pair<snowflake, std::unordered_set<snowflake>>> members;
+	std::vector<std::pair<snowflake, std::unordered_set<snowflake>>> objects;
+	{
+		std::lock_guard<std::mutex> lock(snapshot_mutex);
+		/* Discord sends each guild's events to shard (guild_id >> 22) % max_shards */
+		for (auto i = snapshot_guilds.begin(); i != snapshot_guilds.end();) {
+			if ((*i >> 22) % max_shards == shard_id) {
+				guilds.push_back(*i);
+				i = snapshot_guilds.erase(i);
+			} else {
+				++i;
+			}
+		}
+		for (auto i = snapshot_members.begin(); i != snapshot_members.end();) {
+			if ((i->first >> 22) % max_shards == shard_id) {
+				members.emplace_back(i->first, std::move(i->second));
+				i = snapshot_members.erase(i);
+			} else {
+				++i;
+			}
+		}
+		for (auto i = snapshot_objects.begin(); i != snapshot_objects.end();) {
+			if ((i->first >> 22) % max_shards == shard_id) {
+				objects.emplace_back(i->first, std::move(i->second));
+				i = snapshot_objects.erase(i);
+			} else {
+				++i;
+			}
+		}
+		if (snapshot_guilds.empty() && snapshot_members.empty() && snapshot_objects.empty()) {
+			/* Users that are left aren't members of any guild we track, so are only refreshed by chance */
+			snapshot_users.clear();
+			snapshot_pending = false;
+		}
+	}
+
+	/* Objects we look at below may be retired by other threads while we use them */
+	epoch_guard guard;
+	size_t total = 0;
+	std::unordered_set<snowflake> pruned_guilds;
+	for (snowflake id : guilds) {
+		guild* g = find_guild(id);
+		if (g) {
+			prune_guild(g);
+			pruned_guilds.insert(id);
+			total++;
+		}
+	}
+	for (auto& entry : members) {
+		guild* g = find_guild(entry.first);
+		if (!g || pruned_guilds.find(entry.first) != pruned_guilds.end()) {
+			continue;
+		}
+		for (snowflake user_id : entry.second) {
+			prune_member(g, user_id);
+			total++;
+		}
+	}
+	for (auto& entry : objects) {
+		guild* g = find_guild(entry.first);
+		if (!g || pruned_guilds.find(entry.first) != pruned_guilds.end()) {
+			continue;
+		}
+		for (snowflake id : entry.second) {
+			prune_object(g, id);
+			total++;
+		}
+	}
+	return total;
+}
+
+};
@@ -55,8 +55,13 @@
 #include <exception>
 #include <string>
 #include <iostream>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 #include <dpp/fmt/format.h>
 #include <dpp/sslclient.h>
+#include <dpp/dns.h>
+#include <dpp/reactor.h>
 #include <dpp/discord.h>
 #include <dpp/dispatcher.h>
 
@@ -67,10 +72,71 @@ public:
 	/** OpenSSL session */
 	SSL* ssl;
 
-	/** OpenSSL context */
+	/** OpenSSL context, shared by every connection. See shared_context(). */
 	SSL_CTX* ctx;
+
+	/** Hostname and port, the key of the TLS session cache */
+	std::string session_key;
+};
+
+namespace {
+
+/* TLS sessions to resume, by hostname and port. The SSL_SESSION pointers are owned by the cache. */
+std::mutex session_mutex;
+std::unordered_map<std::string, SSL_SESSION*> sessions;
+
+std::atomic<uint64_t> full_handshakes{0}, resumed_handshakes{0};
+
+/* Called by openssl with each session ticket the server sends us. With TLS 1.3 this happens
+ * after the handshake, from within SSL_read().
+ */
+int new_session(SSL* ssl, SSL_SESSION* session)
+{
+	opensslcontext* context = (opensslcontext*)SSL_get_app_data(ssl);
+	if (context == nullptr) {
+		return 0;
+	}
+	std::lock_guard<std::mutex> lock(session_mutex);
+	SSL_SESSION*& cached = sessions[context->session_key];
+	if (cached) {
+		SSL_SESSION_free(cached);
+	}
+	cached = session;
+	/* Returning 1 tells openssl we have taken the reference to the session */
+	return 1;
+}
+
+/* One context for the whole process, rather than one per connection. It is never freed,
+ * as connections may be closing on other threads when the program exits.
+ */
+SSL_CTX* shared_context()
+{
+	static SSL_CTX* ctx = []() {
+		SSL_CTX* c = SSL_CTX_new(TLS_client_method());
+		if (c != nullptr) {
+			/* Sessions are kept in our own cache, not the internal one, so that openssl doesn't
+			 * discard them when a connection is dropped without a TLS shutdown.
+			 */
+			SSL_CTX_set_session_cache_mode(c, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+			SSL_CTX_sess_set_new_cb(c, new_session);
+		}
+		return c;
+	}();
+	return ctx;
+}
+
 };
 
+tls_stats get_tls_stats()
+{
+	tls_stats s;
+	s.full_handshakes = full_handshakes;
+	s.resumed_handshakes = resumed_handshakes;
+	std::lock_guard<std::mutex> lock(session_mutex);
+	s.sessions = sessions.size();
+	return s;
+}
+
 /* NOTE: Upper bounds check not required: https://docs.microsoft.com/en-us/windows/win32/winsock/select-and-fd---2 */
 #define SAFE_FD_SET(a, b) { if (a >= 0) { FD_SET(a, b); }}
 #define SAFE_FD_ISSET(a, b) ((a >= 0) ? FD_ISSET(a, b) : 0)
@@ -83,6 +149,7 @@ public:
 const int ERROR_STATUS = -1;
 
 ssl_client::ssl_client(const std::string &_hostname, const std::string &_port) :
+	obuffer_offset(0),
 	nonblocking(false),
 	sfd(INVALID_SOCKET),
 	ssl(nullptr),
@@ -90,7 +157,15 @@ ssl_client::ssl_client(const std::string &_hostname, const std::string &_port) :
 	hostname(_hostname),
 	port(_port),
 	bytes_out(0),
-	bytes_in(0)
+	bytes_in(0),
+	read_blocked_on_write(false),
+	write_blocked_on_read(false),
+	io_thread(nullptr),
+	bytes_queued(0),
+	buffers_queued(0),
+	buffers_sent(0),
+	flush_time_total_us(0),
+	flush_time_max_us(0)
 {
 #ifndef WIN32
         signal(SIGALRM, SIG_IGN);
@@ -111,10 +186,10 @@ void ssl_client::Connect()
 {
 	/* Initial connection is done in blocking mode. There is a timeout on it. */
 	nonblocking = false;
-	const SSL_METHOD *method = TLS_client_method(); /* Create new client-method instance */
+	read_blocked_on_write = write_blocked_on_read = false;
 
-	/* Create SSL context */
-	ssl->ctx = SSL_CTX_new(method);
+	/* Get the shared SSL context */
+	ssl->ctx = shared_context();
 	if (ssl->ctx == nullptr)
 		throw dpp::exception("Failed to create SSL client context!");
 
@@ -123,30 +198,32 @@ void ssl_client::Connect()
 	if (ssl->ssl == nullptr)
 		throw dpp::exception("SSL_new failed!");
 
-	/* Resolve hostname to IP */
-	struct hostent *host;
-	if ((host = gethostbyname(hostname.c_str())) == nullptr)
-		throw dpp::exception(fmt::format("Couldn't resolve hostname '{}'", hostname));
-
-	addrinfo hints, *addrs;
-	
-	memset(&hints, 0, sizeof(addrinfo));
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
+	/* Offer the last session we had with this host, so that a reconnect can do an abbreviated handshake */
+	ssl->session_key = hostname + ":" + port;
+	SSL_set_app_data(ssl->ssl, ssl);
+	SSL_set_tlsext_host_name(ssl->ssl, hostname.c_str());
+	{
+		std::lock_guard<std::mutex> lock(session_mutex);
+		auto cached = sessions.find(ssl->session_key);
+		if (cached != sessions.end()) {
+			SSL_set_session(ssl->ssl, cached->second);
+		}
+	}
 
-	int status = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &addrs);
-	if (status != 0)
-		throw dpp::exception(fmt::format("getaddrinfo (host={}, port={}): ", hostname, port, gai_strerror(status)));
+	/* Resolve hostname to IP. Many shards reconnecting at once share one lookup through the DNS cache.
+	 * This waits for the lookup, as SSL_connect() below waits for the handshake; Connect() runs on
+	 * the thread starting or reconnecting a shard or voice client, never on a reactor thread.
+	 */
+	dns_result addrs = resolve_hostname(hostname, port);
 
 	/* Attempt each address in turn, if there are multiple IP addresses on the hostname */
 	int err = 0;
-	for (struct addrinfo *addr = addrs; addr != nullptr; addr = addr->ai_next) {
-		sfd = ::socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+	for (auto& addr : addrs) {
+		sfd = ::socket(addr.family, addr.socktype, addr.protocol);
 		if (sfd == ERROR_STATUS) {
 			err = errno;
 			continue;
-		} else if (connect(sfd, addr->ai_addr, (int)addr->ai_addrlen) == 0) {
+		} else if (connect(sfd, addr.get_sockaddr(), (int)addr.get_size()) == 0) {
 			break;
 		}
 		err = errno;
@@ -160,7 +237,6 @@ void ssl_client::Connect()
 	#endif
 		sfd = ERROR_STATUS;
 	}
-	freeaddrinfo(addrs);
 
 	/* Check if none of the IPs yielded a valid connection */
 	if (sfd == ERROR_STATUS)
@@ -169,29 +245,55 @@ void ssl_client::Connect()
 	/* We're good to go - hand the fd over to openssl */
 	SSL_set_fd(ssl->ssl, (int)sfd);
 
-	status = SSL_connect(ssl->ssl);
+	int status = SSL_connect(ssl->ssl);
 	if (status != 1) {
 		throw dpp::exception("SSL_connect error");
 	}
 
+	if (SSL_session_reused(ssl->ssl)) {
+		resumed_handshakes++;
+	} else {
+		full_handshakes++;
+	}
+
 	this->cipher = SSL_get_cipher(ssl->ssl);
 }
 
 void ssl_client::write(const std::string &data)
 {
-	/* If we are in nonblocking mode, append to the buffer,
+	write_buffer(std::string(data));
+}
+
+void ssl_client::write_buffer(std::string&& data)
+{
+	/* If we are in nonblocking mode, add to the queue,
 	 * otherwise just use SSL_write directly. The only time we
 	 * use SSL_write directly is during connection before the
 	 * ReadLoop is called, which allows for guaranteed simple
 	 * lock-step delivery e.g. for HTTP header negotiation
 	 */
 	if (nonblocking) {
-		obuffer += data;
+		if (!data.empty()) {
+			bytes_queued += data.length();
+			buffers_queued++;
+			obuffer.push_back({std::move(data), dpp::utility::time_f()});
+		}
 	} else {
 		SSL_write(ssl->ssl, data.data(), (int)data.length());
 	}
 }
 
+send_queue_stats ssl_client::get_send_queue_stats()
+{
+	send_queue_stats s;
+	s.bytes_queued = bytes_queued;
+	s.buffers_queued = buffers_queued;
+	s.buffers_sent = buffers_sent;
+	s.average_flush_time = s.buffers_sent ? (flush_time_total_us / (double)s.buffers_sent) / 1000000.0 : 0;
+	s.max_flush_time = flush_time_max_us / 1000000.0;
+	return s;
+}
+
 void ssl_client::one_second_timer()
 {
 }
@@ -204,24 +306,10 @@ void ssl_client::log(dpp::loglevel severity, const std::string &msg) const
 {
 }
 
-void ssl_client::read_loop()
+void ssl_client::set_nonblocking()
 {
-	/* The read loop is non-blocking using select(). This method
-	 * cannot read while it is waiting for write, or write while it is
-	 * waiting for read. This is a limitation of the openssl libraries,
-	 * as SSL is sent and received in low level ~16k frames which must
-	 * be synchronised and ordered correctly. Attempting to send while
-	 * we need another frame or receive while we are due to send a frame
-	 * would cause the protocol to break.
-	 */
-	int r = 0;
-	size_t ClientToServerLength = 0, ClientToServerOffset = 0;
-	bool read_blocked_on_write =  false, write_blocked_on_read = false,read_blocked = false;
-	fd_set readfds, writefds, efds;
-	char ClientToServerBuffer[BUFSIZZ], ServerToClientBuffer[BUFSIZZ];
-
 	if (sfd == -1)  {
-		throw dpp::exception("Invalid file descriptor in read_loop()");
+		throw dpp::exception("Invalid file descriptor in set_nonblocking()");
 	}
 	
 	/* Make the socket nonblocking */
@@ -239,6 +327,133 @@ void ssl_client::read_loop()
 	}
 #endif
 	nonblocking = true;
+}
+
+bool ssl_client::wants_write() const
+{
+	/* If we're waiting for a read on the socket don't try to write to the server */
+	return !obuffer.empty() || read_blocked_on_write;
+}
+
+bool ssl_client::handle_io(bool readable, bool writeable)
+{
+	/* This method cannot read while it is waiting for write, or write while it is
+	 * waiting for read. This is a limitation of the openssl libraries,
+	 * as SSL is sent and received in low level ~16k frames which must
+	 * be synchronised and ordered correctly. Attempting to send while
+	 * we need another frame or receive while we are due to send a frame
+	 * would cause the protocol to break.
+	 */
+	int r = 0;
+	bool read_blocked = false;
+	char ServerToClientBuffer[BUFSIZZ];
+
+	/* Now check if there's data to read */
+	if((readable && !write_blocked_on_read) || (read_blocked_on_write && writeable)) {
+		do {
+			read_blocked_on_write = false;
+			read_blocked = false;
+			
+			r = SSL_read(ssl->ssl,ServerToClientBuffer,BUFSIZZ);
+
+			int e = SSL_get_error(ssl->ssl,r);
+
+			switch (e) {
+				case SSL_ERROR_NONE:
+					/* Data received, add it to the buffer */
+					buffer.append(ServerToClientBuffer, r);
+					this->handle_buffer(buffer);
+					bytes_in += r;
+				break;
+				case SSL_ERROR_ZERO_RETURN:
+					/* End of data */
+					SSL_shutdown(ssl->ssl);
+					return false;
+				break;
+				case SSL_ERROR_WANT_READ:
+					read_blocked = true;
+				break;
+						
+				/* We get a WANT_WRITE if we're trying to rehandshake and we block on a write during that rehandshake.
+				* We need to wait on the socket to be writeable but reinitiate the read when it is
+				*/
+				case SSL_ERROR_WANT_WRITE:
+					read_blocked_on_write = true;
+				break;
+				default:
+					return false;
+				break;
+			}
+
+			/* We need a check for read_blocked here because SSL_pending() doesn't work properly during the
+			* handshake. This check prevents a busy-wait loop around SSL_read()
+			*/
+		} while (SSL_pending(ssl->ssl) && !read_blocked);
+	}
+
+	/* If the socket is writeable, send from the front of the sendq until it would block. Each buffer
+	 * is handed to openssl where it is, and stays put until all of it is sent, as openssl requires
+	 * a write which would have blocked to be retried with the same buffer.
+	 */
+	if ((writeable || (write_blocked_on_read && readable)) && !obuffer.empty()) {
+		write_blocked_on_read = false;
+		bool blocked = false;
+		while (!obuffer.empty() && !blocked) {
+			send_buffer& front = obuffer.front();
+			/* Try to write */
+			r = SSL_write(ssl->ssl, front.data.data() + obuffer_offset, (int)(front.data.length() - obuffer_offset));
+			
+			switch(SSL_get_error(ssl->ssl,r)) {
+				/* We wrote something */
+				case SSL_ERROR_NONE:
+					obuffer_offset += r;
+					bytes_out += r;
+					bytes_queued -= r;
+					if (obuffer_offset == front.data.length()) {
+						uint64_t flush_time = (uint64_t)((dpp::utility::time_f() - front.queued_at) * 1000000.0);
+						flush_time_total_us += flush_time;
+						if (flush_time > flush_time_max_us) {
+							flush_time_max_us = flush_time;
+						}
+						buffers_sent++;
+						buffers_queued--;
+						obuffer.pop_front();
+						obuffer_offset = 0;
+					}
+				break;
+					
+				/* We would have blocked */
+				case SSL_ERROR_WANT_WRITE:
+					blocked = true;
+				break;
+		
+				/* We get a WANT_READ if we're trying to rehandshake and we block onwrite during the current connection.
+				* We need to wait on the socket to be readable but reinitiate our write when it is
+				*/
+				case SSL_ERROR_WANT_READ:
+					write_blocked_on_read = true;
+					blocked = true;
+				break;
+						
+				/* Some other error */
+				default:
+					return false;
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+void ssl_client::read_loop()
+{
+	/* The read loop is non-blocking using select(). See handle_io() for the reading
+	 * and writing. Connections handled by a dpp::reactor don't use this loop.
+	 */
+	int r = 0;
+	fd_set readfds, writefds, efds;
+
+	set_nonblocking();
 
 	try {
 		/* Loop until there is a socket error */
@@ -265,8 +480,7 @@ void ssl_client::read_loop()
 				SAFE_FD_SET(cfd, &writefds);
 			}
 
-			/* If we're waiting for a read on the socket don't try to write to the server */
-			if (ClientToServerLength || obuffer.length() || read_blocked_on_write) {
+			if (wants_write()) {
 				SAFE_FD_SET(sfd,&writefds);
 			}
 				
@@ -291,87 +505,8 @@ void ssl_client::read_loop()
 				return;
 			}
 
-			/* Now check if there's data to read */
-			if((SAFE_FD_ISSET(sfd,&readfds) && !write_blocked_on_read) || (read_blocked_on_write && SAFE_FD_ISSET(sfd,&writefds))) {
-				do {
-					read_blocked_on_write = false;
-					read_blocked = false;
-					
-					r = SSL_read(ssl->ssl,ServerToClientBuffer,BUFSIZZ);
-
-					int e = SSL_get_error(ssl->ssl,r);
-
-					switch (e) {
-						case SSL_ERROR_NONE:
-							/* Data received, add it to the buffer */
-							buffer.append(ServerToClientBuffer, r);
-							this->handle_buffer(buffer);
-							bytes_in += r;
-						break;
-						case SSL_ERROR_ZERO_RETURN:
-							/* End of data */
-							SSL_shutdown(ssl->ssl);
-							return;
-						break;
-						case SSL_ERROR_WANT_READ:
-							read_blocked = true;
-						break;
-								
-						/* We get a WANT_WRITE if we're trying to rehandshake and we block on a write during that rehandshake.
-						* We need to wait on the socket to be writeable but reinitiate the read when it is
-						*/
-						case SSL_ERROR_WANT_WRITE:
-							read_blocked_on_write = true;
-						break;
-						default:
-							return;
-						break;
-					}
-
-					/* We need a check for read_blocked here because SSL_pending() doesn't work properly during the
-					* handshake. This check prevents a busy-wait loop around SSL_read()
-					*/
-				} while (SSL_pending(ssl->ssl) && !read_blocked);
-			}
-
-			/* Check for input on the sendq */
-			if (obuffer.length() && ClientToServerLength == 0) {
-				memcpy(&ClientToServerBuffer, obuffer.data(), obuffer.length() > BUFSIZZ ? BUFSIZZ : obuffer.length());
-				ClientToServerLength = obuffer.length() > BUFSIZZ ? BUFSIZZ : obuffer.length();
-				obuffer = obuffer.substr(ClientToServerLength, obuffer.length());
-				ClientToServerOffset = 0;
-			}
-
-			/* If the socket is writeable... */
-			if ((SAFE_FD_ISSET(sfd,&writefds) && ClientToServerLength) || (write_blocked_on_read && SAFE_FD_ISSET(sfd,&readfds))) {
-				write_blocked_on_read = false;
-				/* Try to write */
-				r = SSL_write(ssl->ssl, ClientToServerBuffer + ClientToServerOffset, (int)ClientToServerLength);
-				
-				switch(SSL_get_error(ssl->ssl,r)) {
-					/* We wrote something */
-					case SSL_ERROR_NONE:
-						ClientToServerLength -= r;
-						ClientToServerOffset += r;
-						bytes_out += r;
-					break;
-						
-					/* We would have blocked */
-					case SSL_ERROR_WANT_WRITE:
-					break;
-			
-					/* We get a WANT_READ if we're trying to rehandshake and we block onwrite during the current connection.
-					* We need to wait on the socket to be readable but reinitiate our write when it is
-					*/
-					case SSL_ERROR_WANT_READ:
-						write_blocked_on_read = true;
-					break;
-							
-					/* Some other error */
-					default:
-						return;
-					break;
-				}
+			if (!handle_io(SAFE_FD_ISSET(sfd, &readfds), SAFE_FD_ISSET(sfd, &writefds))) {
+				return;
 			}
 		}
 	}
@@ -397,6 +532,7 @@ bool ssl_client::handle_buffer(std::string &buffer)
 
 void ssl_client::close()
 {
+	reactor::remove(this);
 	if (ssl->ssl) {
 		SSL_free(ssl->ssl);
 		ssl->ssl = nullptr;
@@ -409,12 +545,13 @@ void ssl_client::close()
 	#else
 		::close(sfd);
 	#endif
-	if (ssl->ctx) {
-		SSL_CTX_free(ssl->ctx);
-		ssl->ctx = nullptr;
-	}
+	/* The context is shared, so it isn't freed here */
+	ssl->ctx = nullptr;
 	sfd = -1;
 	obuffer.clear();
+	obuffer_offset = 0;
+	bytes_queued = 0;
+	buffers_queued = 0;
 	buffer.clear();
 }
 
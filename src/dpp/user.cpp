@@ -44,6 +44,8 @@ std::map<uint32_t, dpp::user_flags> usermap = {
 
 namespace dpp {
 
+slab_helper(user);
+
 user::user() :
 	managed(),
 	discriminator(0),
@@ -52,6 +54,26 @@ user::user() :
 {
 }
 
+user::user(const user& other) :
+	managed(other.id),
+	username(other.username),
+	discriminator(other.discriminator),
+	avatar(other.avatar),
+	flags(other.flags),
+	refcount(other.refcount.load())
+{
+}
+
+user& user::operator=(const user& other) {
+	id = other.id;
+	username = other.username;
+	discriminator = other.discriminator;
+	avatar = other.avatar;
+	flags = other.flags;
+	refcount = other.refcount.load();
+	return *this;
+}
+
 user::~user()
 {
 }
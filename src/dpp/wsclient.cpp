@@ -21,6 +21,12 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#ifdef _WIN32
+#include <WinSock2.h>
+#else
+#include <sys/socket.h>
+#endif
 #include <dpp/wsclient.h>
 #include <dpp/fmt/format.h>
 
@@ -33,18 +39,27 @@ const unsigned char WS_PAYLOAD_LENGTH_MAGIC_HUGE = 127;
 const size_t WS_MAX_PAYLOAD_LENGTH_SMALL = 125;
 const size_t WS_MAX_PAYLOAD_LENGTH_LARGE = 65535;
 const size_t MAXHEADERSIZE = sizeof(uint64_t) + 2;
+const size_t DEFAULT_MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+/* Close code for a message bigger than we accept */
+const uint32_t WS_CLOSE_TOO_BIG = 1009;
+/* Close code for a protocol error, e.g. a continuation frame with nothing to continue */
+const uint32_t WS_CLOSE_PROTOCOL_ERROR = 1002;
 
 websocket_client::websocket_client(const std::string &hostname, const std::string &port, const std::string &urlpath)
 	: ssl_client(hostname, port),
 	key(fmt::format("{:16x}", time(nullptr))),
 	state(HTTP_HEADERS),
-	path(urlpath)
+	path(urlpath),
+	fragmented(false),
+	max_message_size(DEFAULT_MAX_MESSAGE_SIZE)
 {
 }
 
 void websocket_client::Connect()
 {
 	state = HTTP_HEADERS;
+	fragments.clear();
+	fragmented = false;
 	/* Send headers synchronously */
 	this->write(
 		fmt::format(
@@ -73,6 +88,12 @@ bool websocket_client::HandleFrame(const std::string &buffer)
 	return true;
 }
 
+bool websocket_client::HandleFrame(std::string_view buffer)
+{
+	/* For classes that derive the websocket client and only override the std::string version */
+	return this->HandleFrame(std::string(buffer));
+}
+
 size_t websocket_client::FillHeader(unsigned char* outbuf, size_t sendlength, ws_opcode opcode)
 {
 	size_t pos = 0;
@@ -109,17 +130,25 @@ size_t websocket_client::FillHeader(unsigned char* outbuf, size_t sendlength, ws
 }
 
 
+void websocket_client::WriteFrame(std::string_view payload, ws_opcode opcode)
+{
+	/* The header and payload go out as one buffer, copied once, rather than as two writes */
+	unsigned char out[MAXHEADERSIZE];
+	size_t s = this->FillHeader(out, payload.length(), opcode);
+	std::string frame;
+	frame.reserve(s + payload.length());
+	frame.append((const char*)out, s);
+	frame.append(payload.data(), payload.length());
+	ssl_client::write_buffer(std::move(frame));
+}
+
 void websocket_client::write(const std::string &data)
 {
 	if (state == HTTP_HEADERS) {
 		/* Simple write */
 		ssl_client::write(data);
 	} else {
-		unsigned char out[MAXHEADERSIZE];
-		size_t s = this->FillHeader(out, data.length(), OP_BINARY);
-		std::string header((const char*)out, s);
-		ssl_client::write(header);
-		ssl_client::write(data);
+		WriteFrame(data, OP_BINARY);
 	}
 }
 
@@ -172,9 +201,15 @@ bool websocket_client::handle_buffer(std::string &buffer)
 				}
 			}
 		break;
-		case CONNECTED:
-			/* Process packets until we can't */
-			while (this->parseheader(buffer));
+		case CONNECTED: {
+			/* Process packets until we can't, then remove them all from the buffer at once, rather than
+			 * moving the rest of the buffer down after each one. Frames are handled in place, so a large
+			 * frame which arrives over many reads is never copied, and the buffer's capacity is reused.
+			 */
+			size_t offset = 0;
+			while (this->parseheader(buffer, offset));
+			buffer.erase(0, std::min(offset, buffer.size()));
+		}
 		break;
 	}
 	return true;
@@ -185,12 +220,13 @@ ws_state websocket_client::GetState()
 	return this->state;
 }
 
-bool websocket_client::parseheader(std::string &data)
+bool websocket_client::parseheader(std::string &buffer, size_t &offset)
 {
-	if (data.size() < 4) {
+	if (offset >= buffer.size() || buffer.size() - offset < 4) {
 		/* Not enough data to form a frame yet */
 		return false;
 	} else {
+		std::string_view data(buffer.data() + offset, buffer.size() - offset);
 		unsigned char opcode = data[0];
 		switch (opcode & ~WS_FINBIT)
 		{
@@ -202,13 +238,12 @@ bool websocket_client::parseheader(std::string &data)
 			{
 				unsigned char len1 = data[1];
 				unsigned int payloadstartoffset = 2;
+				bool masked = (len1 & WS_MASKBIT);
+				bool fin = (opcode & WS_FINBIT);
+				opcode &= ~WS_FINBIT;
 
-				if (len1 & WS_MASKBIT) {
-					len1 &= ~WS_MASKBIT;
-					payloadstartoffset += 2;
-					/* We don't handle masked data, because discord doesnt send it */
-					return true;
-				}
+				/* Servers shouldn't mask frames, and discord doesn't, but we can unmask them if they do */
+				len1 &= ~WS_MASKBIT;
 
 				/* 6 bit ("small") length frame */
 				uint64_t len = len1;
@@ -239,22 +274,71 @@ bool websocket_client::parseheader(std::string &data)
 					payloadstartoffset += 8;
 				}
 
+				unsigned int maskoffset = payloadstartoffset;
+				if (masked) {
+					payloadstartoffset += 4;
+				}
+
+				/* Refuse messages bigger than the limit as soon as we see the header, rather than after buffering them */
+				if (len > max_message_size || (opcode == OP_CONTINUATION && fragments.length() + len > max_message_size)) {
+					log(dpp::ll_error, fmt::format("Websocket message of at least {} bytes is over the limit of {} bytes, disconnecting", (opcode == OP_CONTINUATION ? fragments.length() : 0) + len, max_message_size));
+					this->Error(WS_CLOSE_TOO_BIG);
+					/* The I/O loop sees the connection end */
+					shutdown(sfd, 2);
+					return false;
+				}
+
 				if (data.length() < payloadstartoffset + len) {
-					/* We don't have a complete frame yet */
+					/* We don't have a complete frame yet. Make room for all of it, so the buffer grows once. */
+					buffer.reserve(offset + payloadstartoffset + len);
 					return false;
 				}
 
-				if ((opcode & ~WS_FINBIT) == OP_PING || (opcode & ~WS_FINBIT) == OP_PONG) {
-					HandlePingPong((opcode & ~WS_FINBIT) == OP_PING, data.substr(payloadstartoffset, len));
+				if (masked) {
+					char* payload = buffer.data() + offset + payloadstartoffset;
+					for (uint64_t i = 0; i < len; ++i) {
+						payload[i] ^= data[maskoffset + (i % 4)];
+					}
+				}
+				std::string_view payload = data.substr(payloadstartoffset, len);
+
+				/* Move past this frame before handling it; the handler may close the connection, clearing the buffer */
+				offset += payloadstartoffset + len;
+
+				if (opcode == OP_PING || opcode == OP_PONG) {
+					/* Control frames can come between the fragments of a message */
+					HandlePingPong(opcode == OP_PING, payload);
+				} else if (opcode == OP_CONTINUATION) {
+					if (!fragmented) {
+						/* Nothing to continue, so the frame is ignored */
+						this->Error(WS_CLOSE_PROTOCOL_ERROR);
+					} else {
+						fragments.append(payload.data(), payload.length());
+						if (fin) {
+							/* Pass the reassembled message to the deriving class */
+							fragmented = false;
+							this->HandleFrame(std::string_view(fragments));
+							fragments.clear();
+						}
+					}
 				} else {
-					/* Pass this frame to the deriving class */
-					this->HandleFrame(data.substr(payloadstartoffset, len));
+					if (fragmented) {
+						/* A new message before the last one ended. The unfinished one is dropped. */
+						this->Error(WS_CLOSE_PROTOCOL_ERROR);
+						fragments.clear();
+						fragmented = false;
+					}
+					if (fin) {
+						/* Pass this frame to the deriving class, straight from the receive buffer */
+						this->HandleFrame(payload);
+					} else {
+						/* The first fragment of a message. The rest follow in continuation frames. */
+						fragments.assign(payload.data(), payload.length());
+						fragmented = true;
+					}
 				}
 
-				/* Remove this frame from the input buffer */
-				data.erase(data.begin(), data.begin() + payloadstartoffset + len);
-
-				return true;
+				return offset < buffer.size();
 			}
 			break;
 
@@ -283,24 +367,15 @@ void websocket_client::one_second_timer()
 {
 	if (((time(NULL) % 20) == 0) && (state == CONNECTED)) {
 		/* For sending pings, we send with payload */
-		unsigned char out[MAXHEADERSIZE];
-		std::string payload = "keepalive";
-		size_t s = this->FillHeader(out, payload.length(), OP_PING);
-		std::string header((const char*)out, s);
-		ssl_client::write(header);
-		ssl_client::write(payload);
+		WriteFrame("keepalive", OP_PING);
 	}
 }
 
-void websocket_client::HandlePingPong(bool ping, const std::string &payload)
+void websocket_client::HandlePingPong(bool ping, std::string_view payload)
 {
-	unsigned char out[MAXHEADERSIZE];
 	if (ping) {
 		/* For receiving pings we echo back their payload with the type OP_PONG */
-		size_t s = this->FillHeader(out, payload.length(), OP_PONG);
-		std::string header((const char*)out, s);
-		ssl_client::write(header);
-		ssl_client::write(payload);
+		WriteFrame(payload, OP_PONG);
 	}
 }
 
@@ -308,9 +383,21 @@ void websocket_client::Error(uint32_t errorcode)
 {
 }
 
+void websocket_client::set_max_message_size(size_t bytes)
+{
+	max_message_size = bytes;
+}
+
+size_t websocket_client::get_max_message_size() const
+{
+	return max_message_size;
+}
+
 void websocket_client::close()
 {
 	this->state = HTTP_HEADERS;
+	fragments.clear();
+	fragmented = false;
 	ssl_client::close();
 }
 
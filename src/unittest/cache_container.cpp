@@ -0,0 +1,286 @@
+#undef DPP_BUILD
+#ifdef _WIN32
+_Pragma("warning( disable : 4251 )"); // 4251 warns when we export classes or structures with stl member variables
+#endif
+#include <dpp/dpp.h>
+#include <map>
+#include <memory>
+#include <vector>
+#include "unittest.h"
+
+/* dpp::cache_container: insert, find, erase and iteration, checked against a std::map holding
+ * the same entries. The probe tests pick ids by their home slot so that runs are placed at the
+ * end of the table and wrap around to slot zero, which random ids would only rarely do.
+ */
+
+/* Same hash as cache_container::home() in cache.cpp */
+size_t home_slot(uint64_t key, size_t slot_count) {
+	unsigned int shift = 64;
+	for (size_t n = slot_count; n > 1; n >>= 1) {
+		shift--;
+	}
+	return (size_t)((key * 0x9E3779B97F4A7C15ull) >> shift);
+}
+
+/* Find count ids, starting from first, whose home slot is slot */
+std::vector<uint64_t> ids_with_home(size_t slot, size_t slot_count, size_t count, uint64_t first = 1) {
+	std::vector<uint64_t> ids;
+	for (uint64_t id = first; ids.size() < count; ++id) {
+		if (home_slot(id, slot_count) == slot) {
+			ids.push_back(id);
+		}
+	}
+	return ids;
+}
+
+/* Objects to point entries at. The container never dereferences them, only tests for nullptr. */
+std::vector<std::unique_ptr<dpp::managed>> objects;
+
+dpp::managed* object_for(uint64_t id) {
+	objects.push_back(std::make_unique<dpp::managed>(id));
+	return objects.back().get();
+}
+
+/* Every entry in the model can be found, and iteration visits exactly the model's entries */
+void check_matches(dpp::cache_container& c, const std::map<uint64_t, dpp::managed*>& model) {
+	CHECK_EQUAL(c.size(), model.size());
+	CHECK_EQUAL(c.empty(), model.empty());
+	for (auto& m : model) {
+		auto it = c.find(m.first);
+		CHECK(it != c.end());
+		if (it != c.end()) {
+			CHECK_EQUAL(it->first, m.first);
+			CHECK(it->second == m.second);
+		}
+	}
+	std::map<uint64_t, dpp::managed*> seen;
+	for (auto& e : c) {
+		CHECK(e.second != nullptr);
+		CHECK(seen.emplace(e.first, e.second).second);
+	}
+	CHECK(seen == model);
+}
+
+void test_empty() {
+	dpp::cache_container c;
+	CHECK_EQUAL(c.size(), 0u);
+	CHECK(c.empty());
+	CHECK_EQUAL(c.capacity(), 0u);
+	CHECK(c.begin() == c.end());
+	CHECK(c.find(1) == c.end());
+	CHECK_EQUAL(c.erase((uint64_t)1), 0u);
+	c.shrink_to_fit();
+	CHECK_EQUAL(c.capacity(), 0u);
+}
+
+void test_insert_find_erase() {
+	dpp::cache_container c;
+	std::map<uint64_t, dpp::managed*> model;
+	for (uint64_t id = 1000; id < 1200; ++id) {
+		dpp::managed* o = object_for(id);
+		auto r = c.insert(std::make_pair(id, o));
+		CHECK(r.second);
+		CHECK_EQUAL(r.first->first, id);
+		model[id] = o;
+	}
+	check_matches(c, model);
+
+	/* Inserting an id which is already present keeps the original object */
+	auto r = c.insert(std::make_pair((uint64_t)1100, object_for(1100)));
+	CHECK(!r.second);
+	CHECK(r.first->second == model[1100]);
+	CHECK_EQUAL(c.size(), model.size());
+
+	CHECK(c.find(999) == c.end());
+	CHECK(c.find(1200) == c.end());
+
+	for (uint64_t id = 1000; id < 1200; id += 3) {
+		CHECK_EQUAL(c.erase(id), 1u);
+		CHECK_EQUAL(c.erase(id), 0u);
+		model.erase(id);
+	}
+	check_matches(c, model);
+
+	/* Erase by iterator */
+	auto it = c.find(1001);
+	CHECK(it != c.end());
+	c.erase(it);
+	model.erase(1001);
+	check_matches(c, model);
+
+	c.clear();
+	model.clear();
+	check_matches(c, model);
+	CHECK_EQUAL(c.capacity(), 0u);
+}
+
+/* A probe run which starts in the last slot continues at slot zero */
+void test_wrap_around() {
+	dpp::cache_container c;
+	c.reserve(1);
+	size_t slot_count = c.capacity();
+	CHECK(slot_count > 0);
+
+	std::map<uint64_t, dpp::managed*> model;
+	/* Four ids wanting the last slot: one gets it, three wrap to slots 0, 1 and 2 */
+	std::vector<uint64_t> last = ids_with_home(slot_count - 1, slot_count, 4);
+	for (uint64_t id : last) {
+		dpp::managed* o = object_for(id);
+		CHECK(c.insert(std::make_pair(id, o)).second);
+		model[id] = o;
+	}
+	/* An id wanting slot one is pushed past the wrapped entries */
+	uint64_t first = ids_with_home(1, slot_count, 1)[0];
+	dpp::managed* o = object_for(first);
+	CHECK(c.insert(std::make_pair(first, o)).second);
+	model[first] = o;
+	CHECK_EQUAL(c.capacity(), slot_count);
+	check_matches(c, model);
+
+	/* Iteration starts at slot zero, so the wrapped entries come before the one in the last slot */
+	CHECK(c.begin()->first != last[0]);
+
+	/* Removing the entry in the last slot shifts the wrapped entries back across the end */
+	CHECK_EQUAL(c.erase(last[0]), 1u);
+	model.erase(last[0]);
+	check_matches(c, model);
+
+	/* Remove one of the wrapped entries, from the middle of the run */
+	CHECK_EQUAL(c.erase(last[2]), 1u);
+	model.erase(last[2]);
+	check_matches(c, model);
+}
+
+/* Deleting from the middle of a probe cluster must not cut off the entries after it */
+void test_delete_in_cluster() {
+	dpp::cache_container c;
+	c.reserve(1);
+	size_t slot_count = c.capacity();
+
+	/* One cluster over slots 4 to 8 holding two interleaved runs: three ids wanting slot 4, and
+	 * two wanting slot 5, the second of which is displaced to slot 8 past the slot 4 entries.
+	 */
+	std::vector<uint64_t> at4 = ids_with_home(4, slot_count, 3);
+	std::vector<uint64_t> at5 = ids_with_home(5, slot_count, 2);
+	std::vector<uint64_t> order = { at4[0], at5[0], at4[1], at4[2], at5[1] };
+	std::map<uint64_t, dpp::managed*> model;
+	for (uint64_t id : order) {
+		dpp::managed* o = object_for(id);
+		CHECK(c.insert(std::make_pair(id, o)).second);
+		model[id] = o;
+	}
+	check_matches(c, model);
+
+	/* Delete each entry of the cluster in turn, from the front, middle and back */
+	for (uint64_t id : { at4[1], at5[0], at4[0], at5[1], at4[2] }) {
+		CHECK_EQUAL(c.erase(id), 1u);
+		model.erase(id);
+		check_matches(c, model);
+	}
+	CHECK(c.empty());
+
+	/* An entry already in its home slot must stay there when an earlier entry is removed */
+	uint64_t a = ids_with_home(6, slot_count, 1)[0];
+	uint64_t b = ids_with_home(7, slot_count, 1)[0];
+	model[a] = object_for(a);
+	model[b] = object_for(b);
+	c.insert(std::make_pair(a, model[a]));
+	c.insert(std::make_pair(b, model[b]));
+	c.erase(a);
+	model.erase(a);
+	check_matches(c, model);
+}
+
+/* The table grows on insert, keeps entries across deletes, and shrinks only when asked */
+void test_grow_shrink() {
+	dpp::cache_container c;
+	std::map<uint64_t, dpp::managed*> model;
+	size_t last_capacity = 0;
+	for (uint64_t id = 1; id <= 5000; ++id) {
+		dpp::managed* o = object_for(id);
+		c.insert(std::make_pair(id, o));
+		model[id] = o;
+		/* Delete as we go, so that entries are moved by backward shifts before each grow */
+		if (id % 4 == 0) {
+			c.erase(id - 2);
+			model.erase(id - 2);
+		}
+		if (c.capacity() != last_capacity) {
+			CHECK(c.capacity() > last_capacity);
+			/* Power of two, and no more than three quarters full */
+			CHECK_EQUAL(c.capacity() & (c.capacity() - 1), 0u);
+			CHECK(c.size() * 4 <= c.capacity() * 3);
+			last_capacity = c.capacity();
+			check_matches(c, model);
+		}
+	}
+	check_matches(c, model);
+	CHECK(c.bytes() >= c.capacity() * sizeof(dpp::cache_container::value_type));
+
+	/* Removing entries never shrinks the table by itself */
+	for (uint64_t id = 1; id <= 5000; ++id) {
+		if (id % 10 != 0) {
+			c.erase(id);
+			model.erase(id);
+		}
+	}
+	CHECK_EQUAL(c.capacity(), last_capacity);
+	check_matches(c, model);
+
+	c.shrink_to_fit();
+	CHECK(c.capacity() < last_capacity);
+	CHECK(c.size() * 4 <= c.capacity() * 3);
+	check_matches(c, model);
+
+	/* Grow again after shrinking, over ids that were deleted */
+	for (uint64_t id = 1; id <= 5000; id += 7) {
+		if (model.find(id) == model.end()) {
+			dpp::managed* o = object_for(id);
+			CHECK(c.insert(std::make_pair(id, o)).second);
+			model[id] = o;
+		}
+	}
+	check_matches(c, model);
+
+	/* Reserve never shrinks, and shrink_to_fit of an empty container frees everything */
+	size_t before = c.capacity();
+	c.reserve(1);
+	CHECK_EQUAL(c.capacity(), before);
+	for (auto& m : model) {
+		c.erase(m.first);
+	}
+	model.clear();
+	c.shrink_to_fit();
+	CHECK_EQUAL(c.capacity(), 0u);
+	check_matches(c, model);
+}
+
+void test_ages() {
+	dpp::cache_container c;
+	uint64_t id = 42;
+	c.insert(std::make_pair(id, object_for(id)));
+	CHECK_EQUAL(c.get_age(c.find(id)), 0u);
+	c.age_all();
+	c.age_all();
+	CHECK_EQUAL(c.get_age(c.find(id)), 2u);
+	c.touch(c.find(id));
+	CHECK_EQUAL(c.get_age(c.find(id)), 0u);
+
+	/* Ages move with their entries when the table grows */
+	c.age_all();
+	for (uint64_t i = 100; i < 200; ++i) {
+		c.insert(std::make_pair(i, object_for(i)));
+	}
+	CHECK_EQUAL(c.get_age(c.find(id)), 1u);
+	CHECK_EQUAL(c.get_age(c.find(150)), 0u);
+}
+
+int main() {
+	test_empty();
+	test_insert_find_erase();
+	test_wrap_around();
+	test_delete_in_cluster();
+	test_grow_shrink();
+	test_ages();
+	return UNITTEST_RESULT();
+}
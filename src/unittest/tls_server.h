@@ -0,0 +1,124 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <stdexcept>
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+/* A local stand-in for a TLS server, so that a dpp::ssl_client, which connects in its
+ * constructor, can be created without a network connection. It listens on a free port of
+ * 127.0.0.1 with a self-signed certificate made at startup, accepts one connection, completes
+ * the handshake, and then keeps everything the client sends until it disconnects.
+ *
+ * Tests feed the client's handle_buffer() directly with what the server would have sent.
+ */
+class tls_server {
+	int listen_fd;
+	uint16_t listen_port;
+	SSL_CTX* ctx;
+	std::thread server_thread;
+	std::mutex received_mutex;
+	std::condition_variable received_cv;
+	std::string received;
+
+	/* Make a throwaway P-256 key and a self-signed certificate for it */
+	void make_certificate() {
+		EVP_PKEY* key = nullptr;
+		EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+		if (!kctx || EVP_PKEY_keygen_init(kctx) <= 0 || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) <= 0 || EVP_PKEY_keygen(kctx, &key) <= 0) {
+			EVP_PKEY_CTX_free(kctx);
+			throw std::runtime_error("Could not generate a key for the test server");
+		}
+		EVP_PKEY_CTX_free(kctx);
+
+		X509* cert = X509_new();
+		X509_set_version(cert, 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+		X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+		X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+		X509_set_pubkey(cert, key);
+		X509_NAME* name = X509_get_subject_name(cert);
+		X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+		X509_set_issuer_name(cert, name);
+		X509_sign(cert, key, EVP_sha256());
+
+		SSL_CTX_use_certificate(ctx, cert);
+		SSL_CTX_use_PrivateKey(ctx, key);
+		X509_free(cert);
+		EVP_PKEY_free(key);
+	}
+
+	void run() {
+		int fd = accept(listen_fd, nullptr, nullptr);
+		if (fd < 0) {
+			return;
+		}
+		SSL* ssl = SSL_new(ctx);
+		SSL_set_fd(ssl, fd);
+		if (SSL_accept(ssl) == 1) {
+			char data[16384];
+			int r;
+			while ((r = SSL_read(ssl, data, sizeof(data))) > 0) {
+				std::lock_guard<std::mutex> lock(received_mutex);
+				received.append(data, r);
+				received_cv.notify_all();
+			}
+		}
+		SSL_free(ssl);
+		::close(fd);
+	}
+
+public:
+	tls_server() : listen_fd(-1), listen_port(0), ctx(SSL_CTX_new(TLS_server_method())) {
+		if (!ctx) {
+			throw std::runtime_error("Could not create the test server's TLS context");
+		}
+		make_certificate();
+
+		listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		socklen_t len = sizeof(addr);
+		if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 1) != 0 || getsockname(listen_fd, (sockaddr*)&addr, &len) != 0) {
+			throw std::runtime_error("Could not listen on 127.0.0.1 for the test server");
+		}
+		listen_port = ntohs(addr.sin_port);
+		server_thread = std::thread(&tls_server::run, this);
+	}
+
+	/* Waits for the client to disconnect, so destroy the client first */
+	~tls_server() {
+		/* Wakes the accept() if no client ever connected */
+		shutdown(listen_fd, SHUT_RDWR);
+		server_thread.join();
+		::close(listen_fd);
+		SSL_CTX_free(ctx);
+	}
+
+	std::string host() const {
+		return "127.0.0.1";
+	}
+
+	std::string port() const {
+		return std::to_string(listen_port);
+	}
+
+	/* Wait up to five seconds until the client has sent at least this many bytes, then take them */
+	std::string take_received(size_t bytes) {
+		std::unique_lock<std::mutex> lock(received_mutex);
+		received_cv.wait_for(lock, std::chrono::seconds(5), [&] { return received.size() >= bytes; });
+		std::string r;
+		r.swap(received);
+		return r;
+	}
+};
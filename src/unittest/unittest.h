@@ -0,0 +1,29 @@
+#pragma once
+#include <iostream>
+
+/* Checks for the unit test programs. Each program in src/unittest is registered with ctest,
+ * prints every failed check, and exits non-zero if there were any.
+ */
+
+static int unittest_failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+			unittest_failures++; \
+		} \
+	} while (0)
+
+#define CHECK_EQUAL(actual, expected) \
+	do { \
+		auto unittest_a = (actual); \
+		auto unittest_e = (expected); \
+		if (!(unittest_a == unittest_e)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #actual " is " << unittest_a << ", expected " << unittest_e << std::endl; \
+			unittest_failures++; \
+		} \
+	} while (0)
+
+/* Return from main() with this */
+#define UNITTEST_RESULT() (unittest_failures ? (std::cerr << unittest_failures << " checks failed" << std::endl, 1) : 0)
@@ -0,0 +1,222 @@
+#undef DPP_BUILD
+#ifdef _WIN32
+_Pragma("warning( disable : 4251 )"); // 4251 warns when we export classes or structures with stl member variables
+#endif
+#include <dpp/dpp.h>
+#include <string>
+#include <vector>
+#include "unittest.h"
+#include "tls_server.h"
+
+/* dpp::websocket_client's frame parser. Each test connects a client to a local TLS stand-in,
+ * completes the upgrade by passing the 101 response to handle_buffer(), then passes it frames
+ * as the server would send them, split into reads in different ways.
+ */
+
+const uint32_t WS_CLOSE_PROTOCOL_ERROR = 1002;
+const uint32_t WS_CLOSE_TOO_BIG = 1009;
+
+/* Build a frame as a server sends it, with an optional mask */
+std::string frame(dpp::ws_opcode opcode, bool fin, const std::string& payload, const char* mask = nullptr) {
+	std::string f;
+	f += (char)(opcode | (fin ? 0x80 : 0));
+	unsigned char maskbit = mask ? 0x80 : 0;
+	size_t n = payload.size();
+	if (n <= 125) {
+		f += (char)(n | maskbit);
+	} else if (n <= 65535) {
+		f += (char)(126 | maskbit);
+		f += (char)(n >> 8);
+		f += (char)(n & 0xff);
+	} else {
+		f += (char)(127 | maskbit);
+		for (int i = 7; i >= 0; --i) {
+			f += (char)((uint64_t)n >> (i * 8));
+		}
+	}
+	if (mask) {
+		f.append(mask, 4);
+		for (size_t i = 0; i < n; ++i) {
+			f += (char)(payload[i] ^ mask[i % 4]);
+		}
+	} else {
+		f += payload;
+	}
+	return f;
+}
+
+class test_client : public dpp::websocket_client {
+public:
+	/* Complete messages passed up by the parser */
+	std::vector<std::string> messages;
+	/* Close codes passed to Error() */
+	std::vector<uint32_t> errors;
+	/* What has been received but not yet parsed, as ssl_client keeps it between reads */
+	std::string pending;
+
+	test_client(const tls_server& server) : dpp::websocket_client(server.host(), server.port(), "/") {
+		std::string upgrade = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n";
+		handle_buffer(upgrade);
+	}
+
+	/* One read from the socket */
+	void receive(const std::string& data) {
+		pending += data;
+		handle_buffer(pending);
+	}
+
+	using dpp::websocket_client::HandleFrame;
+
+	bool HandleFrame(std::string_view buffer) override {
+		messages.emplace_back(buffer);
+		return true;
+	}
+
+	void Error(uint32_t errorcode) override {
+		errors.push_back(errorcode);
+	}
+
+	void log(dpp::loglevel severity, const std::string &msg) const override {
+	}
+};
+
+/* A frame arriving over many reads is passed up once, when its last byte arrives */
+void test_split_frame() {
+	for (size_t length : { (size_t)5, (size_t)300, (size_t)70000 }) {
+		tls_server server;
+		test_client client(server);
+		std::string payload;
+		for (size_t i = 0; i < length; ++i) {
+			payload += (char)('a' + i % 26);
+		}
+		std::string f = frame(dpp::OP_TEXT, true, payload);
+
+		/* One byte at a time through the header, so that every partial header length is seen, then bigger reads */
+		size_t pos = 0;
+		for (; pos < 12 && pos < f.size() - 1; ++pos) {
+			client.receive(f.substr(pos, 1));
+			CHECK(client.messages.empty());
+		}
+		for (; pos < f.size() - 1; pos += 4096) {
+			client.receive(f.substr(pos, std::min((size_t)4096, f.size() - 1 - pos)));
+			CHECK(client.messages.empty());
+		}
+		client.receive(f.substr(f.size() - 1));
+		CHECK_EQUAL(client.messages.size(), 1u);
+		CHECK(client.messages.size() == 1 && client.messages[0] == payload);
+		CHECK(client.pending.empty());
+		CHECK(client.errors.empty());
+	}
+}
+
+/* Several frames in one read are all passed up in order, and a partial one at the end is kept */
+void test_several_frames() {
+	tls_server server;
+	test_client client(server);
+	std::string big(1000, 'x');
+	std::string last = frame(dpp::OP_TEXT, true, "last");
+	client.receive(frame(dpp::OP_TEXT, true, "one") + frame(dpp::OP_BINARY, true, big) + frame(dpp::OP_TEXT, true, "") + last.substr(0, 3));
+	CHECK_EQUAL(client.messages.size(), 3u);
+	if (client.messages.size() == 3) {
+		CHECK_EQUAL(client.messages[0], "one");
+		CHECK(client.messages[1] == big);
+		CHECK_EQUAL(client.messages[2], "");
+	}
+	CHECK_EQUAL(client.pending, last.substr(0, 3));
+
+	client.receive(last.substr(3));
+	CHECK_EQUAL(client.messages.size(), 4u);
+	CHECK(client.messages.size() == 4 && client.messages[3] == "last");
+	CHECK(client.pending.empty());
+
+	/* A masked frame is unmasked */
+	const char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+	client.receive(frame(dpp::OP_TEXT, true, "masked payload", mask));
+	CHECK(client.messages.size() == 5 && client.messages[4] == "masked payload");
+	CHECK(client.errors.empty());
+}
+
+/* A ping between the fragments of a message is answered, and the message is still put together */
+void test_fragments_with_ping() {
+	tls_server server;
+	test_client client(server);
+	std::string stream = frame(dpp::OP_TEXT, false, "frag") + frame(dpp::OP_PING, true, "pg") + frame(dpp::OP_CONTINUATION, false, "ment") + frame(dpp::OP_CONTINUATION, true, "ed");
+
+	/* All in one read, then again split inside the ping */
+	client.receive(stream);
+	CHECK_EQUAL(client.messages.size(), 1u);
+	CHECK(client.messages.size() == 1 && client.messages[0] == "fragmented");
+	size_t cut = frame(dpp::OP_TEXT, false, "frag").size() + 3;
+	client.receive(stream.substr(0, cut));
+	CHECK_EQUAL(client.messages.size(), 1u);
+	client.receive(stream.substr(cut));
+	CHECK_EQUAL(client.messages.size(), 2u);
+	CHECK(client.messages.size() == 2 && client.messages[1] == "fragmented");
+	CHECK(client.errors.empty());
+	CHECK(client.pending.empty());
+
+	/* Each ping got a pong with the same payload: final bit, pong opcode, masked, and a zero mask */
+	std::string pong = std::string("\x8a\x82\0\0\0\0pg", 8);
+	CHECK(server.take_received(pong.size() * 2) == pong + pong);
+}
+
+/* A continuation frame with no message to continue is a protocol error, and is not passed up */
+void test_stray_continuation() {
+	tls_server server;
+	test_client client(server);
+	client.receive(frame(dpp::OP_CONTINUATION, true, "orphan") + frame(dpp::OP_TEXT, true, "after"));
+	CHECK_EQUAL(client.errors.size(), 1u);
+	CHECK(client.errors.size() == 1 && client.errors[0] == WS_CLOSE_PROTOCOL_ERROR);
+	CHECK_EQUAL(client.messages.size(), 1u);
+	CHECK(client.messages.size() == 1 && client.messages[0] == "after");
+
+	/* So is a new message before the last one was finished, which drops the unfinished one */
+	client.errors.clear();
+	client.messages.clear();
+	client.receive(frame(dpp::OP_TEXT, false, "unfinished") + frame(dpp::OP_TEXT, true, "new") + frame(dpp::OP_CONTINUATION, true, "late"));
+	CHECK_EQUAL(client.errors.size(), 2u);
+	CHECK(client.errors.size() == 2 && client.errors[0] == WS_CLOSE_PROTOCOL_ERROR && client.errors[1] == WS_CLOSE_PROTOCOL_ERROR);
+	CHECK_EQUAL(client.messages.size(), 1u);
+	CHECK(client.messages.size() == 1 && client.messages[0] == "new");
+}
+
+/* A message over the size limit is refused as soon as its header arrives */
+void test_oversize() {
+	{
+		tls_server server;
+		test_client client(server);
+		client.set_max_message_size(1000);
+		CHECK_EQUAL(client.get_max_message_size(), 1000u);
+
+		/* At the limit is fine */
+		client.receive(frame(dpp::OP_BINARY, true, std::string(1000, 'k')));
+		CHECK_EQUAL(client.messages.size(), 1u);
+		CHECK(client.errors.empty());
+
+		/* Only the header of a 64 bit length frame, with none of its payload */
+		std::string f = frame(dpp::OP_BINARY, true, std::string(70000, 'k'));
+		client.receive(f.substr(0, 10));
+		CHECK_EQUAL(client.errors.size(), 1u);
+		CHECK(client.errors.size() == 1 && client.errors[0] == WS_CLOSE_TOO_BIG);
+		CHECK_EQUAL(client.messages.size(), 1u);
+	}
+	{
+		/* Fragments which are each under the limit, but not together */
+		tls_server server;
+		test_client client(server);
+		client.set_max_message_size(10);
+		client.receive(frame(dpp::OP_TEXT, false, "123456") + frame(dpp::OP_CONTINUATION, true, "789012"));
+		CHECK_EQUAL(client.errors.size(), 1u);
+		CHECK(client.errors.size() == 1 && client.errors[0] == WS_CLOSE_TOO_BIG);
+		CHECK(client.messages.empty());
+	}
+}
+
+int main() {
+	test_split_frame();
+	test_several_frames();
+	test_fragments_with_ping();
+	test_stray_continuation();
+	test_oversize();
+	return UNITTEST_RESULT();
+}
@@ -0,0 +1,281 @@
+#undef DPP_BUILD
+#ifdef _WIN32
+_Pragma("warning( disable : 4251 )"); // 4251 warns when we export classes or structures with stl member variables
+#endif
+#include <dpp/dpp.h>
+#include <dpp/nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include "unittest.h"
+
+/* dpp::zstd_stream, which decompresses zstd-stream gateway connections, replaying frames of a
+ * captured stream. The stream is one zstd frame for the whole connection, flushed at the end of
+ * each message, as Discord sends it. They were made with python's zstandard module:
+ *
+ *	c = zstandard.ZstdCompressor(level=3).compressobj()
+ *	frame = c.compress(message) + c.flush(zstandard.COMPRESSOBJ_FLUSH_BLOCK)
+ *
+ * The messages are HELLO, a heartbeat ACK, a MESSAGE_CREATE, and a GUILD_MEMBERS_CHUNK of 600
+ * members, which decompresses to over fifty times its size, so the output buffer is grown many
+ * times for one frame.
+ */
+
+const std::vector<std::string> captured_frames = {
+	/* 115 bytes, decompresses to 124 */
+	std::string(
+		"\x28\xb5\x2f\xfd\x00\x58\x54\x03\x00\x42\x87\x18\x1b\x60\x89\xdb\x14\x45\xfc\xde"
+		"\xc0\x7e\x05\xb5\x6b\x28\xe1\x3f\x10\x04\x6a\x9a\xa8\xc9\x08\x9f\x31\x08\x02\xbb"
+		"\x51\x64\xdc\x88\x14\x40\xe5\x99\x6b\x38\x59\x0e\x67\x2f\x9d\x41\x04\x56\x88\xe0"
+		"\x6a\xa7\x8b\xee\x41\x85\x1d\x4c\x28\xb4\xad\x85\xb3\xe2\x45\x7e\x13\xe5\x3e\x9e"
+		"\xd4\x20\xb0\x04\xf9\xa6\x08\xde\x66\x96\xa3\x75\x91\x66\x5d\xc3\x5f\x5e\x79\x52"
+		"\x2b\xef\x34\xee\xa9\xb5\x87\xc9\xf7\x5f\x01\x00\x24\x4a\x12"
+		, 115),
+	/* 17 bytes, decompresses to 36 */
+	std::string(
+		"\x74\x00\x00\x30\x31\x6e\x75\x6c\x6c\x7d\x02\x00\x20\xc8\xbf\x04\x20"
+		, 17),
+	/* 282 bytes, decompresses to 403 */
+	std::string(
+		"\xbc\x08\x00\x16\xd3\x3b\x23\x30\x89\x56\x07\x60\x3e\x3d\x31\x18\x52\x89\x1a\x59"
+		"\x8c\x02\x79\x7e\xd3\xbd\xf2\x49\xd5\x52\x03\x6d\x5b\x31\x23\x86\xc2\x45\x44\x44"
+		"\x81\x01\x34\x00\x32\x00\x31\x00\x00\xbb\xdb\x52\x0b\x58\x0b\x2a\x0b\x5d\x52\x24"
+		"\x75\x78\x7b\x48\x6a\xd5\xe1\x21\x4e\xec\xca\x8e\xec\x23\xae\x8f\x88\x00\x5f\xbb"
+		"\x8f\x16\x9e\x21\x09\xad\xce\x28\x10\x4c\x81\xc0\x82\x19\x40\x24\x12\x0c\xc1\x03"
+		"\x6b\x59\xd6\xd4\xa2\x79\xc8\x48\xe3\xe8\x4e\xb1\xb5\xa8\x55\xe9\xa5\xa6\xd6\x7b"
+		"\xce\x1d\xbe\x91\x3c\x9f\x04\xca\x12\xe6\xc7\x43\x17\x07\x06\xf0\x75\x3e\xb2\x27"
+		"\x3b\x0d\xcf\x29\x21\x47\xdf\x85\xbb\x01\xe9\x29\xa5\xbd\xb6\x3c\x97\xde\x95\xfb"
+		"\xf0\xec\xc4\x49\xb9\x46\xbe\x00\x4f\x1f\x47\x47\xe2\xd1\xd3\xc2\x96\xc5\xd6\x6a"
+		"\x0a\x6b\xc9\x29\xee\xc1\x73\x46\x07\xe3\xe8\x8a\x29\xab\x29\xad\x2d\x6e\x05\x93"
+		"\xc9\xb9\x11\x6b\x65\xc7\xd0\x95\xdb\xe0\x44\xa6\x5d\x0d\x4d\x57\x85\xc3\xf7\xe4"
+		"\x9e\x0f\xe3\x68\x42\x63\x47\xc9\xee\x1e\x9e\x3e\x1d\xa7\x74\x24\x65\x54\xd9\x1c"
+		"\x5d\xa5\xb6\xcb\x36\x0d\x00\x89\x3b\x1a\x50\xdc\xd2\x3d\x64\x7d\x51\x04\x63\xa8"
+		"\x41\xba\x2a\xa2\xcd\xfe\x62\x0a\x55\x02\x2c\xb1\x7a\x12\x2c\x9b\xeb\x65\x6e\x4f"
+		"\xab\x80"
+		, 282),
+	/* 2256 bytes, decompresses to 127812 */
+	std::string(
+		"\x6c\x46\x00\xaa\x7f\x60\x0f\x1e\x20\x55\x0a\x39\xc0\x95\x0a\x5f\xf3\x2e\xb1\xa2"
+		"\x97\x71\x3b\x2f\x31\xbc\xd3\xb6\xa4\x24\xdc\xc5\xa1\x03\x00\x03\x18\x07\x25\x01"
+		"\xe6\x00\xca\x00\x1b\x37\x6e\xdc\xb8\x71\xe3\xc6\x89\x12\xa5\x49\x93\x26\x4d\x9a"
+		"\x34\x69\x5a\x68\x68\x8b\xb1\xc5\x18\xd2\x62\x68\x31\x86\xb4\x18\x5a\x8c\x21\x2d"
+		"\x86\x16\x63\x48\x8b\xa1\xc5\xd0\x68\x46\x33\x63\x31\x33\x16\x33\x63\x31\x33\x16"
+		"\x33\x63\x31\x33\x16\x33\x63\x31\x33\x16\xf3\xb1\xf8\xc7\xe2\x9f\x7f\xfe\xf9\xe7"
+		"\x9f\x7f\xfe\xf9\xe7\x32\x22\x23\x72\x91\x8b\x5c\xe4\x22\x17\xb9\xc8\x45\x2e\x8b"
+		"\x2f\x16\x5f\x2c\x64\xb1\x90\xc5\x42\x16\x0b\x59\x2c\x64\xb1\x90\xc5\x42\x16\x0b"
+		"\x59\x58\x6c\xb1\x17\xf6\xc2\x5e\xd8\x0b\x7b\x61\x2f\xec\x85\xbd\x70\x17\xed\xa2"
+		"\x75\xeb\xd6\xad\x5b\xb7\x6e\xdd\xba\x34\x69\xb2\x64\xc9\x92\x25\x4b\x96\x2c\x59"
+		"\xae\x5b\x37\x6e\xdc\xb8\x71\xe3\xc6\x8d\x1b\x27\x4a\x94\x26\x4d\x9a\x34\x69\xd2"
+		"\xa4\x69\x1a\xcd\xc7\x2e\x23\x8b\x2f\x2c\xee\xa2\x34\xd7\x89\x02\x50\x42\xc4\x08"
+		"\x0f\x1a\x2c\x50\x64\x10\x0a\x10\x0f\xf8\x06\x6c\x11\x64\x01\x28\xc2\x42\x85\x0c"
+		"\x14\x15\x1b\x3e\x70\xe8\x80\x61\x43\xc5\x04\x00\x0a\x13\xf3\x88\xcc\xc7\x3a\x24"
+		"\xd5\xfb\xc4\x18\x13\x06\x4c\x84\x00\x41\x71\xc1\x03\x85\x87\x09\x00\x1a\x30\x21"
+		"\xa2\x62\xc4\x07\x0c\x24\x28\x32\x54\x6c\xa8\xd0\xa1\x62\x04\x17\x38\x90\x90\xa0"
+		"\x40\x05\x08\x0f\x0e\x10\x68\x70\xa0\x41\x05\x03\x0c\x14\x48\x40\x10\xdb\xb7\x6f"
+		"\xdf\xbe\x7d\xfb\x26\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26"
+		"\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26"
+		"\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26"
+		"\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26"
+		"\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26"
+		"\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\xc9\x26\x9b\x6c\xb2\x69\x6c\x34\xa3\x99\x21\x33"
+		"\x43\x66\x86\xcc\x0c\x99\x19\x32\x33\x64\x66\xc8\xcc\x90\xf9\x90\x7f\xc8\x3f\xff"
+		"\xfc\xf3\xcf\x3f\xff\xfc\xf3\xcf\x65\x44\x46\xe4\x22\x17\xb9\xc8\x45\x2e\x72\x91"
+		"\x8b\x5c\x16\x5f\x2c\xbe\x58\xc8\x62\x21\x8b\x85\x2c\x16\xb2\x58\xc8\x62\x21\x8b"
+		"\x85\x2c\x16\xb2\xb0\x58\xec\x85\xbd\xb0\x17\xf6\xc2\x5e\xd8\x0b\x7b\x61\x2f\xdc"
+		"\x45\xbb\x68\xdd\xba\x75\xeb\xd6\xad\x5b\xb7\x2e\x4d\x9a\x2c\x59\xb2\x64\xc9\x92"
+		"\x25\x4b\x96\xeb\xd6\x8d\x01\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b"
+		"\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b"
+		"\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b"
+		"\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b"
+		"\xed\xb4\xd3\x4e\x3b\xed\xb4\x53\x0e\x39\xe4\x90\x43\x0e\x39\xe4\x90\x43\x0e\x39"
+		"\xe4\x90\x43\x9e\x3c\x79\xf2\xe4\xc9\x93\x27\x4f\x9e\x3c\x79\xf2\xe4\xc9\x93\x27"
+		"\x4f\x9e\x3c\x79\xf2\xe4\xc9\x93\x27\x4f\x9e\x3c\x79\xf2\xe4\xc9\x93\x27\x4f\x9e"
+		"\x3c\x79\xf2\xe4\xc9\x93\x27\x4f\x9e\x3c\x79\xf2\xe4\xc9\x93\x27\x4f\x9e\x3c\x79"
+		"\xf2\xe4\xc9\x93\x27\x4f\x9e\x3c\x79\xf2\xe4\xc9\x93\x27\x4f\x9e\x3c\x79\xf2\xe4"
+		"\xc9\x93\x27\x4f\x9e\x3c\x79\xf2\xe4\xc9\x93\x27\x4f\x9e\x3c\x79\xf2\xe4\xc9\x93"
+		"\x27\xcf\x7d\xfb\xf6\xed\xdb\xb7\x07\x25\x4a\x50\xb0\x6c\xd9\xb2\x65\xcb\x96\x2d"
+		"\x5b\xb6\x6c\xd9\xb2\x65\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64"
+		"\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d"
+		"\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90"
+		"\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6"
+		"\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43"
+		"\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9"
+		"\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f"
+		"\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\x64\x0f\xd9\x43\xf6\x90\x3d\xe4"
+		"\x0e\xb5\x43\xed\x50\x3b\xd4\x0e\xb5\x43\xed\x50\x3b\xd4\x0e\xb5\x43\xed\x50\x3b"
+		"\xd4\x4e\x3b\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b\xed\xb4"
+		"\xd3\x4e\x3b\xed\xb4\xd3\x4e\x3b\xed\xb4\x01\x87\x1d\xa8\x43\x50\x8e\xa5\x8c\x5a"
+		"\x69\x0c\x83\x1f\xa5\x20\x29\x56\x03\x13\x90\x80\x40\x00\x02\x02\x01\x05\x04\x82"
+		"\x40\x82\x40\x83\xa9\x00\x13\x61\x80\x10\xac\x10\x9c\x10\xdc\x1f\x84\x0e\x2a\x41"
+		"\x05\x68\x01\x69\xd0\x14\x84\x81\x00\x50\x03\x12\x41\x11\xf4\x00\x81\x1a\x88\x28"
+		"\x20\x96\x82\x66\x03\x42\xef\x20\x49\x81\xfc\x01\xea\x48\xd0\x62\x40\xec\x0d\xc2"
+		"\x19\x88\x3e\x41\x46\x04\x7d\x06\x88\xb9\x41\x24\x03\xd9\x07\x24\x4b\xd0\x6a\x82"
+		"\xc8\x19\xc4\x53\x20\xf3\x80\x14\x09\x7a\x0d\x08\xbe\x41\x34\x0b\x92\x0f\x90\x17"
+		"\x41\x8f\x01\x21\x37\xc8\x66\x20\xfc\x80\x54\x35\xe8\x18\x20\x7e\x06\x99\x0c\x44"
+		"\x1e\x90\x2b\x41\xb3\x01\x41\xef\x20\x49\x81\xfc\x01\x72\x24\x68\x31\x20\xf6\x06"
+		"\xe1\x14\x88\x3e\x41\x46\x04\x7d\x03\xc4\xdc\x20\x92\x81\xec\x03\x2a\x4b\xd0\x6a"
+		"\x82\xc8\x19\xe4\x29\x90\x79\x40\x8a\x04\xbd\x0d\x08\xbe\x41\x34\x0b\x92\x07\xc8"
+		"\x8b\xa0\xc7\x80\x90\x33\xc8\x66\x20\xfc\x80\x54\x19\x74\x0c\x10\x3f\x83\x4c\x06"
+		"\x22\x1e\x90\x2b\x41\xb3\x01\xa1\x77\x90\xa4\x40\xfe\x00\x39\x2a\x68\x31\x20\xf6"
+		"\x06\xe1\x0c\x44\x9f\x20\x23\x82\xbe\x01\xca\xdc\x20\x92\x81\xec\x03\x92\x25\x68"
+		"\x35\x41\xe4\x0c\x72\x29\x90\x79\x40\x8a\x04\xbd\x06\x04\xdf\x20\x9a\x05\xc9\x03"
+		"\xc4\x8b\xa0\xc7\x80\x90\x1b\xa4\x81\x34\x68\x06\xd2\x40\x10\xa8\x01\xa9\xa0\x08"
+		"\xfa\x80\x54\x50\x09\x7a\x40\x24\x28\x82\x3e\x20\x19\x24\x82\x9e\x20\x09\x8a\x40"
+		"\x0f\x48\x06\x85\xa0\x0f\x48\x82\x62\xd0\x03\x12\x41\x11\xf4\x03\x92\xa0\x12\xf4"
+		"\x80\x4c\x50\x04\xed\x80\x24\xa8\x04\x3d\x41\x12\x14\x83\x1e\x20\x09\x14\x41\x4f"
+		"\x90\x04\xc5\xa0\x07\x44\x05\x45\xd0\x03\x24\x41\x31\xe8\x01\x59\x41\x11\xf4\x01"
+		"\x49\x50\x08\x7a\x40\x26\x68\x0c\x7a\x40\x32\x28\x82\x1e\x20\x09\x0a\x83\x1e\x90"
+		"\x0a\x8a\xa0\x0f\x48\x82\x42\x90\x07\xa4\x82\x22\xe8\x03\x92\xa0\x12\xf4\x01\x91"
+		"\xa0\x08\xfa\x80\x64\x50\x04\x7d\x82\x24\x28\x02\x3d\x20\x19\x14\x41\x1f\x10\x09"
+		"\x8a\x41\x0f\x48\x04\x45\xd0\x07\x24\x82\x4a\xd0\x03\x32\x41\x11\xb4\x01\x49\xd0"
+		"\x12\xf4\x04\x49\x50\x0c\x7a\x40\x12\xa8\x04\x3d\x41\x12\x14\x83\x1e\x90\x0a\x0a"
+		"\x41\x0f\x90\x04\xc5\xa0\x07\x64\x82\x22\xe8\x06\x24\x41\x21\xe8\x01\x99\xa0\x18"
+		"\xf4\x01\xc9\xa0\x08\x7a\x80\x24\x28\x06\x3d\xa0\x2a\x28\x82\x3e\x20\x09\x0a\x41"
+		"\x0f\x88\x0a\x8a\xa0\x0f\x48\x82\x4a\xd0\x03\x22\x41\x22\xe8\x03\x92\x41\x11\xf4"
+		"\x04\x49\x50\x09\xf4\x80\x64\x50\x04\x7d\x40\x12\x14\x07\x3d\x20\x11\x14\x41\x1f"
+		"\x90\x04\x95\x20\x0f\xc8\x04\x45\xd0\x06\x24\x41\x25\xe8\x11\x24\x41\x31\xe8\x01"
+		"\x49\xa0\x08\x7a\x82\x4a\x50\x0c\x7a\x40\x2a\x28\x82\x1e\x20\x13\x14\x83\x1e\x90"
+		"\x09\x8a\xa0\x0f\x48\x04\x85\xa0\x07\x64\x82\x62\xd0\x03\x92\x41\x21\xe8\x01\x92"
+		"\xa0\x18\xf4\x80\x54\x50\x0c\xfa\x80\x24\x28\x04\x3d\x20\x15\x14\x41\x3f\x20\x09"
+		"\x2a\x41\x0f\x88\x04\x45\xd0\x0d\x48\x06\x45\xd0\x13\x24\x41\x11\xe8\x01\x91\x41"
+		"\x11\xf4\x01\x49\x50\x0c\x7a\x40\x46\x50\x04\x7d\x40\x12\x54\x82\x1e\x90\x15\x14"
+		"\x41\x1b\x90\x04\x95\xa0\x27\x48\x82\xc4\xa0\x07\x24\x81\x22\xe8\x09\x92\xa0\x28"
+		"\xe8\x01\xa9\xa0\x08\x7a\x80\x24\x28\x06\x7d\x40\x26\x28\x82\x3e\x20\x09\x0a\x41"
+		"\x1f\x90\x09\x8a\x41\x0f\x48\x06\x45\xd0\x03\x48\x82\x62\xd0\x03\x52\x41\x11\xf4"
+		"\x01\x91\xa0\x10\xf4\x80\x54\x50\x04\x7d\x40\x2a\xa8\x60\x82\x6e\xa6\xf3\xd1\x67"
+		"\x07\x4d\x20\x54\x00\xc1\x05\x84\xd2\xa0\x63\x80\xf8\x19\x64\x32\x10\x79\x80\x5c"
+		"\x09\x9a\x0d\x08\xbd\x83\x14\x48\x07\x4d\x20\x2c\x08\x80\x1a\x20\x09\x0a\x41\x0f"
+		"\x48\x0a\x8a\xa0\x0f\x48\x82\x62\xd0\x03\x32\x41\x23\xe8\x03\x92\xa0\x10\xf4\x80"
+		"\x4c\x50\x19\xf4\x80\x64\x50\x04\x3d\x40\x12\x14\x2c\x88\x01\x00\x02\x82\x16\x48"
+		"\x07\x4d\x20\x06\x04\x40\x1b\x20\x09\x0a\x41\x0f\x48\x04\x45\xd0\x0f\x48\x82\x62"
+		"\xd0\x03\x32\x41\x11\xf4\x01\x92\xa0\x10\xf4\x80\x4c\x50\x0c\x7a\x40\x64\x50\x04"
+		"\x3d\x40\x12\x14\x83\x1e\x90\x16\x14\x41\x1f\x90\x04\x85\xa0\x07\xa4\x82\x46\xd0"
+		"\x07\x24\x41\x25\xe8\x01\x91\xa0\x10\xf4\x01\xc9\xa0\xa8\x90\x55\x28\x7a\xb5\xb7"
+		"\xc4\x7c\x5c\x81\x47\xa5\x22\x88\xa3\xf6\x09\xd0\x91\xe9\x97\x52\x31\x41\xc2\x6e"
+		"\x71\x52\x31\xe2\x28\x7f\x1a\x74\x34\xfa\x95\x54\x04\x90\x50\xb6\x88\x54\x74\x39"
+		"\xca\x9f\x23\x3a\x82\x7e\x21\x15\x03\x24\xc4\x2d\x1e\x15\x49\x1c\xe5\x4f\x80\x8e"
+		"\x4c\xbf\x8e\x8a\x09\x12\x76\x8b\x8d\x8a\x11\x47\xf9\xd3\xa0\xa3\xd1\xaf\x30\x2a"
+		"\x7e\x9c\xcf\xfb\x59\xef\x0f\xce\x3e\xf8\xf9\xa8\xf2\xe7\x18\x1f\xfe\xfc\x31\xd9"
+		"\x87\x3c\x1f\x57\x7e\x66\xf3\xc1\x7c\xd4\x4f\xf9\x79\x3e\xe4\x27\xfa\x3c\x1f\xf9"
+		"\x33\x7e\x1e\x1f\xf9\x89\x3f\xcf\x47\xfa\x84\x9f\xc7\x47\x7e\xc2\xcf\xf3\x51\x3f"
+		"\xf1\xf3\xf3\x91\x9f\xf2\xf3\x7c\xcc\x4f\xfc\xec\x7c\xe4\xa7\xfc\x3c\x3f\xf2\x13"
+		"\x7f\x1e\x1f\xe9\x13\x3f\xcf\x8f\xfc\xc4\x9f\xe7\x43\xfd\xc4\xcf\xe3\x23\x3f\xf1"
+		"\xe7\xf9\x58\x3f\xf1\xf3\xf9\xc8\x4f\xf8\x79\x3e\xe6\x67\xfc\x79\x3e\xf2\x27\x7e"
+		"\x1e\x1f\xf9\x09\x7f\x9e\x8f\xfa\x89\x9f\xcf\x47\x7e\xc2\x8f\xe7\xa3\x7e\x32\xb2"
+		"\x84\x9f\xaf\x56\x02\x1f\xab\x92\xe0\xa7\x2b\x90\xf0\xf3\xea\x23\xf0\x61\x95\x11"
+		"\xfc\xb4\xa2\x08\x3f\x5f\x4d\x04\x3e\x56\x5d\x86\x20\xa8\x15\x42\xe8\x79\x78\xa4"
+		"\xe6\x21\x9e\x84\x67\x79\xda\x9e\xc9\xa3\x79\xe0\x4d\x24\xac\x8b\x6d\x8a\x2b\xa2"
+		"\x8d\x16\x3d\xa4\xbb\x10\x67\xa4\xd3\x12\x9d\x1e\x7d\xac\x68\xa3\x6e\xdb\x28\xa7"
+		"\x6e\xff\xc5\x59\x45\xa0\x8f\x1a\xfc\x45\xe9\x51\xf4\xc5\x51\xdd\x14\x8d\x02\x08"
+		"\xbb\x00\x44\xe9\x10\x9a\x2f\x21\x37\x5d\x46\x2f\xcb\x51\x17\xa3"
+		, 2256),
+};
+
+const std::vector<std::string> expected_messages = {
+	"{\"t\":null,\"s\":null,\"op\":10,\"d\":{\"heartbeat_interval\":41250,\"_trace\":[\"[\\\"gateway-prd-us-east1-b-0r7w\\\",{\\\"micros\\\":0.0}]\"]}}",
+	"{\"t\":null,\"s\":null,\"op\":11,\"d\":null}",
+	"{\"t\":\"MESSAGE_CREATE\",\"s\":2,\"op\":0,\"d\":{\"type\":0,\"tts\":false,\"timestamp\":\"2021-09-21T18:06:33.515000+00:00\",\"pinned\":false,\"mentions\":[],\"mention_roles\":[],\"mention_everyone\":false,\"id\":\"889932519120273428\",\"guild_id\":\"825407338755653642\",\"channel_id\":\"828681546533437471\",\"author\":{\"username\":\"test\",\"id\":\"189759562910400512\",\"discriminator\":\"0001\",\"avatar\":null},\"content\":\"zstd stream test message\"}}",
+};
+
+const size_t MEMBER_CHUNK_SIZE = 127812;
+
+/* Check the fourth message without keeping all of it here */
+void check_member_chunk(const std::string& message) {
+	CHECK_EQUAL(message.size(), MEMBER_CHUNK_SIZE);
+	nlohmann::json j = nlohmann::json::parse(message, nullptr, false);
+	CHECK(!j.is_discarded());
+	if (!j.is_discarded()) {
+		CHECK(j["t"] == "GUILD_MEMBERS_CHUNK");
+		CHECK(j["s"] == 3);
+		CHECK_EQUAL(j["d"]["members"].size(), 600u);
+		CHECK(j["d"]["members"][599]["user"]["username"] == "member599");
+	}
+}
+
+/* Decompress every captured frame on a new stream, each onto an empty buffer */
+void replay(dpp::zstd_stream& stream) {
+	stream.reset();
+	for (size_t i = 0; i < captured_frames.size(); ++i) {
+		std::string message, error;
+		CHECK_EQUAL(stream.decompress(captured_frames[i], message, 1024 * 1024, error), dpp::zs_ok);
+		CHECK(error.empty());
+		if (i < expected_messages.size()) {
+			CHECK_EQUAL(message, expected_messages[i]);
+		} else {
+			check_member_chunk(message);
+		}
+	}
+}
+
+void test_replay() {
+	dpp::zstd_stream stream;
+	replay(stream);
+	/* Reconnecting starts a new stream with the same state */
+	replay(stream);
+}
+
+/* The frames only make sense in order, on the stream that compressed them */
+void test_out_of_order() {
+	dpp::zstd_stream stream;
+	stream.reset();
+	std::string message, error;
+	/* Skipping HELLO leaves the heartbeat ACK without the frame header, which came first */
+	CHECK_EQUAL(stream.decompress(captured_frames[1], message, 1024 * 1024, error), dpp::zs_corrupt);
+	CHECK(!error.empty());
+
+	/* Garbage is rejected too */
+	stream.reset();
+	error.clear();
+	CHECK_EQUAL(stream.decompress(std::string(64, '\x5a'), message, 1024 * 1024, error), dpp::zs_corrupt);
+	CHECK(!error.empty());
+
+	/* After a reset the stream is usable again */
+	replay(stream);
+}
+
+/* A message over the limit is refused, at whatever point the output passes it */
+void test_too_big() {
+	dpp::zstd_stream stream;
+	stream.reset();
+	std::string message, error;
+	for (size_t i = 0; i < expected_messages.size(); ++i) {
+		message.clear();
+		CHECK_EQUAL(stream.decompress(captured_frames[i], message, 100000, error), dpp::zs_ok);
+	}
+	message.clear();
+	CHECK_EQUAL(stream.decompress(captured_frames[3], message, 100000, error), dpp::zs_too_big);
+	CHECK(!error.empty());
+
+	/* The limit is inclusive */
+	stream.reset();
+	for (size_t i = 0; i < captured_frames.size(); ++i) {
+		message.clear();
+		CHECK_EQUAL(stream.decompress(captured_frames[i], message, MEMBER_CHUNK_SIZE, error), dpp::zs_ok);
+	}
+}
+
+/* Without libzstd, zstd-stream can't be used at all */
+void test_unavailable() {
+	dpp::zstd_stream stream;
+	bool thrown = false;
+	try {
+		stream.reset();
+	}
+	catch (const dpp::exception&) {
+		thrown = true;
+	}
+	CHECK(thrown);
+	std::string message, error;
+	CHECK_EQUAL(stream.decompress(captured_frames[0], message, 1024 * 1024, error), dpp::zs_corrupt);
+	CHECK(!error.empty());
+}
+
+int main() {
+	if (dpp::zstd_stream::available()) {
+		test_replay();
+		test_out_of_order();
+		test_too_big();
+	} else {
+		test_unavailable();
+	}
+	return UNITTEST_RESULT();
+}